@@ -1,10 +1,11 @@
 
 
-QT       += core gui network
+QT       += core gui network concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TEMPLATE = app
+CONFIG += c++11
 DEFINES += QT_DEPRECATED_WARNINGS
 
 
@@ -15,11 +16,59 @@ SOURCES += main.cpp\
     imagecontainer.cpp \
     colorboard.cpp \
     colorlabel.cpp \
-    util.cpp
+    util.cpp \
+    paletteengine.cpp \
+    paletteserver.cpp \
+    paletteloadtest.cpp \
+    palettemap.cpp \
+    imageloader.cpp \
+    colormanagement.cpp \
+    memorybudget.cpp \
+    resampler.cpp \
+    benchmarks.cpp \
+    oklab.cpp \
+    colorindex.cpp \
+    colorsearchdialog.cpp \
+    tilehash.cpp \
+    imagecanvas.cpp \
+    loupe.cpp \
+    histogrampanel.cpp \
+    startup.cpp \
+    paletteexport.cpp \
+    saliency.cpp \
+    sequencereader.cpp \
+    perceptualhash.cpp
 
 HEADERS  += mainwindow.h \
     workarea.h \
     imagecontainer.h \
     colorboard.h \
     colorlabel.h \
-    util.h
+    util.h \
+    paletteengine.h \
+    paletteserver.h \
+    paletteloadtest.h \
+    palettemap.h \
+    imageloader.h \
+    colormanagement.h \
+    memorybudget.h \
+    resampler.h \
+    benchmarks.h \
+    oklab.h \
+    colorindex.h \
+    colorsearchdialog.h \
+    tilehash.h \
+    imagecanvas.h \
+    loupe.h \
+    histogrampanel.h \
+    startup.h \
+    paletteexport.h \
+    saliency.h \
+    sequencereader.h \
+    perceptualhash.h
+
+# make startupbench: start the app, time main() to the first painted frame, fail over the threshold.
+isEmpty(STARTUP_THRESHOLD_MS): STARTUP_THRESHOLD_MS = 800
+startupbench.commands = $$OUT_PWD/$$TARGET --startup-benchmark --startup-threshold $$STARTUP_THRESHOLD_MS
+startupbench.depends = first
+QMAKE_EXTRA_TARGETS += startupbench
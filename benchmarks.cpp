@@ -0,0 +1,271 @@
+#include "benchmarks.h"
+#include "resampler.h"
+#include "imageloader.h"
+#include "paletteengine.h"
+#include "perceptualhash.h"
+#include <QImage>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QVector>
+#include <QtMath>
+
+namespace {
+
+/*
+ * Exact area average in double, the reference every downscaler is compared to.
+ */
+QImage areaAverage(const QImage &image, const QSize &size)
+{
+    QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage target(size, QImage::Format_ARGB32_Premultiplied);
+    double scaleX = double(source.width()) / size.width();
+    double scaleY = double(source.height()) / size.height();
+
+    for(int y = 0; y < size.height(); y++) {
+        double top = y * scaleY, bottom = (y + 1) * scaleY;
+        QRgb *out = reinterpret_cast<QRgb *>(target.scanLine(y));
+        for(int x = 0; x < size.width(); x++) {
+            double left = x * scaleX, right = (x + 1) * scaleX;
+            double sum[4] = {0.0, 0.0, 0.0, 0.0};
+            for(int sy = int(top); sy < qMin(source.height(), int(qCeil(bottom))); sy++) {
+                double coverY = qMin(bottom, sy + 1.0) - qMax(top, double(sy));
+                const QRgb *in = reinterpret_cast<const QRgb *>(source.constScanLine(sy));
+                for(int sx = int(left); sx < qMin(source.width(), int(qCeil(right))); sx++) {
+                    double cover = coverY * (qMin(right, sx + 1.0) - qMax(left, double(sx)));
+                    sum[0] += qRed(in[sx]) * cover;
+                    sum[1] += qGreen(in[sx]) * cover;
+                    sum[2] += qBlue(in[sx]) * cover;
+                    sum[3] += qAlpha(in[sx]) * cover;
+                }
+            }
+            double area = scaleX * scaleY;
+            out[x] = qRgba(qRound(sum[0] / area), qRound(sum[1] / area),
+                           qRound(sum[2] / area), qRound(sum[3] / area));
+        }
+    }
+    return target;
+}
+
+double psnr(const QImage &a, const QImage &b)
+{
+    QImage first = a.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage second = b.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    double error = 0.0;
+    for(int y = 0; y < first.height(); y++) {
+        const QRgb *p = reinterpret_cast<const QRgb *>(first.constScanLine(y));
+        const QRgb *q = reinterpret_cast<const QRgb *>(second.constScanLine(y));
+        for(int x = 0; x < first.width(); x++) {
+            int dr = qRed(p[x]) - qRed(q[x]);
+            int dg = qGreen(p[x]) - qGreen(q[x]);
+            int db = qBlue(p[x]) - qBlue(q[x]);
+            error += dr * dr + dg * dg + db * db;
+        }
+    }
+    error /= 3.0 * first.width() * first.height();
+    return error == 0.0 ? 99.0 : 10.0 * log10(255.0 * 255.0 / error);
+}
+
+/*
+ * A synthetic image with fine stripes and a gradient, which shows aliasing clearly.
+ */
+QImage syntheticImage()
+{
+    QImage image(3000, 2000, QImage::Format_RGB32);
+    for(int y = 0; y < image.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for(int x = 0; x < image.width(); x++) {
+            int stripe = ((x / 2 + y / 3) & 1) * 255;
+            line[x] = qRgb(stripe, x * 255 / image.width(), y * 255 / image.height());
+        }
+    }
+    return image;
+}
+
+}
+
+/**
+ * @brief runResampleBenchmark
+ * @param fileName the image to shrink, or empty for a synthetic one.
+ * @param size the target size, fitted in the image's aspect ratio.
+ * @param iterations how many times every filter runs.
+ * @return the process exit code.
+ *
+ * Compare the resampler with QImage::scaled(), by time and by PSNR against an exact area
+ * average.
+ */
+int runResampleBenchmark(const QString &fileName, const QSize &size, int iterations)
+{
+    QTextStream out(stdout);
+    out.setFieldAlignment(QTextStream::AlignLeft);
+
+    QImage image = fileName.isEmpty() ? syntheticImage() : readImage(fileName);
+    if(image.isNull()) {
+        QTextStream(stderr) << "Can't read " << fileName << '\n';
+        return 1;
+    }
+
+    QSize target = image.size().scaled(size, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    iterations = qMax(1, iterations);
+    QImage reference = areaAverage(image, target);
+
+    out << image.width() << "*" << image.height() << " -> " << target.width() << "*" << target.height()
+        << ", " << iterations << " iterations\n";
+    out.flush();
+
+    const char *names[] = {"box", "bilinear", "lanczos3", "QImage::scaled"};
+    for(int method = 0; method < 4; method++) {
+        QImage result;
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0; i < iterations; i++) {
+            if(method < 3) {
+                result = resampleImage(image, target, ResampleFilter(method));
+            }
+            else {
+                result = image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+        }
+        double ms = timer.nsecsElapsed() / 1e6 / iterations;
+
+        out << qSetFieldWidth(16) << names[method] << qSetFieldWidth(0)
+            << QString::number(ms, 'f', 2) << " ms, PSNR "
+            << QString::number(psnr(result, reference), 'f', 2) << " dB\n";
+        out.flush();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief runPaletteBenchmark
+ * @param fileName the image to analyse, or empty for a synthetic one.
+ * @param colorCount the palette size.
+ * @param iterations how many times every mode runs.
+ * @param maximumRatio the accepted cost of the perceptual mode, relative to the RGB mode.
+ * @return the process exit code, 1 if the perceptual mode is too slow.
+ *
+ * Time the whole palette computation (histogram and quantization) in both modes.
+ */
+int runPaletteBenchmark(const QString &fileName, int colorCount, int iterations, double maximumRatio)
+{
+    QTextStream out(stdout);
+    out.setFieldAlignment(QTextStream::AlignLeft);
+
+    QImage image = fileName.isEmpty() ? syntheticImage() : readImage(fileName);
+    if(image.isNull()) {
+        QTextStream(stderr) << "Can't read " << fileName << '\n';
+        return 1;
+    }
+    iterations = qMax(1, iterations);
+
+    out << image.width() << "*" << image.height() << ", " << colorCount << " colors, " << iterations
+        << " iterations\n";
+    out.flush();
+
+    const char *names[] = {"rgb", "perceptual"};
+    double ms[2];
+    for(int mode = 0; mode < 2; mode++) {
+        QVector<QColor> palette;
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0; i < iterations; i++) {
+            palette = computePalette(image, colorCount, QuantizeMode(mode));
+        }
+        ms[mode] = timer.nsecsElapsed() / 1e6 / iterations;
+
+        out << qSetFieldWidth(16) << names[mode] << qSetFieldWidth(0)
+            << QString::number(ms[mode], 'f', 2) << " ms";
+        for(int i = 0; i < palette.size(); i++) {
+            out << " " << palette[i].name();
+        }
+        out << '\n';
+        out.flush();
+    }
+
+    double ratio = ms[1] / qMax(ms[0], 1e-6);
+    out << (ratio <= maximumRatio ? "PASS" : "FAIL") << ": perceptual costs " << QString::number(ratio, 'f', 2)
+        << "x the rgb mode, limit " << maximumRatio << "x\n";
+    return ratio <= maximumRatio ? 0 : 1;
+}
+
+/**
+ * @brief runHashBenchmark
+ * @param fileName the image to hash, or empty for a synthetic JPEG.
+ * @param iterations how many times the file is hashed and decoded.
+ * @param maximumRatio the accepted cost of the hash, relative to a full decode.
+ * @return the process exit code, 1 if the hash is too slow or misses a re-export.
+ *
+ * Time the perceptual hash (small decode and DCT) against readImage(), then check that a
+ * half size, lower quality re-export of the image is found as a near duplicate and its mirror
+ * image is not.
+ */
+int runHashBenchmark(const QString &fileName, int iterations, double maximumRatio)
+{
+    QTextStream out(stdout);
+    out.setFieldAlignment(QTextStream::AlignLeft);
+
+    QTemporaryFile synthetic(QDir::tempPath() + "/hashbenchXXXXXX.jpg");
+    QString path = fileName;
+    if(path.isEmpty()) {
+        if(!synthetic.open() || !syntheticImage().save(&synthetic, "JPG", 90)) {
+            QTextStream(stderr) << "Can't write a synthetic image\n";
+            return 1;
+        }
+        synthetic.close();
+        path = synthetic.fileName();
+    }
+
+    QImage image = readImage(path);
+    if(image.isNull()) {
+        QTextStream(stderr) << "Can't read " << path << '\n';
+        return 1;
+    }
+    iterations = qMax(1, iterations);
+
+    out << image.width() << "*" << image.height() << ", " << iterations << " iterations\n";
+    out.flush();
+
+    PerceptualHash hash;
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < iterations; i++) {
+        hash = readPerceptualHash(path);
+    }
+    double hashMs = timer.nsecsElapsed() / 1e6 / iterations;
+
+    timer.restart();
+    for(int i = 0; i < iterations; i++) {
+        image = readImage(path);
+    }
+    double decodeMs = timer.nsecsElapsed() / 1e6 / iterations;
+
+    QImage copy = resampleImage(image, image.size() / 2, BoxFilter);
+    QTemporaryFile reexport(QDir::tempPath() + "/hashbenchXXXXXX.jpg");
+    if(!reexport.open() || !copy.save(&reexport, "JPG", 70)) {
+        QTextStream(stderr) << "Can't write the re-exported image\n";
+        return 1;
+    }
+    reexport.close();
+    PerceptualHash copyHash = readPerceptualHash(reexport.fileName());
+    PerceptualHash mirrorHash = computePerceptualHash(image.mirrored(true, false));
+
+    out << qSetFieldWidth(16) << "hash" << qSetFieldWidth(0) << QString::number(hashMs, 'f', 2)
+        << " ms, " << QString::number(hash.bits, 16) << '\n';
+    out << qSetFieldWidth(16) << "full decode" << qSetFieldWidth(0) << QString::number(decodeMs, 'f', 2)
+        << " ms\n";
+    out << "re-export: " << hammingDistance(hash.bits, copyHash.bits) << " bits apart, mirror: "
+        << hammingDistance(hash.bits, mirrorHash.bits) << " bits apart\n";
+
+    double ratio = hashMs / qMax(decodeMs, 1e-6);
+    bool found = isNearDuplicate(hash, copyHash) && !isNearDuplicate(hash, mirrorHash);
+    bool pass = ratio <= maximumRatio && found;
+    out << (pass ? "PASS" : "FAIL") << ": the hash costs " << QString::number(ratio, 'f', 2)
+        << "x a full decode, limit " << maximumRatio << "x";
+    if(!found) {
+        out << ", near duplicates not told apart";
+    }
+    out << '\n';
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+#include <QSize>
+
+int runResampleBenchmark(const QString &fileName, const QSize &size, int iterations);
+int runPaletteBenchmark(const QString &fileName, int colorCount, int iterations, double maximumRatio);
+int runHashBenchmark(const QString &fileName, int iterations, double maximumRatio);
+
+#endif // BENCHMARKS_H
@@ -1,6 +1,8 @@
 #include "colorboard.h"
 #include "colorlabel.h"
 #include "util.h"
+#include "paletteengine.h"
+#include "memorybudget.h"
 #include <QLabel>
 #include <QGridLayout>
 #include <QVector>
@@ -9,14 +11,35 @@
 #include <QBrush>
 #include <QPointF>
 #include <QPainter>
+#include <QSettings>
 
 ColorBoard::ColorBoard(QWidget *parent) : QWidget(parent)
 {
     layout = new QGridLayout(this);
+    colorCount = 7;
+    currentFrame = 0;
+    frameHistogramsEntry = 0;
+    quantizeMode = QSettings("MyPaint", "MyPaint").value("perceptualPalette", false).toBool() ? PerceptualQuantize
+                                                                                            : RgbQuantize;
+    pixelWeighting = QSettings("MyPaint", "MyPaint").value("salientPalette", false).toBool() ? SaliencyWeighting
+                                                                                           : UniformWeighting;
 
     text = new QLabel(tr("Open an image first."), this);
     text->setAlignment(Qt::AlignCenter);
-    layout->addWidget(text, 0, 0, 1, 3);
+    layout->addWidget(text, 0, 0, 1, 2);
+
+    // Only multi-frame images (animations, multi-page files) can show the colors of all frames.
+    allFramesCheckBox = new QCheckBox(tr("All frames"), this);
+    allFramesCheckBox->setVisible(false);
+    layout->addWidget(allFramesCheckBox, 0, 2, 1, 1);
+    connect(allFramesCheckBox, SIGNAL(toggled(bool)), SLOT(showAllFramesColors(bool)));
+
+    layout->setColumnMinimumWidth(0, 50);
+}
+
+ColorBoard::~ColorBoard()
+{
+    MemoryBudget::instance()->unregisterEntry(frameHistogramsEntry);
 }
 
 QVector<ColorLabel *> ColorBoard::getColorLabels() const
@@ -24,53 +47,267 @@ QVector<ColorLabel *> ColorBoard::getColorLabels() const
     return colorLabels;
 }
 
+QVector<QColor> ColorBoard::getColors() const
+{
+    return colors;
+}
+
+int ColorBoard::getColorCount() const
+{
+    return colorCount;
+}
+
 /**
- * @brief ColorBoard::setColorLabels
+ * @brief ColorBoard::getHistogram
+ * @return the palette histogram of all frames together.
+ */
+const ColorHistogram &ColorBoard::getHistogram() const
+{
+    return histogram;
+}
+
+/**
+ * @brief ColorBoard::getFrameHistogram
+ * @return the palette histogram of the frame shown, or nullptr if it isn't kept (evicted, or
+ * not read yet).
+ */
+const ColorHistogram *ColorBoard::getFrameHistogram() const
+{
+    if(currentFrame < frameHistograms.size() && !frameHistograms[currentFrame].isEmpty()) {
+        return &frameHistograms[currentFrame];
+    }
+    if(frameColors.size() == 1 && !histogram.isEmpty()) {
+        return &histogram;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief ColorBoard::setFrameHistogram
+ * @param index the frame index.
+ * @param histogram the palette histogram of the frame.
  *
- * If the color vector is empty (the first time to load image), create all member of the class.
- * Else change these relating variables.
+ * The histograms of a sequence come frame by frame with their palettes.
  */
-void ColorBoard::setColorLabels()
+void ColorBoard::setFrameHistogram(int index, const ColorHistogram &histogram)
 {
-    if(colors.empty()) {
-        createColorLabels();
+    if(index < 0 || index >= frameColors.size()) {
+        return;
     }
-    else {
-        changeColorLabels();
+    if(frameHistograms.size() != frameColors.size()) {
+        frameHistograms.resize(frameColors.size());
+    }
+    frameHistograms[index] = histogram;
+    registerFrameHistograms();
+}
+
+/**
+ * @brief ColorBoard::registerFrameHistograms
+ *
+ * Count the kept frame histograms in the memory budget. Counting the frames again costs more
+ * than their histograms weigh, but they can be dropped: the histogram panel then counts the
+ * frame it shows.
+ */
+void ColorBoard::registerFrameHistograms()
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+    qint64 bytes = 0;
+    for(int i = 0; i < frameHistograms.size(); i++) {
+        if(!frameHistograms[i].isEmpty()) {
+            bytes += qint64(ColorHistogram::BinCount) * sizeof(quint32);
+        }
+    }
+
+    if(frameHistogramsEntry != 0) {
+        budget->updateEntry(frameHistogramsEntry, bytes);
+    }
+    else if(bytes > 0) {
+        frameHistogramsEntry = budget->registerEntry("frame histograms", bytes, bytes, [this]() {
+            frameHistograms.clear();
+            frameHistogramsEntry = 0;
+        });
     }
 }
 
+QuantizeMode ColorBoard::getQuantizeMode() const
+{
+    return quantizeMode;
+}
+
+/**
+ * @brief ColorBoard::setQuantizeMode
+ * @param mode the color space the palettes are computed in.
+ *
+ * It's kept in the settings. The colors shown change when the image is analysed again.
+ */
+void ColorBoard::setQuantizeMode(QuantizeMode mode)
+{
+    quantizeMode = mode;
+    QSettings("MyPaint", "MyPaint").setValue("perceptualPalette", mode == PerceptualQuantize);
+}
+
+PixelWeighting ColorBoard::getPixelWeighting() const
+{
+    return pixelWeighting;
+}
+
+/**
+ * @brief ColorBoard::setPixelWeighting
+ * @param weighting how much every pixel counts in the palettes.
+ *
+ * It's kept in the settings. The colors shown change when the image is analysed again.
+ */
+void ColorBoard::setPixelWeighting(PixelWeighting weighting)
+{
+    pixelWeighting = weighting;
+    QSettings("MyPaint", "MyPaint").setValue("salientPalette", weighting == SaliencyWeighting);
+}
+
+/**
+ * @brief ColorBoard::setColorLabels
+ * @param frames the frames of the image just loaded, a single image has one frame.
+ *
+ * Compute the main colors of every frame and of all frames, and show the colors of the first
+ * frame.
+ */
+void ColorBoard::setColorLabels(const QVector<QImage> &frames)
+{
+    computeMainColor(frames);
+
+    currentFrame = 0;
+    allFramesCheckBox->setVisible(frames.size() > 1);
+    changeColorLabels();
+}
+
 /**
  * @brief ColorBoard::computeMainColor
+ * @param frames the frames to analyse.
  *
  * The core algoritem of compute the main color of the image.
- * MMCQ (Modified Median Cut Quantization)
+ * MMCQ (Modified Median Cut Quantization), see paletteengine.cpp.
  */
-void ColorBoard::computeMainColor()
+void ColorBoard::computeMainColor(const QVector<QImage> &frames)
 {
-    colors.push_back(QColor("#feb3b0"));
-    colors.push_back(QColor("#3b3c5a"));
-    colors.push_back(QColor("#0d0e23"));
-    colors.push_back(QColor("#706182"));
-    colors.push_back(QColor("#fce4fc"));
-    colors.push_back(QColor("#706182"));
-    colors.push_back(QColor("#706182"));
+    FramePalettes palettes = computeFramePalettes(frames, colorCount, quantizeMode, pixelWeighting);
+
+    histogram = palettes.histogram;
+    globalColors = palettes.globalPalette;
+    frameColors = palettes.framePalettes;
+    frameHistograms = palettes.frameHistograms;
+    registerFrameHistograms();
+}
+
+/**
+ * @brief ColorBoard::updateColorLabels
+ * @param previousFrames the frames before the file changed.
+ * @param frames the frames now.
+ * @param tiles the changed tiles of every frame.
+ *
+ * Only the changed tiles are counted again: their old pixels are removed from the histogram
+ * and their new pixels added, and so in the histogram of their frame when it's kept. A frame
+ * whose histogram was dropped is analysed again, the unchanged frames are not.
+ *
+ * With saliency weighting a changed tile changes the saliency of its surrounding too, so the
+ * frames are analysed again completely.
+ */
+void ColorBoard::updateColorLabels(const QVector<QImage> &previousFrames, const QVector<QImage> &frames,
+                                   const QVector<QVector<QRect> > &tiles)
+{
+    if(pixelWeighting == SaliencyWeighting) {
+        computeMainColor(frames);
+        changeColorLabels();
+        return;
+    }
+
+    bool kept = frameHistograms.size() == tiles.size();
+    for(int i = 0; i < tiles.size(); i++) {
+        for(int j = 0; j < tiles[i].size(); j++) {
+            histogram.add(previousFrames[i], tiles[i][j], -1);
+            histogram.add(frames[i], tiles[i][j], 1);
+            if(kept) {
+                frameHistograms[i].add(previousFrames[i], tiles[i][j], -1);
+                frameHistograms[i].add(frames[i], tiles[i][j], 1);
+            }
+        }
+        if(frameColors.size() > 1 && !tiles[i].isEmpty()) {
+            frameColors[i] = kept ? quantizeHistogram(frameHistograms[i], colorCount, quantizeMode)
+                                  : computePalette(frames[i], colorCount, quantizeMode);
+        }
+    }
+
+    globalColors = quantizeHistogram(histogram, colorCount, quantizeMode);
+    if(frameColors.size() == 1) {
+        frameColors[0] = globalColors;
+    }
+    changeColorLabels();
 }
 
 /**
- * @brief ColorBoard::createColorLabels
+ * @brief ColorBoard::startSequence
+ * @param frameCount the frame count of the sequence just opened.
  *
- * create these relating variables and add them to a grid layout.
+ * The palettes of a sequence are computed by the sequence reader and come frame by frame, the
+ * palette of all frames comes when every frame is read.
  */
-void ColorBoard::createColorLabels()
+void ColorBoard::startSequence(int frameCount)
 {
-    text->setText(tr("Image main color"));
+    frameColors.clear();
+    frameColors.resize(frameCount);
+    globalColors.clear();
+    histogram.clear();
+    frameHistograms.clear();
+    registerFrameHistograms();
 
-    computeMainColor();
+    currentFrame = 0;
+    allFramesCheckBox->setVisible(frameCount > 1);
+    changeColorLabels();
+}
+
+/**
+ * @brief ColorBoard::setFrameColors
+ * @param index the frame index.
+ * @param colors the main colors of the frame.
+ *
+ * It's a slot function.
+ */
+void ColorBoard::setFrameColors(int index, const QVector<QColor> &colors)
+{
+    if(index < 0 || index >= frameColors.size()) {
+        return;
+    }
+    frameColors[index] = colors;
+    if(frameColors.size() == 1) {
+        globalColors = colors;
+    }
+    if(index == currentFrame || frameColors.size() == 1) {
+        changeColorLabels();
+    }
+}
+
+/**
+ * @brief ColorBoard::setGlobalColors
+ * @param colors the main colors of all frames.
+ *
+ * It's a slot function.
+ */
+void ColorBoard::setGlobalColors(const QVector<QColor> &colors)
+{
+    globalColors = colors;
+    if(frameColors.size() <= 1 || allFramesCheckBox->isChecked()) {
+        changeColorLabels();
+    }
+}
 
+/**
+ * @brief ColorBoard::addColorLabels
+ *
+ * Create a color label and a color value label for every color and add them to the grid layout.
+ */
+void ColorBoard::addColorLabels()
+{
     QVector<QColor>::const_iterator it;
     for(it = colors.constBegin(); it != colors.constEnd(); it++) {
-        int index = it - colors.begin();
+        int index = it - colors.constBegin();
 
         ColorLabel *colorLabel = new ColorLabel(*it, this);
 
@@ -90,22 +327,43 @@ void ColorBoard::createColorLabels()
 
         layout->addWidget(colorValueLabel, index * 3 + 1, 2, 3, 1);
     }
+}
 
-    layout->setColumnMinimumWidth(0, 50);
-    setLayout(layout);
+/**
+ * @brief ColorBoard::removeColorLabels
+ *
+ * Remove all color labels and color value labels from the grid layout.
+ */
+void ColorBoard::removeColorLabels()
+{
+    for(int i = 0; i < colorLabels.size(); i++) {
+        layout->removeWidget(colorLabels[i]);
+        layout->removeWidget(colorValueLabels[i]);
+        colorLabels[i]->deleteLater();
+        colorValueLabels[i]->deleteLater();
+    }
+    colorLabels.clear();
+    colorValueLabels.clear();
 }
 
 /**
  * @brief ColorBoard::changeColorLabels
  *
+ * Show the colors of the current frame, or of all frames.
  * If the color label number doesn't change, change the relating variables, it's easy.
- * Thinking about the condition that users change the color label number in the setting,
- * we should do more actions.
+ * A simple image may have fewer main colors than the color label number, and users can change
+ * the color label number in the setting, then the labels are created again.
  */
 void ColorBoard::changeColorLabels()
 {
-    colors.clear();
-    computeMainColor();
+    if(frameColors.size() <= 1 || allFramesCheckBox->isChecked()) {
+        colors = globalColors;
+        text->setText(frameColors.size() <= 1 ? tr("Image main color") : tr("All frames main color"));
+    }
+    else {
+        colors = frameColors[currentFrame];
+        text->setText(tr("Frame %1 main color").arg(currentFrame + 1));
+    }
 
     if(colorLabels.size() == colors.size()) {
         QVector<QColor>::const_iterator it;
@@ -119,8 +377,41 @@ void ColorBoard::changeColorLabels()
             colorLabels[index]->setColor(*it);
         }
     }
+    else {
+        removeColorLabels();
+        addColorLabels();
+    }
+
+    emit colorsChangeSignal();
+}
+
+/**
+ * @brief ColorBoard::showFrameColors
+ * @param index the frame shown in the image container.
+ *
+ * It's a slot function.
+ * When users move the frame scrubber, show the main colors of that frame.
+ */
+void ColorBoard::showFrameColors(int index)
+{
+    if(index < 0 || index >= frameColors.size()) {
+        return;
+    }
+    currentFrame = index;
+    changeColorLabels();
 }
 
+/**
+ * @brief ColorBoard::showAllFramesColors
+ * @param checked whether the main colors of all frames are shown.
+ *
+ * It's a slot function.
+ */
+void ColorBoard::showAllFramesColors(bool checked)
+{
+    Q_UNUSED(checked);
+    changeColorLabels();
+}
 
 void ColorBoard::sendCopySuccessSignal()
 {
@@ -5,32 +5,63 @@
 #include <QLabel>
 #include <QGridLayout>
 #include <QVector>
+#include <QImage>
+#include <QCheckBox>
 
 #include "colorlabel.h"
+#include "paletteengine.h"
 
 class ColorBoard : public QWidget
 {
     Q_OBJECT
 public:
     explicit ColorBoard(QWidget *parent = 0);
+    ~ColorBoard();
 
     QVector<ColorLabel *> getColorLabels() const;
-    void setColorLabels();
+    QVector<QColor> getColors() const;
+    int getColorCount() const;
+    const ColorHistogram &getHistogram() const;
+    const ColorHistogram *getFrameHistogram() const;
+    void setFrameHistogram(int index, const ColorHistogram &histogram);
+    QuantizeMode getQuantizeMode() const;
+    void setQuantizeMode(QuantizeMode mode);
+    PixelWeighting getPixelWeighting() const;
+    void setPixelWeighting(PixelWeighting weighting);
+    void setColorLabels(const QVector<QImage> &frames);
+    void updateColorLabels(const QVector<QImage> &previousFrames, const QVector<QImage> &frames,
+                           const QVector<QVector<QRect> > &tiles);
+    void startSequence(int frameCount);
 private:
     QGridLayout *layout;
-    QVector<QColor> colors;
+    int colorCount, currentFrame;
+    QuantizeMode quantizeMode;
+    PixelWeighting pixelWeighting;
+    QVector<QColor> colors, globalColors;
+    QVector<QVector<QColor> > frameColors;
+    ColorHistogram histogram;
+    QVector<ColorHistogram> frameHistograms;
+    int frameHistogramsEntry;
     QVector<QLabel*> colorValueLabels;
     QVector<ColorLabel*> colorLabels;
     QLabel *text;
+    QCheckBox *allFramesCheckBox;
 
-    void computeMainColor();
-    void createColorLabels();
+    void computeMainColor(const QVector<QImage> &frames);
+    void registerFrameHistograms();
     void changeColorLabels();
+    void addColorLabels();
+    void removeColorLabels();
 
 signals:
     void copySuccessFromColorBoradSignal();
+    void colorsChangeSignal();
 public slots:
     void sendCopySuccessSignal();
+    void showFrameColors(int index);
+    void showAllFramesColors(bool checked);
+    void setFrameColors(int index, const QVector<QColor> &colors);
+    void setGlobalColors(const QVector<QColor> &colors);
 
 };
 
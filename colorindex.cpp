@@ -0,0 +1,445 @@
+#include "colorindex.h"
+#include "paletteengine.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace {
+
+const quint32 IndexMagic = 0x4d504349; // "MPCI"
+const quint32 IndexVersion = 2;
+
+// An entry takes at least this much of the file: the lengths of an empty path and palette, the
+// time and size, the hash bits and the average color.
+const qint64 MinimumEntryBytes = 4 + 8 + 8 + 8 + 4 + 4;
+
+struct HashExtractor
+{
+    typedef ColorIndexEntry result_type;
+
+    QString root;
+
+    ColorIndexEntry operator()(const ColorIndexEntry &entry) const
+    {
+        ColorIndexEntry result = entry;
+        result.hash = readPerceptualHash(root + "/" + entry.path);
+        return result;
+    }
+};
+
+struct PaletteExtractor
+{
+    typedef ColorIndexEntry result_type;
+
+    QString root;
+    int colorCount;
+
+    ColorIndexEntry operator()(const ColorIndexEntry &entry) const
+    {
+        ColorIndexEntry result = entry;
+        QVector<QColor> palette = computeFilePalette(root + "/" + entry.path, colorCount);
+        for(int i = 0; i < palette.size(); i++) {
+            result.palette.push_back(palette[i].rgb());
+        }
+        return result;
+    }
+};
+
+struct AxisLess
+{
+    int axis;
+
+    template <typename T>
+    bool operator()(const T &first, const T &second) const
+    {
+        return first.lab[axis] < second.lab[axis];
+    }
+};
+
+}
+
+ColorIndex::ColorIndex()
+{
+}
+
+/**
+ * @brief ColorIndex::load
+ * @param fileName the index file written by save().
+ * @return whether the file is a valid index.
+ *
+ * The points are stored in tree order, so nothing is rebuilt.
+ */
+bool ColorIndex::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic, version, entryCount, pointCount;
+    in >> magic >> version;
+    if(magic != IndexMagic || version != IndexVersion) {
+        return false;
+    }
+
+    QString newRoot;
+    in >> newRoot >> entryCount;
+    if(in.status() != QDataStream::Ok || qint64(entryCount) > file.size() / MinimumEntryBytes) {
+        return false;
+    }
+    // The count is only an upper bound until the entries are read, a truncated file ends first.
+    QVector<ColorIndexEntry> newEntries;
+    for(quint32 i = 0; i < entryCount && in.status() == QDataStream::Ok; i++) {
+        ColorIndexEntry entry;
+        in >> entry.path >> entry.modified >> entry.size >> entry.hash.bits >> entry.hash.average >> entry.palette;
+        entry.hash.valid = !entry.palette.isEmpty();
+        newEntries.push_back(entry);
+    }
+
+    in >> pointCount;
+    if(in.status() != QDataStream::Ok || qint64(pointCount) * qint64(sizeof(Point)) > file.size()) {
+        return false;
+    }
+    QVector<Point> newPoints(pointCount);
+    int bytes = int(pointCount * sizeof(Point));
+    if(in.readRawData(reinterpret_cast<char *>(newPoints.data()), bytes) != bytes) {
+        return false;
+    }
+    for(int i = 0; i < newPoints.size(); i++) {
+        if(newPoints[i].entry >= entryCount) {
+            return false;
+        }
+    }
+
+    root = newRoot;
+    entries = newEntries;
+    points = newPoints;
+    return true;
+}
+
+/**
+ * @brief ColorIndex::save
+ * @param fileName the index file.
+ * @return whether the file is written.
+ *
+ * The points are written as they are in memory (little endian floats on every platform the
+ * app is built for). The file is replaced only when it's completely written.
+ */
+bool ColorIndex::save(const QString &fileName) const
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << IndexMagic << IndexVersion << root << quint32(entries.size());
+    for(int i = 0; i < entries.size(); i++) {
+        out << entries[i].path << entries[i].modified << entries[i].size << entries[i].hash.bits
+            << entries[i].hash.average << entries[i].palette;
+    }
+    out << quint32(points.size());
+    out.writeRawData(reinterpret_cast<const char *>(points.constData()), int(points.size() * sizeof(Point)));
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+/**
+ * @brief ColorIndex::update
+ * @param rootPath the directory to index, with its subdirectories.
+ * @param colorCount the palette size of every image.
+ * @param progress called after every chunk of analysed images, on the calling thread.
+ * @return how many files were added, changed, removed or kept.
+ *
+ * Only files which are new, or whose time or size changed since the last update are decoded
+ * again, so updating a big library after a few edits is fast. Files which can't be decoded are
+ * kept with an empty palette, so they aren't tried again until they change.
+ * Every file is hashed first from a small decode. A near duplicate of an image already analysed
+ * (a re-export, a resized copy) takes its palette and is never decoded in full.
+ */
+ColorIndex::UpdateStats ColorIndex::update(const QString &rootPath, int colorCount, Progress progress)
+{
+    UpdateStats stats = {0, 0, 0, 0, 0};
+
+    QDir rootDir(rootPath);
+    if(rootDir.absolutePath() != root) {
+        entries.clear();
+    }
+    root = rootDir.absolutePath();
+
+    QHash<QString, int> known;
+    for(int i = 0; i < entries.size(); i++) {
+        known.insert(entries[i].path, i);
+    }
+
+    QVector<ColorIndexEntry> kept, pending;
+    QDirIterator it(root, imageNameFilters(), QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        it.next();
+        QFileInfo info = it.fileInfo();
+
+        ColorIndexEntry entry;
+        entry.path = rootDir.relativeFilePath(info.filePath());
+        entry.modified = info.lastModified().toMSecsSinceEpoch();
+        entry.size = info.size();
+
+        QHash<QString, int>::iterator found = known.find(entry.path);
+        if(found == known.end()) {
+            pending.push_back(entry);
+            stats.added++;
+            continue;
+        }
+
+        const ColorIndexEntry &old = entries[found.value()];
+        if(old.modified == entry.modified && old.size == entry.size) {
+            kept.push_back(old);
+            stats.unchanged++;
+        }
+        else {
+            pending.push_back(entry);
+            stats.changed++;
+        }
+        known.erase(found);
+    }
+    stats.removed = known.size();
+
+    NearDuplicateIndex analysed;
+    for(int i = 0; i < kept.size(); i++) {
+        analysed.insert(kept[i].hash, i);
+    }
+
+    HashExtractor hasher;
+    hasher.root = root;
+    PaletteExtractor extractor;
+    extractor.root = root;
+    extractor.colorCount = colorCount;
+    for(int done = 0; done < pending.size(); done += FileChunkSize) {
+        QVector<ColorIndexEntry> chunk =
+                QtConcurrent::blockingMapped<QVector<ColorIndexEntry> >(pending.mid(done, FileChunkSize), hasher);
+
+        // The first image of a group is analysed, the others copy its palette.
+        int base = kept.size();
+        QVector<int> sources(chunk.size());
+        QVector<int> originalPositions;
+        QVector<ColorIndexEntry> originals;
+        for(int i = 0; i < chunk.size(); i++) {
+            sources[i] = analysed.find(chunk[i].hash);
+            if(sources[i] < 0) {
+                analysed.insert(chunk[i].hash, base + i);
+                originalPositions.push_back(i);
+                originals.push_back(chunk[i]);
+            }
+        }
+        originals = QtConcurrent::blockingMapped<QVector<ColorIndexEntry> >(originals, extractor);
+        for(int i = 0; i < originals.size(); i++) {
+            chunk[originalPositions[i]] = originals[i];
+        }
+
+        kept += chunk;
+        for(int i = 0; i < chunk.size(); i++) {
+            if(sources[i] >= 0) {
+                kept[base + i].palette = kept[sources[i]].palette;
+                stats.duplicates++;
+            }
+        }
+        if(progress) {
+            progress(qMin(done + FileChunkSize, pending.size()), pending.size());
+        }
+    }
+
+    entries = kept;
+    buildTree();
+    return stats;
+}
+
+/**
+ * @brief ColorIndex::search
+ * @param color the color to look for.
+ * @param maxResults how many images at most.
+ * @return the images with a palette color closest to the color, closest first.
+ *
+ * The score of an image is the OKLab distance of its closest palette color. Subtrees farther
+ * than the worst image kept so far are skipped, so a query reads a few hundred points of even
+ * a million image index.
+ */
+QVector<ColorMatch> ColorIndex::search(const QColor &color, int maxResults) const
+{
+    QVector<ColorMatch> matches;
+    if(maxResults <= 0 || points.isEmpty()) {
+        return matches;
+    }
+
+    OkLab lab = rgbToOkLab(color.rgb());
+    float query[3] = {lab.L, lab.a, lab.b};
+
+    QVector<Candidate> best;
+    searchTree(0, points.size(), 0, query, maxResults, best);
+
+    for(int i = 0; i < best.size(); i++) {
+        const ColorIndexEntry &entry = entries[best[i].entry];
+
+        // Find which palette color matched, only for the few results.
+        QRgb closest = entry.palette.value(0);
+        float closestDistance = -1.0f;
+        for(int j = 0; j < entry.palette.size(); j++) {
+            float distance = okLabDistanceSquared(rgbToOkLab(entry.palette[j]), lab);
+            if(closestDistance < 0.0f || distance < closestDistance) {
+                closestDistance = distance;
+                closest = entry.palette[j];
+            }
+        }
+
+        ColorMatch match;
+        match.path = root + "/" + entry.path;
+        match.color = QColor(closest);
+        match.distance = qSqrt(best[i].distance);
+        matches.push_back(match);
+    }
+    return matches;
+}
+
+QString ColorIndex::rootPath() const
+{
+    return root;
+}
+
+int ColorIndex::fileCount() const
+{
+    return entries.size();
+}
+
+/**
+ * @brief ColorIndex::sizeInBytes
+ * @return the approximate memory held by the index.
+ */
+qint64 ColorIndex::sizeInBytes() const
+{
+    qint64 bytes = qint64(points.size()) * sizeof(Point);
+    for(int i = 0; i < entries.size(); i++) {
+        bytes += sizeof(ColorIndexEntry) + entries[i].path.size() * 2 + entries[i].palette.size() * sizeof(QRgb);
+    }
+    return bytes;
+}
+
+QString ColorIndex::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/colorindex.bin";
+}
+
+/**
+ * @brief ColorIndex::imageNameFilters
+ * @return a name filter for every format Qt can read, e.g. *.png.
+ */
+QStringList ColorIndex::imageNameFilters()
+{
+    QStringList filters;
+    QList<QByteArray> formats = QImageReader::supportedImageFormats();
+    for(int i = 0; i < formats.size(); i++) {
+        filters.push_back("*." + QString::fromLatin1(formats[i]));
+    }
+    return filters;
+}
+
+void ColorIndex::buildTree()
+{
+    points.clear();
+    for(int i = 0; i < entries.size(); i++) {
+        for(int j = 0; j < entries[i].palette.size(); j++) {
+            OkLab lab = rgbToOkLab(entries[i].palette[j]);
+            Point point = {{lab.L, lab.a, lab.b}, quint32(i)};
+            points.push_back(point);
+        }
+    }
+    buildTree(0, points.size(), 0);
+}
+
+/**
+ * @brief ColorIndex::buildTree
+ *
+ * Put the median of the range on the axis in the middle, smaller ones before it and bigger
+ * ones after it, then do the same for both halves on the next axis.
+ */
+void ColorIndex::buildTree(int begin, int end, int axis)
+{
+    if(end - begin <= 1) {
+        return;
+    }
+
+    int middle = (begin + end) / 2;
+    AxisLess less = {axis};
+    std::nth_element(points.begin() + begin, points.begin() + middle, points.begin() + end, less);
+
+    buildTree(begin, middle, (axis + 1) % 3);
+    buildTree(middle + 1, end, (axis + 1) % 3);
+}
+
+void ColorIndex::searchTree(int begin, int end, int axis, const float *query, int maxResults,
+                            QVector<Candidate> &best) const
+{
+    if(begin >= end) {
+        return;
+    }
+
+    int middle = (begin + end) / 2;
+    const Point &point = points[middle];
+
+    float dL = point.lab[0] - query[0];
+    float da = point.lab[1] - query[1];
+    float db = point.lab[2] - query[2];
+    float distance = dL * dL + da * da + db * db;
+
+    // An image is ranked by its closest color, so it's kept once with the smallest distance.
+    if(best.size() < maxResults || distance < best.last().distance) {
+        bool better = true;
+        for(int i = 0; i < best.size(); i++) {
+            if(best[i].entry == point.entry) {
+                better = distance < best[i].distance;
+                if(better) {
+                    best.remove(i);
+                }
+                break;
+            }
+        }
+        if(better) {
+            int i = best.size();
+            while(i > 0 && best[i - 1].distance > distance) {
+                i--;
+            }
+            Candidate candidate = {distance, point.entry};
+            best.insert(i, candidate);
+            if(best.size() > maxResults) {
+                best.removeLast();
+            }
+        }
+    }
+
+    float diff = query[axis] - point.lab[axis];
+    int next = (axis + 1) % 3;
+    if(diff < 0.0f) {
+        searchTree(begin, middle, next, query, maxResults, best);
+        if(best.size() < maxResults || diff * diff < best.last().distance) {
+            searchTree(middle + 1, end, next, query, maxResults, best);
+        }
+    }
+    else {
+        searchTree(middle + 1, end, next, query, maxResults, best);
+        if(best.size() < maxResults || diff * diff < best.last().distance) {
+            searchTree(begin, middle, next, query, maxResults, best);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef COLORINDEX_H
+#define COLORINDEX_H
+
+#include <QColor>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+#include "oklab.h"
+#include "perceptualhash.h"
+
+/*
+ * One indexed file: what it was when it was analysed, what it looks like, and its palette.
+ */
+struct ColorIndexEntry
+{
+    QString path;
+    qint64 modified;
+    qint64 size;
+    PerceptualHash hash;
+    QVector<QRgb> palette;
+};
+
+struct ColorMatch
+{
+    QString path;
+    QColor color;
+    float distance;
+};
+
+/*
+ * The palettes of every image under a directory, searchable by color.
+ *
+ * Every palette color is a point in OKLab. The points are kept in an implicit k-d tree: the
+ * array is ordered so that the middle element of every range splits it on one axis (L, a, b in
+ * turn), so the tree needs no pointers and is saved and loaded as one block.
+ */
+class ColorIndex
+{
+public:
+    typedef std::function<void(int done, int total)> Progress;
+
+    struct UpdateStats
+    {
+        int added, changed, removed, unchanged, duplicates;
+    };
+
+    ColorIndex();
+
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    UpdateStats update(const QString &rootPath, int colorCount, Progress progress = Progress());
+    QVector<ColorMatch> search(const QColor &color, int maxResults) const;
+
+    QString rootPath() const;
+    int fileCount() const;
+    qint64 sizeInBytes() const;
+
+    static QString defaultFileName();
+    static QStringList imageNameFilters();
+private:
+    struct Point
+    {
+        float lab[3];
+        quint32 entry;
+    };
+
+    struct Candidate
+    {
+        float distance;
+        quint32 entry;
+    };
+
+    QString root;
+    QVector<ColorIndexEntry> entries;
+    QVector<Point> points;
+
+    void buildTree();
+    void buildTree(int begin, int end, int axis);
+    void searchTree(int begin, int end, int axis, const float *query, int maxResults,
+                    QVector<Candidate> &best) const;
+};
+
+#endif // COLORINDEX_H
@@ -0,0 +1,268 @@
+#include "colormanagement.h"
+#include <QImage>
+#include <QVector>
+#include <QPair>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSharedPointer>
+#include <QThread>
+#include <QtConcurrent>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+
+/**
+ * @brief ColorLut3D::ColorLut3D
+ * @param transform the conversion from the image color space to sRGB.
+ *
+ * The grid points are mapped with 16 bits per channel, so the table keeps more precision than
+ * the 8-bit pixels it's applied to.
+ */
+ColorLut3D::ColorLut3D(const QColorTransform &transform)
+    : table(GridSize * GridSize * GridSize * 4)
+{
+    float *entry = table.data();
+    for(int r = 0; r < GridSize; r++) {
+        for(int g = 0; g < GridSize; g++) {
+            for(int b = 0; b < GridSize; b++) {
+                QRgba64 color = QRgba64::fromRgba64(r * 65535 / (GridSize - 1), g * 65535 / (GridSize - 1),
+                                                    b * 65535 / (GridSize - 1), 65535);
+                color = transform.map(color);
+
+                *entry++ = color.blue() / 65535.0f;
+                *entry++ = color.green() / 65535.0f;
+                *entry++ = color.red() / 65535.0f;
+                *entry++ = 0.0f;
+            }
+        }
+    }
+}
+
+#endif
+
+/**
+ * @brief ColorLut3D::apply
+ * @param image a Format_ARGB32, Format_RGB32, Format_RGBA64 or Format_RGBX64 image, converted
+ * in place.
+ *
+ * The image is split into bands of rows which are converted on the thread pool.
+ */
+void ColorLut3D::apply(QImage &image) const
+{
+    if(table.isEmpty() || image.isNull()) {
+        return;
+    }
+
+    int bandHeight = qMax(32, image.height() / (QThread::idealThreadCount() * 4) + 1);
+    QVector<QPair<int, int> > bands;
+    for(int top = 0; top < image.height(); top += bandHeight) {
+        bands.push_back(qMakePair(top, qMin(image.height(), top + bandHeight)));
+    }
+
+    Band band;
+    band.lut = this;
+    band.bits = image.bits();
+    band.stride = image.bytesPerLine();
+    band.width = image.width();
+    band.wide = image.format() == QImage::Format_RGBA64 || image.format() == QImage::Format_RGBX64;
+    QtConcurrent::blockingMap(bands, band);
+}
+
+void ColorLut3D::Band::operator()(const QPair<int, int> &rows) const
+{
+    for(int y = rows.first; y < rows.second; y++) {
+        if(wide) {
+            lut->applyRow64(reinterpret_cast<quint64 *>(bits + qptrdiff(y) * stride), width);
+        }
+        else {
+            lut->applyRow(reinterpret_cast<QRgb *>(bits + qptrdiff(y) * stride), width);
+        }
+    }
+}
+
+/**
+ * @brief ColorLut3D::applyRow
+ *
+ * With SSE2 the three channels of the 8 grid points are interpolated together, one channel
+ * per lane, and packed back to a QRgb with saturation.
+ */
+void ColorLut3D::applyRow(QRgb *line, int width) const
+{
+    const float scale = (GridSize - 1) / 255.0f;
+    const float *t = table.constData();
+    const int stepB = 4;
+    const int stepG = GridSize * 4;
+    const int stepR = GridSize * GridSize * 4;
+
+    for(int x = 0; x < width; x++) {
+        QRgb pixel = line[x];
+
+        float fr = qRed(pixel) * scale;
+        float fg = qGreen(pixel) * scale;
+        float fb = qBlue(pixel) * scale;
+        int ir = qMin(int(fr), GridSize - 2);
+        int ig = qMin(int(fg), GridSize - 2);
+        int ib = qMin(int(fb), GridSize - 2);
+        float dr = fr - ir;
+        float dg = fg - ig;
+        float db = fb - ib;
+
+        const float *c = t + ir * stepR + ig * stepG + ib * stepB;
+
+#if defined(__SSE2__)
+        __m128 wb = _mm_set1_ps(db);
+        __m128 wg = _mm_set1_ps(dg);
+        __m128 wr = _mm_set1_ps(dr);
+
+        __m128 c000 = _mm_loadu_ps(c);
+        __m128 c001 = _mm_loadu_ps(c + stepB);
+        __m128 c010 = _mm_loadu_ps(c + stepG);
+        __m128 c011 = _mm_loadu_ps(c + stepG + stepB);
+        __m128 c100 = _mm_loadu_ps(c + stepR);
+        __m128 c101 = _mm_loadu_ps(c + stepR + stepB);
+        __m128 c110 = _mm_loadu_ps(c + stepR + stepG);
+        __m128 c111 = _mm_loadu_ps(c + stepR + stepG + stepB);
+
+        __m128 c00 = _mm_add_ps(c000, _mm_mul_ps(_mm_sub_ps(c001, c000), wb));
+        __m128 c01 = _mm_add_ps(c010, _mm_mul_ps(_mm_sub_ps(c011, c010), wb));
+        __m128 c10 = _mm_add_ps(c100, _mm_mul_ps(_mm_sub_ps(c101, c100), wb));
+        __m128 c11 = _mm_add_ps(c110, _mm_mul_ps(_mm_sub_ps(c111, c110), wb));
+        __m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c01, c00), wg));
+        __m128 c1 = _mm_add_ps(c10, _mm_mul_ps(_mm_sub_ps(c11, c10), wg));
+        __m128 result = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), wr));
+
+        __m128i value = _mm_cvtps_epi32(_mm_mul_ps(result, _mm_set1_ps(255.0f)));
+        value = _mm_packs_epi32(value, value);
+        value = _mm_packus_epi16(value, value);
+
+        line[x] = (quint32(_mm_cvtsi128_si32(value)) & 0x00ffffff) | (pixel & 0xff000000);
+#else
+        int channels[3];
+        for(int i = 0; i < 3; i++) {
+            float c00 = c[i] + (c[stepB + i] - c[i]) * db;
+            float c01 = c[stepG + i] + (c[stepG + stepB + i] - c[stepG + i]) * db;
+            float c10 = c[stepR + i] + (c[stepR + stepB + i] - c[stepR + i]) * db;
+            float c11 = c[stepR + stepG + i] + (c[stepR + stepG + stepB + i] - c[stepR + stepG + i]) * db;
+            float c0 = c00 + (c01 - c00) * dg;
+            float c1 = c10 + (c11 - c10) * dg;
+            channels[i] = qBound(0, qRound((c0 + (c1 - c0) * dr) * 255.0f), 255);
+        }
+        line[x] = qRgba(channels[2], channels[1], channels[0], qAlpha(pixel));
+#endif
+    }
+}
+
+/**
+ * @brief ColorLut3D::applyRow64
+ *
+ * The same interpolation for 16-bit pixels (r, g, b, a from the lowest bits). The grid has
+ * 16-bit precision, so the result keeps all the bits of the source.
+ */
+void ColorLut3D::applyRow64(quint64 *line, int width) const
+{
+    const float scale = (GridSize - 1) / 65535.0f;
+    const float *t = table.constData();
+    const int stepB = 4;
+    const int stepG = GridSize * 4;
+    const int stepR = GridSize * GridSize * 4;
+
+    for(int x = 0; x < width; x++) {
+        quint64 pixel = line[x];
+
+        float fr = (pixel & 0xffff) * scale;
+        float fg = ((pixel >> 16) & 0xffff) * scale;
+        float fb = ((pixel >> 32) & 0xffff) * scale;
+        int ir = qMin(int(fr), GridSize - 2);
+        int ig = qMin(int(fg), GridSize - 2);
+        int ib = qMin(int(fb), GridSize - 2);
+        float dr = fr - ir;
+        float dg = fg - ig;
+        float db = fb - ib;
+
+        const float *c = t + ir * stepR + ig * stepG + ib * stepB;
+
+        // The grid stores b, g, r, the pixel is r, g, b.
+        quint64 channels[3];
+        for(int i = 0; i < 3; i++) {
+            float c00 = c[i] + (c[stepB + i] - c[i]) * db;
+            float c01 = c[stepG + i] + (c[stepG + stepB + i] - c[stepG + i]) * db;
+            float c10 = c[stepR + i] + (c[stepR + stepB + i] - c[stepR + i]) * db;
+            float c11 = c[stepR + stepG + i] + (c[stepR + stepG + stepB + i] - c[stepR + stepG + i]) * db;
+            float c0 = c00 + (c01 - c00) * dg;
+            float c1 = c10 + (c11 - c10) * dg;
+            channels[2 - i] = quint64(qBound(0, qRound((c0 + (c1 - c0) * dr) * 65535.0f), 65535));
+        }
+        line[x] = channels[0] | (channels[1] << 16) | (channels[2] << 32) | (pixel & Q_UINT64_C(0xffff000000000000));
+    }
+}
+
+/**
+ * @brief isHighBitDepth
+ * @param image an image.
+ * @return whether it has more than 8 bits per channel (16-bit PNG or TIFF, 10-bit formats).
+ */
+bool isHighBitDepth(const QImage &image)
+{
+    return image.depth() > 32 || image.pixelFormat().redColorBits() > 8;
+}
+
+/**
+ * @brief convertToSRgb
+ * @param image the decoded image.
+ * @return the image in sRGB.
+ *
+ * Untagged images are taken as sRGB already. The lookup table of every source profile is built
+ * once and kept, so opening more images from the same camera or editor only costs the table
+ * lookups.
+ */
+QImage convertToSRgb(const QImage &image)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    QColorSpace colorSpace = image.colorSpace();
+    if(!colorSpace.isValid() || colorSpace == QColorSpace(QColorSpace::SRgb)) {
+        return image;
+    }
+
+    static QMutex mutex;
+    static QCache<QByteArray, QSharedPointer<ColorLut3D> > luts(16);
+
+    QByteArray key = colorSpace.iccProfile();
+    if(key.isEmpty()) {
+        key = QByteArray::number(int(colorSpace.primaries())) + "/"
+            + QByteArray::number(int(colorSpace.transferFunction())) + "/"
+            + QByteArray::number(colorSpace.gamma());
+    }
+
+    // The shared pointer keeps the table alive even if another thread evicts it meanwhile.
+    QSharedPointer<ColorLut3D> lut;
+    {
+        QMutexLocker locker(&mutex);
+        QSharedPointer<ColorLut3D> *cached = luts.object(key);
+        if(cached == nullptr) {
+            cached = new QSharedPointer<ColorLut3D>(
+                        new ColorLut3D(colorSpace.transformationToColorSpace(QColorSpace(QColorSpace::SRgb))));
+            luts.insert(key, cached);
+        }
+        lut = *cached;
+    }
+
+    // High bit depth images are converted in 16 bits, they must not lose their precision here.
+    QImage converted;
+    if(isHighBitDepth(image)) {
+        converted = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_RGBA64 : QImage::Format_RGBX64);
+    }
+    else {
+        converted = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    }
+    lut->apply(converted);
+
+    converted.setColorSpace(QColorSpace(QColorSpace::SRgb));
+    return converted;
+#else
+    return image;
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef COLORMANAGEMENT_H
+#define COLORMANAGEMENT_H
+
+#include <QImage>
+#include <QVector>
+#include <QPair>
+#include <QtGlobal>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#include <QColorSpace>
+#include <QColorTransform>
+#endif
+
+/*
+ * A color transform sampled on a 33 * 33 * 33 grid. Converting a pixel is a trilinear
+ * interpolation between 8 grid points instead of the full color management math.
+ */
+class ColorLut3D
+{
+public:
+    enum { GridSize = 33 };
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    explicit ColorLut3D(const QColorTransform &transform);
+#endif
+
+    void apply(QImage &image) const;
+private:
+    // Every grid point is 4 floats in the order b, g, r, 0 to match the bytes of a QRgb.
+    QVector<float> table;
+
+    struct Band
+    {
+        const ColorLut3D *lut;
+        uchar *bits;
+        int stride, width;
+        bool wide;
+
+        void operator()(const QPair<int, int> &rows) const;
+    };
+
+    void applyRow(QRgb *line, int width) const;
+    void applyRow64(quint64 *line, int width) const;
+};
+
+bool isHighBitDepth(const QImage &image);
+QImage convertToSRgb(const QImage &image);
+
+#endif // COLORMANAGEMENT_H
@@ -0,0 +1,325 @@
+#include "colorsearchdialog.h"
+#include "imageloader.h"
+#include "resampler.h"
+#include "memorybudget.h"
+#include "util.h"
+#include <QGridLayout>
+#include <QFileDialog>
+#include <QColorDialog>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSettings>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QPixmap>
+#include <QtConcurrent>
+
+namespace {
+
+const int ThumbnailSide = 96;
+
+struct ThumbnailLoader
+{
+    typedef QImage result_type;
+
+    QImage operator()(const QString &fileName) const
+    {
+        return makeThumbnail(readImage(fileName), ThumbnailSide);
+    }
+};
+
+QString buttonStyle(const QColor &color)
+{
+    return "QPushButton{background-color: " + qcolorToString(color) + "; border: 1px solid #c0c0c0;}";
+}
+
+}
+
+ColorSearchDialog::ColorSearchDialog(QWidget *parent) : QDialog(parent)
+{
+    setWindowTitle(tr("Search by color"));
+    resize(720, 520);
+
+    indexFileName = ColorIndex::defaultFileName();
+    indexEntry = 0;
+    updatePending = false;
+
+    directoryEdit = new QLineEdit(this);
+    browseButton = new QPushButton(tr("Browse..."), this);
+    updateButton = new QPushButton(tr("Update index"), this);
+
+    swatchLayout = new QHBoxLayout;
+    colorButton = new QPushButton(tr("Other..."), this);
+    resultCountSpinBox = new QSpinBox(this);
+    resultCountSpinBox->setRange(1, 500);
+    resultCountSpinBox->setValue(50);
+    resultCountSpinBox->setPrefix(tr("Top "));
+
+    resultList = new QListWidget(this);
+    resultList->setViewMode(QListView::IconMode);
+    resultList->setIconSize(QSize(ThumbnailSide, ThumbnailSide));
+    resultList->setResizeMode(QListView::Adjust);
+    resultList->setMovement(QListView::Static);
+    resultList->setSpacing(6);
+
+    statusLabel = new QLabel(this);
+
+    QGridLayout *layout = new QGridLayout(this);
+    layout->addWidget(new QLabel(tr("Library"), this), 0, 0);
+    layout->addWidget(directoryEdit, 0, 1, 1, 2);
+    layout->addWidget(browseButton, 0, 3);
+    layout->addWidget(updateButton, 0, 4);
+    layout->addWidget(new QLabel(tr("Color"), this), 1, 0);
+    layout->addLayout(swatchLayout, 1, 1);
+    layout->addWidget(colorButton, 1, 2);
+    layout->addWidget(resultCountSpinBox, 1, 3, 1, 2);
+    layout->addWidget(resultList, 2, 0, 1, 5);
+    layout->addWidget(statusLabel, 3, 0, 1, 5);
+    layout->setColumnStretch(1, 1);
+
+    // Changes in the library are picked up a moment after the last one, copies come in bursts.
+    watcher = new QFileSystemWatcher(this);
+    updateTimer = new QTimer(this);
+    updateTimer->setSingleShot(true);
+    updateTimer->setInterval(1000);
+
+    updateWatcher = new QFutureWatcher<IndexUpdate>(this);
+    thumbnailWatcher = new QFutureWatcher<QImage>(this);
+
+    connect(browseButton, SIGNAL(clicked()), SLOT(browseDirectory()));
+    connect(updateButton, SIGNAL(clicked()), SLOT(updateIndex()));
+    connect(colorButton, SIGNAL(clicked()), SLOT(chooseColor()));
+    connect(resultCountSpinBox, SIGNAL(valueChanged(int)), SLOT(search()));
+    connect(resultList, SIGNAL(itemDoubleClicked(QListWidgetItem*)), SLOT(openResult(QListWidgetItem*)));
+    connect(watcher, SIGNAL(directoryChanged(QString)), updateTimer, SLOT(start()));
+    connect(updateTimer, SIGNAL(timeout()), SLOT(updateIndex()));
+    connect(updateWatcher, SIGNAL(finished()), SLOT(finishUpdate()));
+    connect(thumbnailWatcher, SIGNAL(resultReadyAt(int)), SLOT(showThumbnail(int)));
+
+    QString root = QSettings("MyPaint", "MyPaint").value("colorIndexRoot").toString();
+    if(index.load(indexFileName)) {
+        root = index.rootPath();
+        indexEntry = MemoryBudget::instance()->registerEntry("color index", index.sizeInBytes(), 0);
+    }
+    directoryEdit->setText(root);
+    statusLabel->setText(tr("%1 images indexed.").arg(index.fileCount()));
+
+    setQueryColor(Qt::red);
+
+    // Catch up with what changed while the app was closed, only those files are decoded.
+    if(!root.isEmpty()) {
+        updateIndex();
+    }
+}
+
+ColorSearchDialog::~ColorSearchDialog()
+{
+    thumbnailWatcher->cancel();
+    thumbnailWatcher->waitForFinished();
+    updateWatcher->waitForFinished();
+    MemoryBudget::instance()->unregisterEntry(indexEntry);
+}
+
+/**
+ * @brief ColorSearchDialog::setSwatches
+ * @param colors the colors of the color board.
+ *
+ * Every color of the color board is a button, click it to search images with that color.
+ */
+void ColorSearchDialog::setSwatches(const QVector<QColor> &colors)
+{
+    for(int i = 0; i < swatchButtons.size(); i++) {
+        delete swatchButtons[i];
+    }
+    swatchButtons.clear();
+
+    for(int i = 0; i < colors.size(); i++) {
+        QPushButton *button = new QPushButton(this);
+        button->setFixedSize(24, 24);
+        button->setStyleSheet(buttonStyle(colors[i]));
+        button->setToolTip(qcolorToString(colors[i]));
+        button->setProperty("swatch", colors[i]);
+        connect(button, SIGNAL(clicked()), SLOT(pickSwatch()));
+        swatchLayout->addWidget(button);
+        swatchButtons.push_back(button);
+    }
+}
+
+void ColorSearchDialog::setQueryColor(const QColor &color)
+{
+    queryColor = color;
+    colorButton->setStyleSheet(buttonStyle(color));
+    search();
+}
+
+/**
+ * @brief ColorSearchDialog::watchDirectories
+ * @param directories the library and its subdirectories.
+ *
+ * A watcher only sees changes in the directories it watches, not below them.
+ */
+void ColorSearchDialog::watchDirectories(const QStringList &directories)
+{
+    QStringList watched = watcher->directories();
+    if(!watched.isEmpty()) {
+        watcher->removePaths(watched);
+    }
+    if(!directories.isEmpty()) {
+        watcher->addPaths(directories);
+    }
+}
+
+void ColorSearchDialog::browseDirectory()
+{
+    QString directory = QFileDialog::getExistingDirectory(this, tr("Image library"), directoryEdit->text());
+    if(directory.isEmpty()) {
+        return;
+    }
+    directoryEdit->setText(directory);
+    updateIndex();
+}
+
+/**
+ * @brief ColorSearchDialog::updateIndex
+ *
+ * It's a slot function.
+ * Update a copy of the index in the background, the current index can still be searched
+ * meanwhile. If the library changes again during the update, another one follows.
+ */
+void ColorSearchDialog::updateIndex()
+{
+    QString root = directoryEdit->text();
+    if(root.isEmpty()) {
+        return;
+    }
+    if(updateWatcher->isRunning()) {
+        updatePending = true;
+        return;
+    }
+
+    QSettings("MyPaint", "MyPaint").setValue("colorIndexRoot", root);
+    updateButton->setEnabled(false);
+    statusLabel->setText(tr("Scanning %1...").arg(root));
+
+    ColorIndex current = index;
+    QString fileName = indexFileName;
+    updateWatcher->setFuture(QtConcurrent::run([this, current, root, fileName]() {
+        IndexUpdate result;
+        result.index = current;
+        result.stats = result.index.update(root, 7, [this](int done, int total) {
+            QMetaObject::invokeMethod(this, "showUpdateProgress", Qt::QueuedConnection,
+                                      Q_ARG(int, done), Q_ARG(int, total));
+        });
+        result.saved = result.index.save(fileName);
+
+        result.directories.push_back(result.index.rootPath());
+        QDirIterator it(result.index.rootPath(), QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while(it.hasNext()) {
+            result.directories.push_back(it.next());
+        }
+        return result;
+    }));
+}
+
+/**
+ * @brief ColorSearchDialog::finishUpdate
+ *
+ * It's a slot function.
+ * Replace the index with the updated one and search again.
+ */
+void ColorSearchDialog::finishUpdate()
+{
+    IndexUpdate result = updateWatcher->result();
+    index = result.index;
+    watchDirectories(result.directories);
+
+    MemoryBudget *budget = MemoryBudget::instance();
+    budget->unregisterEntry(indexEntry);
+    indexEntry = budget->registerEntry("color index", index.sizeInBytes(), 0);
+
+    QString text = tr("%1 images indexed: %2 added, %3 changed, %4 removed.")
+            .arg(index.fileCount()).arg(result.stats.added).arg(result.stats.changed).arg(result.stats.removed);
+    if(result.stats.duplicates > 0) {
+        text += " " + tr("%1 near duplicates reused a palette.").arg(result.stats.duplicates);
+    }
+    if(!result.saved) {
+        text += " " + tr("The index can't be saved to %1.").arg(indexFileName);
+    }
+    statusLabel->setText(text);
+    updateButton->setEnabled(true);
+
+    search();
+
+    if(updatePending) {
+        updatePending = false;
+        updateIndex();
+    }
+}
+
+void ColorSearchDialog::showUpdateProgress(int done, int total)
+{
+    statusLabel->setText(tr("Analysing images %1/%2...").arg(done).arg(total));
+}
+
+void ColorSearchDialog::chooseColor()
+{
+    QColor color = QColorDialog::getColor(queryColor, this, tr("Search color"));
+    if(color.isValid()) {
+        setQueryColor(color);
+    }
+}
+
+void ColorSearchDialog::pickSwatch()
+{
+    setQueryColor(sender()->property("swatch").value<QColor>());
+}
+
+/**
+ * @brief ColorSearchDialog::search
+ *
+ * It's a slot function.
+ * List the images closest to the query color, then load their thumbnails in the background.
+ */
+void ColorSearchDialog::search()
+{
+    thumbnailWatcher->cancel();
+    thumbnailWatcher->waitForFinished();
+    resultList->clear();
+
+    QElapsedTimer timer;
+    timer.start();
+    QVector<ColorMatch> matches = index.search(queryColor, resultCountSpinBox->value());
+    double ms = timer.nsecsElapsed() / 1e6;
+
+    QStringList fileNames;
+    QPixmap placeholder(ThumbnailSide, ThumbnailSide);
+    for(int i = 0; i < matches.size(); i++) {
+        placeholder.fill(matches[i].color);
+        QListWidgetItem *item = new QListWidgetItem(QIcon(placeholder), QFileInfo(matches[i].path).fileName(), resultList);
+        item->setData(Qt::UserRole, matches[i].path);
+        item->setToolTip(matches[i].path + "\n" + qcolorToString(matches[i].color)
+                         + ", " + tr("distance %1").arg(matches[i].distance, 0, 'f', 3));
+        fileNames.push_back(matches[i].path);
+    }
+
+    if(!updateWatcher->isRunning()) {
+        statusLabel->setText(tr("%1 images indexed, %2 matches in %3 ms.")
+                             .arg(index.fileCount()).arg(matches.size()).arg(ms, 0, 'f', 2));
+    }
+
+    thumbnailWatcher->setFuture(QtConcurrent::mapped(fileNames, ThumbnailLoader()));
+}
+
+void ColorSearchDialog::showThumbnail(int row)
+{
+    QListWidgetItem *item = resultList->item(row);
+    QImage thumbnail = thumbnailWatcher->resultAt(row);
+    if(item != nullptr && !thumbnail.isNull()) {
+        item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+    }
+}
+
+void ColorSearchDialog::openResult(QListWidgetItem *item)
+{
+    emit openImageSignal(item->data(Qt::UserRole).toString());
+}
@@ -0,0 +1,72 @@
+#ifndef COLORSEARCHDIALOG_H
+#define COLORSEARCHDIALOG_H
+
+#include <QDialog>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QHBoxLayout>
+#include <QSpinBox>
+#include <QListWidget>
+#include <QLabel>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QVector>
+#include <QColor>
+
+#include "colorindex.h"
+
+class ColorSearchDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    explicit ColorSearchDialog(QWidget *parent = 0);
+    ~ColorSearchDialog();
+
+    void setSwatches(const QVector<QColor> &colors);
+private:
+    struct IndexUpdate
+    {
+        ColorIndex index;
+        ColorIndex::UpdateStats stats;
+        QStringList directories;
+        bool saved;
+    };
+
+    ColorIndex index;
+    QString indexFileName;
+    int indexEntry;
+    QColor queryColor;
+    bool updatePending;
+
+    QLineEdit *directoryEdit;
+    QPushButton *browseButton, *updateButton, *colorButton;
+    QHBoxLayout *swatchLayout;
+    QVector<QPushButton *> swatchButtons;
+    QSpinBox *resultCountSpinBox;
+    QListWidget *resultList;
+    QLabel *statusLabel;
+
+    QFileSystemWatcher *watcher;
+    QTimer *updateTimer;
+    QFutureWatcher<IndexUpdate> *updateWatcher;
+    QFutureWatcher<QImage> *thumbnailWatcher;
+
+    void setQueryColor(const QColor &color);
+    void watchDirectories(const QStringList &directories);
+signals:
+    void openImageSignal(QString fileName);
+private slots:
+    void browseDirectory();
+    void updateIndex();
+    void finishUpdate();
+    void showUpdateProgress(int done, int total);
+    void chooseColor();
+    void pickSwatch();
+    void search();
+    void showThumbnail(int row);
+    void openResult(QListWidgetItem *item);
+};
+
+#endif // COLORSEARCHDIALOG_H
@@ -0,0 +1,344 @@
+#include "histogrampanel.h"
+#include <QPainter>
+#include <QPolygonF>
+#include <QVBoxLayout>
+#include <QtMath>
+
+namespace {
+
+/*
+ * The hue, saturation and value bins of the center color of every palette histogram bin,
+ * computed once. Gray bins have no hue.
+ */
+struct BinColors
+{
+    enum {
+        NoHue = 255
+    };
+
+    quint8 hue[ColorHistogram::BinCount];
+    quint8 saturation[ColorHistogram::BinCount];
+    quint8 value[ColorHistogram::BinCount];
+    quint8 hueSaturation[ColorHistogram::BinCount];
+
+    BinColors()
+    {
+        const int side = ColorHistogram::SideLength;
+        for(int r = 0; r < side; r++) {
+            for(int g = 0; g < side; g++) {
+                for(int b = 0; b < side; b++) {
+                    int index = ColorHistogram::binIndex(r, g, b);
+                    double red = (r + 0.5) / side, green = (g + 0.5) / side, blue = (b + 0.5) / side;
+                    double maximum = qMax(red, qMax(green, blue));
+                    double minimum = qMin(red, qMin(green, blue));
+                    double delta = maximum - minimum;
+                    double s = maximum > 0.0 ? delta / maximum : 0.0;
+
+                    value[index] = quint8(qMin(side - 1, int(maximum * side)));
+                    saturation[index] = quint8(qMin(side - 1, int(s * side)));
+
+                    if(delta < 1.0 / side) {
+                        hue[index] = NoHue;
+                        hueSaturation[index] = NoHue;
+                        continue;
+                    }
+
+                    double h;
+                    if(maximum == red) {
+                        h = (green - blue) / delta;
+                    }
+                    else if(maximum == green) {
+                        h = 2.0 + (blue - red) / delta;
+                    }
+                    else {
+                        h = 4.0 + (red - green) / delta;
+                    }
+                    h = h / 6.0 - qFloor(h / 6.0);
+
+                    hue[index] = quint8(qMin(ColorStatistics::HueBins - 1, int(h * ColorStatistics::HueBins)));
+                    hueSaturation[index] = quint8(qMin(ColorStatistics::SaturationBins - 1,
+                                                       int(s * ColorStatistics::SaturationBins)));
+                }
+            }
+        }
+    }
+};
+
+qint64 maximumOf(const QVector<qint64> &bins)
+{
+    qint64 maximum = 1;
+    for(int i = 0; i < bins.size(); i++) {
+        maximum = qMax(maximum, bins[i]);
+    }
+    return maximum;
+}
+
+void drawCurve(QPainter &painter, const QRectF &rect, const QVector<qint64> &bins, qint64 maximum,
+               const QColor &color)
+{
+    QPolygonF polygon;
+    polygon << rect.bottomLeft();
+    double step = rect.width() / bins.size();
+    for(int i = 0; i < bins.size(); i++) {
+        double y = rect.bottom() - rect.height() * bins[i] / maximum;
+        polygon << QPointF(rect.left() + i * step, y) << QPointF(rect.left() + (i + 1) * step, y);
+    }
+    polygon << rect.bottomRight();
+
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(color);
+    painter.drawPolygon(polygon);
+}
+
+void drawBars(QPainter &painter, const QRectF &rect, const QVector<qint64> &bins, bool hueColors)
+{
+    qint64 maximum = maximumOf(bins);
+    double step = rect.width() / bins.size();
+    for(int i = 0; i < bins.size(); i++) {
+        double height = rect.height() * bins[i] / maximum;
+        QColor color = hueColors ? QColor::fromHsvF((i + 0.5) / bins.size(), 0.8, 0.9) : QColor(96, 96, 96);
+        painter.fillRect(QRectF(rect.left() + i * step, rect.bottom() - height, step, height), color);
+    }
+}
+
+}
+
+/**
+ * @brief computeStatistics
+ * @param histogram a palette histogram, of an image or of a part of it.
+ * @return the channel histograms and the hue/saturation density.
+ *
+ * One pass over the 32768 histogram bins, whatever the image size.
+ */
+ColorStatistics computeStatistics(const ColorHistogram &histogram)
+{
+    static const BinColors binColors;
+
+    ColorStatistics statistics;
+    statistics.red.fill(0, ColorStatistics::ChannelBins);
+    statistics.green.fill(0, ColorStatistics::ChannelBins);
+    statistics.blue.fill(0, ColorStatistics::ChannelBins);
+    statistics.hue.fill(0, ColorStatistics::HueBins);
+    statistics.saturation.fill(0, ColorStatistics::ChannelBins);
+    statistics.value.fill(0, ColorStatistics::ChannelBins);
+    statistics.hueSaturation.fill(0, ColorStatistics::HueBins * ColorStatistics::SaturationBins);
+    statistics.total = histogram.total();
+
+    const int side = ColorHistogram::SideLength;
+    for(int r = 0; r < side; r++) {
+        for(int g = 0; g < side; g++) {
+            for(int b = 0; b < side; b++) {
+                int index = ColorHistogram::binIndex(r, g, b);
+                quint32 count = histogram.count(index);
+                if(count == 0) {
+                    continue;
+                }
+
+                statistics.red[r] += count;
+                statistics.green[g] += count;
+                statistics.blue[b] += count;
+                statistics.saturation[binColors.saturation[index]] += count;
+                statistics.value[binColors.value[index]] += count;
+
+                if(binColors.hue[index] != BinColors::NoHue) {
+                    statistics.hue[binColors.hue[index]] += count;
+                    statistics.hueSaturation[binColors.hueSaturation[index] * ColorStatistics::HueBins
+                                             + binColors.hue[index]] += count;
+                }
+            }
+        }
+    }
+
+    return statistics;
+}
+
+HistogramPanel::HistogramPanel(QWidget *parent) : QWidget(parent)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    viewportCheckBox = new QCheckBox(tr("Visible area only"), this);
+    layout->addWidget(viewportCheckBox);
+    layout->addStretch();
+    setLayout(layout);
+    setMinimumHeight(280);
+
+    // Nothing to show before an image is set, the hue tables are built on the first image.
+    statistics.total = 0;
+
+    connect(viewportCheckBox, SIGNAL(toggled(bool)), SLOT(setViewportMode(bool)));
+}
+
+/**
+ * @brief HistogramPanel::setImage
+ * @param image the image shown, the current frame of an animation.
+ * @param histogram the palette histogram of exactly that image, if the color board has one.
+ *
+ * With a histogram, the whole image statistics are derived from it without reading the
+ * pixels. The same image set again (e.g. the color board shows other colors) does nothing.
+ */
+void HistogramPanel::setImage(const QImage &image, const ColorHistogram *histogram)
+{
+    if(image.cacheKey() == this->image.cacheKey() && !image.isNull()) {
+        return;
+    }
+    this->image = image;
+
+    if(histogram != nullptr) {
+        imageHistogram = *histogram;
+    }
+    else {
+        imageHistogram.clear();
+        imageHistogram.add(image);
+    }
+
+    rebuildViewportHistogram();
+    refresh();
+}
+
+/**
+ * @brief HistogramPanel::setVisibleRect
+ * @param rect the part of the image shown in the viewport.
+ *
+ * It's a slot function.
+ * The viewport histogram counts the 256 * 256 tiles touching the viewport. When users scroll
+ * or zoom, the tiles which left the viewport are subtracted and the tiles which came in are
+ * added, the others aren't read at all.
+ */
+void HistogramPanel::setVisibleRect(const QRect &rect)
+{
+    visibleRect = rect;
+    if(!viewportCheckBox->isChecked() || image.isNull()) {
+        return;
+    }
+
+    QSet<int> tiles;
+    int columns = (image.width() + StatsTileSize - 1) / StatsTileSize;
+    QRect area = rect.intersected(image.rect());
+    if(!area.isEmpty()) {
+        for(int y = area.top() / StatsTileSize; y <= area.bottom() / StatsTileSize; y++) {
+            for(int x = area.left() / StatsTileSize; x <= area.right() / StatsTileSize; x++) {
+                tiles.insert(y * columns + x);
+            }
+        }
+    }
+
+    bool changed = false;
+    for(QSet<int>::const_iterator it = visibleTiles.constBegin(); it != visibleTiles.constEnd(); ++it) {
+        if(!tiles.contains(*it)) {
+            viewportHistogram.add(image, tileRect(*it), -1);
+            changed = true;
+        }
+    }
+    for(QSet<int>::const_iterator it = tiles.constBegin(); it != tiles.constEnd(); ++it) {
+        if(!visibleTiles.contains(*it)) {
+            viewportHistogram.add(image, tileRect(*it), 1);
+            changed = true;
+        }
+    }
+    visibleTiles = tiles;
+
+    if(changed) {
+        refresh();
+    }
+}
+
+/**
+ * @brief HistogramPanel::setViewportMode
+ * @param viewport whether the statistics are of the visible area or of the whole image.
+ *
+ * It's a slot function.
+ */
+void HistogramPanel::setViewportMode(bool viewport)
+{
+    Q_UNUSED(viewport);
+    rebuildViewportHistogram();
+    refresh();
+}
+
+QRect HistogramPanel::tileRect(int tile) const
+{
+    int columns = (image.width() + StatsTileSize - 1) / StatsTileSize;
+    QRect rect((tile % columns) * StatsTileSize, (tile / columns) * StatsTileSize, StatsTileSize, StatsTileSize);
+    return rect.intersected(image.rect());
+}
+
+/**
+ * @brief HistogramPanel::rebuildViewportHistogram
+ *
+ * Forget the visible tiles, setVisibleRect() counts them again from scratch.
+ */
+void HistogramPanel::rebuildViewportHistogram()
+{
+    viewportHistogram.clear();
+    visibleTiles.clear();
+    if(viewportCheckBox->isChecked()) {
+        setVisibleRect(visibleRect);
+    }
+}
+
+void HistogramPanel::refresh()
+{
+    statistics = computeStatistics(viewportCheckBox->isChecked() ? viewportHistogram : imageHistogram);
+    update();
+}
+
+/**
+ * @brief HistogramPanel::paintEvent
+ *
+ * From top to bottom: the R, G and B histograms on top of each other, the H, S and V
+ * histograms, and the hue (x) / saturation (y) density, brighter where more pixels are.
+ */
+void HistogramPanel::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QPainter painter(this);
+    QRectF area = QRectF(rect()).adjusted(10, viewportCheckBox->geometry().bottom() + 6, -10, -10);
+    if(area.height() < 60 || statistics.total == 0) {
+        return;
+    }
+
+    double labelWidth = 28;
+    QRectF plots = area.adjusted(labelWidth, 0, 0, 0);
+    double rgbHeight = area.height() * 0.3;
+    double stripHeight = area.height() * 0.12;
+    double gap = 4;
+
+    QRectF rgbRect(plots.left(), area.top(), plots.width(), rgbHeight);
+    painter.fillRect(rgbRect, QColor(248, 248, 248));
+    qint64 maximum = qMax(maximumOf(statistics.red), qMax(maximumOf(statistics.green), maximumOf(statistics.blue)));
+    drawCurve(painter, rgbRect, statistics.red, maximum, QColor(255, 0, 0, 90));
+    drawCurve(painter, rgbRect, statistics.green, maximum, QColor(0, 200, 0, 90));
+    drawCurve(painter, rgbRect, statistics.blue, maximum, QColor(0, 0, 255, 90));
+
+    double y = rgbRect.bottom() + gap;
+    const char *names[] = {"H", "S", "V"};
+    const QVector<qint64> *strips[] = {&statistics.hue, &statistics.saturation, &statistics.value};
+    painter.setPen(Qt::black);
+    painter.drawText(QRectF(area.left(), rgbRect.top(), labelWidth, rgbHeight), Qt::AlignVCenter, "RGB");
+    for(int i = 0; i < 3; i++) {
+        QRectF strip(plots.left(), y, plots.width(), stripHeight);
+        painter.fillRect(strip, QColor(248, 248, 248));
+        drawBars(painter, strip, *strips[i], i == 0);
+        painter.setPen(Qt::black);
+        painter.drawText(QRectF(area.left(), y, labelWidth, stripHeight), Qt::AlignVCenter, names[i]);
+        y += stripHeight + gap;
+    }
+
+    // The density is on a log scale, so a few pixels of a rare hue still show.
+    QImage density(ColorStatistics::HueBins, ColorStatistics::SaturationBins, QImage::Format_ARGB32);
+    double logMaximum = qLn(1.0 + maximumOf(statistics.hueSaturation));
+    for(int s = 0; s < ColorStatistics::SaturationBins; s++) {
+        QRgb *line = reinterpret_cast<QRgb *>(density.scanLine(ColorStatistics::SaturationBins - 1 - s));
+        for(int h = 0; h < ColorStatistics::HueBins; h++) {
+            double level = qLn(1.0 + statistics.hueSaturation[s * ColorStatistics::HueBins + h]) / logMaximum;
+            QColor color = QColor::fromHsvF((h + 0.5) / ColorStatistics::HueBins,
+                                            (s + 0.5) / ColorStatistics::SaturationBins, 1.0);
+            color.setAlphaF(level);
+            line[h] = color.rgba();
+        }
+    }
+    QRectF densityRect(plots.left(), y, plots.width(), area.bottom() - y);
+    painter.fillRect(densityRect, Qt::black);
+    painter.drawImage(densityRect, density);
+    painter.drawText(QRectF(area.left(), y, labelWidth, densityRect.height()), Qt::AlignVCenter, "HS");
+}
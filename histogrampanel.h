@@ -0,0 +1,63 @@
+#ifndef HISTOGRAMPANEL_H
+#define HISTOGRAMPANEL_H
+
+#include <QWidget>
+#include <QImage>
+#include <QRect>
+#include <QSet>
+#include <QVector>
+#include <QCheckBox>
+#include <QPaintEvent>
+
+#include "paletteengine.h"
+
+/*
+ * Channel statistics derived from a palette histogram, so no pixel is read again: every
+ * histogram bin adds its count to the R, G, B, H, S and V bins of its color, and to the
+ * hue/saturation density plot.
+ */
+struct ColorStatistics
+{
+    enum {
+        ChannelBins = ColorHistogram::SideLength,
+        HueBins = 36,
+        SaturationBins = 16
+    };
+
+    QVector<qint64> red, green, blue, hue, saturation, value;
+    QVector<qint64> hueSaturation;
+    qint64 total;
+};
+
+ColorStatistics computeStatistics(const ColorHistogram &histogram);
+
+class HistogramPanel : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit HistogramPanel(QWidget *parent = 0);
+
+    void setImage(const QImage &image, const ColorHistogram *histogram = nullptr);
+public slots:
+    void setVisibleRect(const QRect &rect);
+    void setViewportMode(bool viewport);
+protected:
+    void paintEvent(QPaintEvent *event);
+private:
+    enum {
+        StatsTileSize = 256
+    };
+
+    QImage image;
+    ColorHistogram imageHistogram, viewportHistogram;
+    QSet<int> visibleTiles;
+    QRect visibleRect;
+    ColorStatistics statistics;
+    QCheckBox *viewportCheckBox;
+
+    QRect tileRect(int tile) const;
+    void rebuildViewportHistogram();
+    void refresh();
+};
+
+#endif // HISTOGRAMPANEL_H
@@ -0,0 +1,234 @@
+#include "imagecanvas.h"
+#include "memorybudget.h"
+#include <QPainter>
+#include <QCache>
+#include <QPair>
+#include <QtMath>
+
+namespace {
+
+// Below this zoom the pixel grid would hide the image.
+const double MinimumGridScale = 8.0;
+
+// A high bit depth image is converted for the screen in tiles of this size.
+const int DisplayTileSize = 256;
+
+// The converted tiles kept, a bit more than two full screens of them, in KB.
+const int MaximumDisplayTilesKb = 128 * DisplayTileSize * DisplayTileSize * 4 / 1024;
+
+typedef QPair<qint64, int> TileKey;
+
+/*
+ * One cache for the tiles of every canvas (every open document and both sides of the compare
+ * view), keyed by the image and the tile. The tiles on screen are used the most recently, so the
+ * tiles of hidden documents go first.
+ */
+QCache<TileKey, QPixmap> &displayTiles()
+{
+    static QCache<TileKey, QPixmap> tiles(MaximumDisplayTilesKb);
+    return tiles;
+}
+
+int displayTilesEntry = 0;
+
+/*
+ * Count the cached tiles in the memory budget like every other cache. The whole cache is one
+ * entry, dropped at once under memory pressure: the tiles on screen are converted again when
+ * they are painted.
+ */
+void registerDisplayTiles()
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+    qint64 bytes = qint64(displayTiles().totalCost()) * 1024;
+    if(displayTilesEntry != 0) {
+        budget->updateEntry(displayTilesEntry, bytes);
+    }
+    else {
+        displayTilesEntry = budget->registerEntry("display tiles", bytes, bytes / 1000, []() {
+            displayTiles().clear();
+            displayTilesEntry = 0;
+        });
+    }
+}
+
+}
+
+ImageCanvas::ImageCanvas(QWidget *parent) : QWidget(parent)
+{
+    scale = 1.0;
+    pixelGridVisible = true;
+
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+/**
+ * @brief ImageCanvas::setPixmaps
+ * @param source the full size pixmap.
+ * @param display a pixmap resampled to the canvas size, or a null pixmap when the image is
+ * shown at 100% or larger.
+ */
+void ImageCanvas::setPixmaps(const QPixmap &source, const QPixmap &display)
+{
+    sourcePixmap = source;
+    displayPixmap = display;
+    sourceImage = QImage();
+    sourceSize = source.size();
+    update();
+}
+
+/**
+ * @brief ImageCanvas::setImage
+ * @param source the full size image, of more than 8 bits per channel.
+ * @param display a pixmap resampled to the canvas size, or a null pixmap when the image is
+ * shown at 100% or larger.
+ *
+ * A full size 8-bit pixmap of a 16-bit image would be a second copy of it only for the screen.
+ * Instead the tiles in the exposed rect are converted when they are painted, and a few of them
+ * are kept for scrolling in the cache shared by all canvases.
+ */
+void ImageCanvas::setImage(const QImage &source, const QPixmap &display)
+{
+    sourcePixmap = QPixmap();
+    displayPixmap = display;
+    sourceImage = source;
+    sourceSize = source.size();
+    update();
+}
+
+/**
+ * @brief ImageCanvas::setScale
+ * @param scale canvas pixels per image pixel.
+ *
+ * The image container resizes the canvas to the zoomed image size, the scroll area does the
+ * rest.
+ */
+void ImageCanvas::setScale(double scale)
+{
+    this->scale = scale;
+    update();
+}
+
+double ImageCanvas::getScale() const
+{
+    return scale;
+}
+
+void ImageCanvas::setPixelGridVisible(bool visible)
+{
+    pixelGridVisible = visible;
+    update();
+}
+
+/**
+ * @brief ImageCanvas::mapToImage
+ * @param pos a position on the canvas.
+ * @return the image pixel under it, clamped to the image.
+ */
+QPoint ImageCanvas::mapToImage(const QPoint &pos) const
+{
+    int x = qFloor(pos.x() / scale);
+    int y = qFloor(pos.y() / scale);
+    return QPoint(qBound(0, x, qMax(0, sourceSize.width() - 1)), qBound(0, y, qMax(0, sourceSize.height() - 1)));
+}
+
+/**
+ * @brief ImageCanvas::tilePixmap
+ * @param column the tile column.
+ * @param row the tile row.
+ * @return the tile of the source image converted for the screen.
+ */
+const QPixmap *ImageCanvas::tilePixmap(int column, int row)
+{
+    TileKey key(sourceImage.cacheKey(), row * ((sourceSize.width() + DisplayTileSize - 1) / DisplayTileSize) + column);
+    QPixmap *tile = displayTiles().object(key);
+    if(tile == nullptr) {
+        QRect rect = QRect(column * DisplayTileSize, row * DisplayTileSize, DisplayTileSize, DisplayTileSize)
+                     .intersected(sourceImage.rect());
+        tile = new QPixmap(QPixmap::fromImage(sourceImage.copy(rect)));
+        int kilobytes = qMax(1, int(qint64(tile->width()) * tile->height() * tile->depth() / 8 / 1024));
+        displayTiles().insert(key, tile, kilobytes);
+        registerDisplayTiles();
+    }
+    return tile;
+}
+
+/**
+ * @brief ImageCanvas::drawImageTiles
+ * @param painter the canvas painter.
+ * @param source the source pixels to draw.
+ */
+void ImageCanvas::drawImageTiles(QPainter &painter, const QRect &source)
+{
+    for(int row = source.top() / DisplayTileSize; row <= source.bottom() / DisplayTileSize; row++) {
+        for(int column = source.left() / DisplayTileSize; column <= source.right() / DisplayTileSize; column++) {
+            const QPixmap *tile = tilePixmap(column, row);
+            QRectF target(column * DisplayTileSize * scale, row * DisplayTileSize * scale,
+                          tile->width() * scale, tile->height() * scale);
+            painter.drawPixmap(target, *tile, QRectF(tile->rect()));
+        }
+    }
+}
+
+/**
+ * @brief ImageCanvas::paintEvent
+ * @param event the paint event, its rect is the exposed part of the canvas.
+ *
+ * At 100% or larger, the source pixels behind the exposed rect are drawn with nearest
+ * neighbour scaling, so every image pixel is a sharp square, with an optional grid around
+ * them. Smaller, the resampled display pixmap is drawn as is, or the source pixmap is scaled
+ * smoothly while a new display pixmap isn't made yet.
+ * A high bit depth image has no source pixmap, its exposed tiles are drawn instead.
+ */
+void ImageCanvas::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    QRect exposed = event->rect();
+    painter.fillRect(exposed, palette().window());
+
+    if(sourceSize.isEmpty()) {
+        return;
+    }
+
+    if(scale < 1.0 && displayPixmap.size() == size()) {
+        painter.drawPixmap(exposed, displayPixmap, exposed);
+        return;
+    }
+
+    // Converting every tile of a high bit depth image while zooming out would be too slow,
+    // the previous display pixmap is stretched until the new one is made.
+    if(scale < 1.0 && sourcePixmap.isNull() && !displayPixmap.isNull()) {
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawPixmap(QRectF(rect()), displayPixmap, QRectF(displayPixmap.rect()));
+        return;
+    }
+
+    // The source pixels which cover the exposed rect, whole pixels only.
+    int left = qMax(0, qFloor(exposed.left() / scale));
+    int top = qMax(0, qFloor(exposed.top() / scale));
+    int right = qMin(sourceSize.width(), qCeil((exposed.right() + 1) / scale));
+    int bottom = qMin(sourceSize.height(), qCeil((exposed.bottom() + 1) / scale));
+    if(right <= left || bottom <= top) {
+        return;
+    }
+    QRect source(left, top, right - left, bottom - top);
+    QRectF target(left * scale, top * scale, source.width() * scale, source.height() * scale);
+
+    painter.setClipRect(exposed);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, scale < 1.0);
+    if(sourcePixmap.isNull()) {
+        drawImageTiles(painter, source);
+    }
+    else {
+        painter.drawPixmap(target, sourcePixmap, source);
+    }
+
+    if(pixelGridVisible && scale >= MinimumGridScale) {
+        painter.setPen(QPen(QColor(128, 128, 128, 96), 0));
+        for(int x = left; x <= right; x++) {
+            painter.drawLine(QPointF(x * scale, target.top()), QPointF(x * scale, target.bottom()));
+        }
+        for(int y = top; y <= bottom; y++) {
+            painter.drawLine(QPointF(target.left(), y * scale), QPointF(target.right(), y * scale));
+        }
+    }
+}
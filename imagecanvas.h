@@ -0,0 +1,41 @@
+#ifndef IMAGECANVAS_H
+#define IMAGECANVAS_H
+
+#include <QWidget>
+#include <QPixmap>
+#include <QImage>
+#include <QPaintEvent>
+
+class QPainter;
+
+/*
+ * The widget the image is drawn on, as large as the zoomed image, inside the scroll area.
+ * It only ever draws the part exposed in the viewport, so painting costs the same at any zoom
+ * and for any image size.
+ */
+class ImageCanvas : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit ImageCanvas(QWidget *parent = 0);
+
+    void setPixmaps(const QPixmap &source, const QPixmap &display);
+    void setImage(const QImage &source, const QPixmap &display);
+    void setScale(double scale);
+    double getScale() const;
+    void setPixelGridVisible(bool visible);
+    QPoint mapToImage(const QPoint &pos) const;
+protected:
+    void paintEvent(QPaintEvent *event);
+private:
+    QPixmap sourcePixmap, displayPixmap;
+    QImage sourceImage;
+    QSize sourceSize;
+    double scale;
+    bool pixelGridVisible;
+
+    const QPixmap *tilePixmap(int column, int row);
+    void drawImageTiles(QPainter &painter, const QRect &source);
+};
+
+#endif // IMAGECANVAS_H
@@ -1,8 +1,23 @@
 #include "imagecontainer.h"
 #include "util.h"
+#include "palettemap.h"
+#include "imageloader.h"
+#include "memorybudget.h"
+#include "resampler.h"
+#include "imagecanvas.h"
+#include "loupe.h"
+#include "colormanagement.h"
 #include <QLabel>
 #include <QScrollArea>
 #include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QSlider>
+#include <QToolButton>
+#include <QSettings>
+#include <QScrollBar>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QPainter>
 #include <QPixmap>
 #include <QImage>
 #include <QWheelEvent>
@@ -13,29 +28,178 @@
 #include <QClipboard>
 #include <QtAlgorithms>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QHash>
+#include <QtMath>
+#include <QtConcurrent>
 #include <QDebug>
 
+namespace {
+
+// Every wheel notch zooms by this factor, so zooming feels the same at any scale.
+const double ZoomStep = 1.25;
+
+// The largest zoom, in screen pixels per image pixel.
+const double MaximumScale = 64.0;
+
+// Widgets can't be drawn past 32767 pixels, a larger image is zoomed until its canvas has this size.
+const int MaximumCanvasSide = 32767;
+
+const double MinimumShowScaleRatio = 0.5;
+
+// Browsers play animation frames without a delay, or with a tiny one, at this interval.
+const int DefaultFrameDelay = 100;
+
+// While playing a sequence, this many frames after the shown one are read again in the
+// background if the memory budget dropped them.
+const int PrefetchFrames = 4;
+
+// The display pixmap is smaller than the frame, so its Lanczos3 kernel reaches 3 display pixels,
+// plus one for rounding, around a changed tile.
+const int DisplayFilterReach = 4;
+
+/*
+ * The frames decoded from a file, kept after the documents showing it are closed or dropped, so
+ * opening it again, in another tab or when a dropped document is shown again, doesn't decode it
+ * again. The frames no document holds any more are counted in the memory budget, one entry per
+ * file, the others are already counted by their documents.
+ */
+struct DecodedFile
+{
+    QDateTime modified;
+    qint64 size;
+    QVector<QImage> frames;
+    QVector<int> delays;
+    int entry;
+};
+
+QHash<QString, DecodedFile> &decodedFiles()
+{
+    static QHash<QString, DecodedFile> files;
+    return files;
+}
+
+// The frames are copied one by one, so each image, not only the vector, is shared and a frame
+// only held here is detached.
+QVector<QImage> copyFrames(const QVector<QImage> &frames)
+{
+    QVector<QImage> copies;
+    copies.reserve(frames.size());
+    for(int i = 0; i < frames.size(); i++) {
+        copies.push_back(frames.at(i));
+    }
+    return copies;
+}
+
+void recountDecodedFiles()
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+    QHash<QString, DecodedFile>::const_iterator it;
+    for(it = decodedFiles().constBegin(); it != decodedFiles().constEnd(); it++) {
+        qint64 bytes = 0;
+        for(int i = 0; i < it->frames.size(); i++) {
+            if(it->frames.at(i).isDetached()) {
+                bytes += it->frames.at(i).sizeInBytes();
+            }
+        }
+        budget->updateEntry(it->entry, bytes);
+    }
+}
+
+void storeDecodedFile(const QString &fileName, const QVector<QImage> &frames, const QVector<int> &delays)
+{
+    QFileInfo info(fileName);
+    QString key = info.absoluteFilePath();
+    MemoryBudget *budget = MemoryBudget::instance();
+    if(decodedFiles().contains(key)) {
+        budget->unregisterEntry(decodedFiles().value(key).entry);
+    }
+
+    qint64 frameBytes = 0;
+    for(int i = 0; i < frames.size(); i++) {
+        frameBytes += frames[i].sizeInBytes();
+    }
+    DecodedFile &file = decodedFiles()[key];
+    file.modified = info.lastModified();
+    file.size = info.size();
+    file.frames = copyFrames(frames);
+    file.delays = delays;
+    file.entry = budget->registerEntry("shared decoded frames", 0, frameBytes / 100,
+                                       [key]() { decodedFiles().remove(key); });
+    recountDecodedFiles();
+}
+
+/*
+ * Read the frames of a file, from the shared decoded frames if the file didn't change since they
+ * were decoded.
+ */
+bool readSharedFrames(const QString &fileName, QVector<QImage> &frames, QVector<int> &delays)
+{
+    QFileInfo info(fileName);
+    QHash<QString, DecodedFile>::const_iterator it = decodedFiles().constFind(info.absoluteFilePath());
+    if(it != decodedFiles().constEnd() && it->modified == info.lastModified() && it->size == info.size()) {
+        frames = copyFrames(it->frames);
+        delays = it->delays;
+        MemoryBudget::instance()->touch(it->entry);
+        recountDecodedFiles();
+        return true;
+    }
+
+    if(!readImageFrames(fileName, frames, delays)) {
+        return false;
+    }
+    storeDecodedFile(fileName, frames, delays);
+    return true;
+}
+
+}
+
 ImageContainer::ImageContainer(QWidget *parent) : QWidget(parent)
 {
-    QHBoxLayout *layout = new QHBoxLayout(this);
-    scaleFactor = 0.05;
+    QVBoxLayout *layout = new QVBoxLayout(this);
 
     setMouseTracking(true);
 
     imageArea = new QScrollArea(this);
     layout->addWidget(imageArea);
+
+    // The frame scrubber only appears for animations, multi-page files and sequences.
+    QHBoxLayout *frameLayout = new QHBoxLayout();
+    playButton = new QToolButton(this);
+    playButton->setText(tr("Play"));
+    playButton->setCheckable(true);
+    frameSlider = new QSlider(Qt::Horizontal, this);
+    frameLabel = new QLabel(this);
+    frameLayout->addWidget(playButton);
+    frameLayout->addWidget(frameSlider);
+    frameLayout->addWidget(frameLabel);
+    layout->addLayout(frameLayout);
+    playButton->setVisible(false);
+    frameSlider->setVisible(false);
+    frameLabel->setVisible(false);
+    currentFrame = 0;
+    loadedFrames = 0;
+    framesEntry = 0;
+    previewEntry = 0;
+    displayEntry = 0;
+    pinnedFrame = -1;
+    connect(frameSlider, SIGNAL(valueChanged(int)), SLOT(showFrame(int)));
+
+    playTimer = new QTimer(this);
+    connect(playTimer, SIGNAL(timeout()), SLOT(playNextFrame()));
+    connect(playButton, SIGNAL(toggled(bool)), SLOT(setPlaying(bool)));
+
     setLayout(layout);
 
-    // When no image load, set the label size (0, 0) to make it invisible
-    imageLabel = new QLabel(this);
-    imageLabel->resize(0, 0);
+    // When no image load, set the canvas size (0, 0) to make it invisible
+    imageCanvas = new ImageCanvas(this);
+    imageCanvas->resize(0, 0);
 
     image = nullptr;
 
-    imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    imageLabel->setScaledContents(true);
-    imageLabel->installEventFilter(this);
-    imageLabel->setMouseTracking(true);
+    imageCanvas->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
+    imageCanvas->installEventFilter(this);
+    imageCanvas->setMouseTracking(true);
 
     /*
      * It means that put a image file in the image container, the image will scale how many times.
@@ -60,41 +224,282 @@ ImageContainer::ImageContainer(QWidget *parent) : QWidget(parent)
     showScaleRatio = 1.0;
 
     imageArea->setAlignment(Qt::AlignCenter);
-    imageArea->setWidget(imageLabel);
+    imageArea->setWidget(imageCanvas);
+
+    loupe = new Loupe(imageArea->viewport());
+    loupeEnabled = false;
+
+    // Scrolling, zooming and resizing all move the scroll bars or their ranges.
+    connect(imageArea->horizontalScrollBar(), SIGNAL(valueChanged(int)), SLOT(emitVisibleRect()));
+    connect(imageArea->verticalScrollBar(), SIGNAL(valueChanged(int)), SLOT(emitVisibleRect()));
+    connect(imageArea->horizontalScrollBar(), SIGNAL(rangeChanged(int,int)), SLOT(emitVisibleRect()));
+    connect(imageArea->verticalScrollBar(), SIGNAL(rangeChanged(int,int)), SLOT(emitVisibleRect()));
+
+    /*
+     * While users zoom out or resize the window, the canvas scales the full size pixmap. When
+     * they stop, a sharp pixmap of the shown size is made.
+     */
+    displayTimer = new QTimer(this);
+    displayTimer->setSingleShot(true);
+    displayTimer->setInterval(80);
+    connect(displayTimer, SIGNAL(timeout()), SLOT(updateDisplayPixmap()));
+
+    /*
+     * Editors often write a file in several steps (truncate, write, rename), so the file is read
+     * again a moment after the last change.
+     */
+    fileWatcher = new QFileSystemWatcher(this);
+    reloadTimer = new QTimer(this);
+    reloadTimer->setSingleShot(true);
+    reloadTimer->setInterval(300);
+    connect(fileWatcher, SIGNAL(fileChanged(QString)), reloadTimer, SLOT(start()));
+    connect(reloadTimer, SIGNAL(timeout()), SLOT(reloadImage()));
+
+    active = true;
+    framesDropped = false;
+    reloadPending = false;
+    syncingView = false;
+}
+
+ImageContainer::~ImageContainer()
+{
+    releaseMemoryEntries();
+    frames.clear();
+    recountDecodedFiles();
+}
+
+/**
+ * @brief ImageContainer::releaseMemoryEntries
+ *
+ * Remove the decoded frames, the frame pixmaps, the preview and the display pixmap from the
+ * memory budget.
+ */
+void ImageContainer::releaseMemoryEntries()
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+
+    budget->unregisterEntry(framesEntry);
+    budget->unregisterEntry(previewEntry);
+    budget->unregisterEntry(displayEntry);
+    for(int i = 0; i < framePixmapEntries.size(); i++) {
+        budget->unregisterEntry(framePixmapEntries[i]);
+    }
+    for(int i = 0; i < sequenceFrameEntries.size(); i++) {
+        budget->unregisterEntry(sequenceFrameEntries[i]);
+    }
+    framesEntry = 0;
+    previewEntry = 0;
+    displayEntry = 0;
+    pinnedFrame = -1;
+    framePixmapEntries.fill(0);
+    sequenceFrameEntries.fill(0);
+    displayPixmap = QPixmap();
 }
 
 /**
  * @brief ImageContainer::wheelEvent
  * @param event the mouse wheel event.
  *
- * When the mouse wheel scroll ↑, the image will zoom out.
- * When the mouse wheel scroll ↓, the image will zoom in.
+ * The wheel above the image is handled in eventFilter(), zoomed at the cursor. Elsewhere in the
+ * container, zoom at the center of the view.
  * If no image load, the event doesn't trigger anything.
  */
 void ImageContainer::wheelEvent(QWheelEvent *event)
 {
-    if(image == nullptr) {
+    if(!hasPixels()) {
         return;
     }
 
-    if(event->delta() > 0) {
-        if(showScaleRatio + scaleFactor > 2) {
-            return;
-        }
-        showScaleRatio += scaleFactor;
-        imageLabel->resize(fileIntoContainerScaleRatio * showScaleRatio * imageLabel->pixmap()->size());
+    zoom(qPow(ZoomStep, event->angleDelta().y() / 120.0), imageArea->viewport()->rect().center());
+}
+
+/**
+ * @brief ImageContainer::zoom
+ * @param factor the zoom change, above 1 to zoom in.
+ * @param anchor a position in the viewport, the image pixel there stays there.
+ *
+ * The zoom goes from half of the fitted size up to maximumShowScaleRatio().
+ */
+void ImageContainer::zoom(double factor, const QPoint &anchor)
+{
+    double ratio = qBound(MinimumShowScaleRatio, showScaleRatio * factor, maximumShowScaleRatio());
+    if(ratio == showScaleRatio) {
+        return;
     }
-    else {
-        if(showScaleRatio - scaleFactor < 0.5) {
-            return;
-        }
-        showScaleRatio -= scaleFactor;
-        imageLabel->resize(fileIntoContainerScaleRatio * showScaleRatio * imageLabel->pixmap()->size());
+
+    // The image position under the anchor, before the canvas changes.
+    QPointF imagePos = QPointF(anchor - imageCanvas->pos()) / displayScale();
+
+    showScaleRatio = ratio;
+    applyScale();
+
+    imageArea->horizontalScrollBar()->setValue(qRound(imagePos.x() * displayScale() - anchor.x()));
+    imageArea->verticalScrollBar()->setValue(qRound(imagePos.y() * displayScale() - anchor.y()));
+    displayTimer->start();
+
+    // Another pixel is under the cursor now.
+    if(loupe->isVisible()) {
+        updateLoupe(imageCanvas->mapFrom(imageArea->viewport(), anchor));
     }
 
     emit showScaleRatioChangeSignal(showScaleRatio);
 }
 
+/**
+ * @brief ImageContainer::maximumShowScaleRatio
+ * @return the largest zoom, relative to the fitted size.
+ *
+ * 64 screen pixels per image pixel, or less when the canvas would be larger than a widget can be.
+ */
+double ImageContainer::maximumShowScaleRatio() const
+{
+    int side = qMax(image->width(), image->height());
+    double scale = qMin(MaximumScale, double(MaximumCanvasSide) / qMax(side, 1));
+    return qMax(MinimumShowScaleRatio, scale / fileIntoContainerScaleRatio);
+}
+
+/**
+ * @brief ImageContainer::displayScale
+ * @return screen pixels per image pixel.
+ */
+double ImageContainer::displayScale() const
+{
+    return fileIntoContainerScaleRatio * showScaleRatio;
+}
+
+/**
+ * @brief ImageContainer::applyScale
+ *
+ * Resize the canvas to the zoomed image, the scroll area updates its scroll bars.
+ */
+void ImageContainer::applyScale()
+{
+    // A larger window or a reloaded image may leave the zoom past the largest canvas.
+    showScaleRatio = qMin(showScaleRatio, maximumShowScaleRatio());
+    imageCanvas->setScale(displayScale());
+    imageCanvas->resize(displayScale() * image->size());
+}
+
+/**
+ * @brief ImageContainer::updateLoupe
+ * @param pos the cursor position on the canvas.
+ *
+ * Show the pixels around the cursor in the loupe, next to the cursor.
+ */
+void ImageContainer::updateLoupe(const QPoint &pos)
+{
+    if(!loupeEnabled || !hasPixels()) {
+        return;
+    }
+
+    loupe->setPixels(*image, imageCanvas->mapToImage(pos), getPixelColor(pos.x(), pos.y()));
+    loupe->moveNear(imageCanvas->mapTo(imageArea->viewport(), pos));
+    loupe->show();
+    loupe->raise();
+}
+
+/**
+ * @brief ImageContainer::setLoupeVisible
+ * @param visible whether the loupe follows the cursor above the image.
+ *
+ * It's a slot function.
+ */
+void ImageContainer::setLoupeVisible(bool visible)
+{
+    loupeEnabled = visible;
+    if(!visible) {
+        loupe->hide();
+    }
+}
+
+/**
+ * @brief ImageContainer::getVisibleRect
+ * @return the part of the image shown in the viewport, in image pixels.
+ */
+QRect ImageContainer::getVisibleRect() const
+{
+    if(image == nullptr) {
+        return QRect();
+    }
+
+    QWidget *viewport = imageArea->viewport();
+    QRect canvasRect(imageCanvas->mapFrom(viewport, QPoint(0, 0)), viewport->size());
+    canvasRect = canvasRect.intersected(imageCanvas->rect());
+    if(canvasRect.isEmpty()) {
+        return QRect();
+    }
+    return QRect(imageCanvas->mapToImage(canvasRect.topLeft()), imageCanvas->mapToImage(canvasRect.bottomRight()));
+}
+
+/**
+ * @brief ImageContainer::emitVisibleRect
+ *
+ * It's a slot function.
+ */
+void ImageContainer::emitVisibleRect()
+{
+    if(image != nullptr) {
+        emit visibleRectChangeSignal(getVisibleRect());
+        if(!syncingView) {
+            emit viewChangeSignal(showScaleRatio, getViewCenter());
+        }
+    }
+}
+
+/**
+ * @brief ImageContainer::getViewCenter
+ * @return the image point at the center of the viewport, from (0, 0) at the top left corner to
+ * (1, 1) at the bottom right one.
+ *
+ * Relative, so two images of different sizes in the compare view show the same part.
+ */
+QPointF ImageContainer::getViewCenter() const
+{
+    QWidget *viewport = imageArea->viewport();
+    QPoint center = imageCanvas->mapFrom(viewport, viewport->rect().center());
+    return QPointF(double(center.x()) / qMax(1, imageCanvas->width()),
+                   double(center.y()) / qMax(1, imageCanvas->height()));
+}
+
+/**
+ * @brief ImageContainer::setView
+ * @param showScaleRatio the zoom, relative to the fitted size.
+ * @param center the relative image point to show at the center of the viewport.
+ *
+ * It's a slot function.
+ * The other side of the compare view zoomed or scrolled, follow it. It doesn't send the change
+ * back.
+ */
+void ImageContainer::setView(double showScaleRatio, const QPointF &center)
+{
+    if(!hasPixels()) {
+        return;
+    }
+
+    syncingView = true;
+    this->showScaleRatio = qBound(MinimumShowScaleRatio, showScaleRatio, maximumShowScaleRatio());
+    applyScale();
+
+    QSize viewport = imageArea->viewport()->size();
+    imageArea->horizontalScrollBar()->setValue(qRound(center.x() * imageCanvas->width() - viewport.width() / 2.0));
+    imageArea->verticalScrollBar()->setValue(qRound(center.y() * imageCanvas->height() - viewport.height() / 2.0));
+    displayTimer->start();
+    syncingView = false;
+
+    emit showScaleRatioChangeSignal(this->showScaleRatio);
+}
+
+/**
+ * @brief ImageContainer::setPixelGridVisible
+ * @param visible whether the lines between pixels are drawn at high zoom.
+ *
+ * It's a slot function.
+ */
+void ImageContainer::setPixelGridVisible(bool visible)
+{
+    imageCanvas->setPixelGridVisible(visible);
+}
+
 /**
  * @brief ImageContainer::resizeEvent
  * @param event the resize event.
@@ -110,9 +515,13 @@ void ImageContainer::resizeEvent(QResizeEvent *event)
     }
     imageAreaWidth = imageArea->viewport()->geometry().width();
     imageAreaHeight = imageArea->viewport()->geometry().height();
+    if(!hasPixels()) {
+        return;
+    }
 
     computeFileIntoContainerScaleRatio();
-    imageLabel->resize(fileIntoContainerScaleRatio * showScaleRatio * imageLabel->pixmap()->size());
+    applyScale();
+    displayTimer->start();
 }
 
 /**
@@ -130,25 +539,38 @@ void ImageContainer::resizeEvent(QResizeEvent *event)
  */
 bool ImageContainer::eventFilter(QObject *watched, QEvent *event)
 {
-    if(watched == imageLabel) {
-        if(image == nullptr) {
-            return true;
+    if(watched == imageCanvas) {
+        if(!hasPixels()) {
+            return QWidget::eventFilter(watched, event);
         }
         if(event->type() == QEvent::MouseMove) {
             QMouseEvent *e = static_cast<QMouseEvent*>(event);
 
             QColor color = getPixelColor(e->pos().x(), e->pos().y());
             QString colorValue = qcolorToString(color);
-            int x = e->pos().x() / showScaleRatio / fileIntoContainerScaleRatio;
-            int y = e->pos().y() / showScaleRatio / fileIntoContainerScaleRatio;
+            QPoint pixel = imageCanvas->mapToImage(e->pos());
 
-            emit cursorInImageSignal(x, y, colorValue);
+            emit cursorInImageSignal(pixel.x(), pixel.y(), colorValue);
             emit cursorInImageSignal(color);
+
+            updateLoupe(e->pos());
+        }
+        else if(event->type() == QEvent::Wheel) {
+            QWheelEvent *e = static_cast<QWheelEvent*>(event);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+            QPoint pos = e->position().toPoint();
+#else
+            QPoint pos = e->pos();
+#endif
+
+            zoom(qPow(ZoomStep, e->angleDelta().y() / 120.0), imageCanvas->mapTo(imageArea->viewport(), pos));
+            return true;
         }
         else if(event->type() == QEvent::Enter) {
             emit cursorInImageSignal();
         }
         else if(event->type() == QEvent::Leave) {
+            loupe->hide();
             emit cursorOutImageSignal();
         }
         else if(event->type() == QEvent::MouseButtonDblClick) {
@@ -162,11 +584,220 @@ bool ImageContainer::eventFilter(QObject *watched, QEvent *event)
             emit copySuccessFromImageLabelSignal();
         }
     }
+    return QWidget::eventFilter(watched, event);
+}
+
+ImageCanvas *ImageContainer::getImageCanvas() const
+{
+    return imageCanvas;
+}
+
+QVector<QImage> ImageContainer::getFrames() const
+{
+    return frames;
+}
+
+/**
+ * @brief ImageContainer::isSequence
+ * @return whether the frames are the files of an image sequence.
+ *
+ * The frames of a sequence are read in the background and may be dropped under memory
+ * pressure, so getFrames() may return null images for them.
+ */
+bool ImageContainer::isSequence() const
+{
+    return !sequenceFiles.isEmpty();
+}
+
+QStringList ImageContainer::getSequenceFiles() const
+{
+    return sequenceFiles;
+}
+
+bool ImageContainer::isPlaying() const
+{
+    return playTimer->isActive();
+}
+
+QString ImageContainer::getFileName() const
+{
+    return fileName;
+}
+
+/**
+ * @brief ImageContainer::getInfo
+ * @return the file name and the image size for the status bar, empty if no image is open. The
+ * size isn't known while the pixels are dropped.
+ */
+QString ImageContainer::getInfo() const
+{
+    if(image == nullptr) {
+        return QString();
+    }
+
+    QFileInfo fi(fileName);
+    QString info;
+
+    if(fi.fileName().length() > 15) {
+        info += "...";
+    }
+    else {
+        info += fi.fileName();
+    }
+    if(!hasPixels()) {
+        return info;
+    }
+
+    info += ", " + QString::number(image->width()) + "*";
+    info += QString::number(image->height());
+    return info;
+}
+
+/**
+ * @brief ImageContainer::setActive
+ * @param active whether the document is on screen.
+ *
+ * The decoded frames of a document on screen are never dropped. In a background tab they are
+ * budget entries like any cache: under memory pressure they are dropped, and the file is decoded
+ * again when the tab is shown. A background document also waits until it's shown to reload its
+ * changed file, so the visible one gets the CPU.
+ */
+void ImageContainer::setActive(bool active)
+{
+    if(this->active == active) {
+        return;
+    }
+    this->active = active;
+
+    MemoryBudget *budget = MemoryBudget::instance();
+    if(!active) {
+        playButton->setChecked(false);
+        budget->setPinned(framesEntry, false);
+        budget->setPinned(sequenceFrameEntries.value(currentFrame), false);
+        budget->setPinned(framePixmapEntries.value(pinnedFrame), false);
+        return;
+    }
+
+    if(framesDropped && !restoreFrames()) {
+        return;
+    }
+    // The shown sequence frame may have been dropped in the background, read it again.
+    if(isSequence() && !hasPixels() && image != nullptr && ensureFrame(currentFrame)) {
+        *image = frames[currentFrame];
+    }
+    budget->setPinned(framesEntry, true);
+    budget->setPinned(sequenceFrameEntries.value(currentFrame), true);
+    if(reloadPending) {
+        reloadPending = false;
+        reloadImage();
+    }
+
+    // The container may have been resized while its pixels were dropped.
+    if(hasPixels()) {
+        computeFileIntoContainerScaleRatio();
+        applyScale();
+    }
+    updateDisplayPixmap();
+}
+
+/**
+ * @brief ImageContainer::hasPixels
+ * @return whether an image is open and its shown frame is in memory.
+ *
+ * The pixels of a background document may be dropped, then image is a null image until the
+ * document is shown again.
+ */
+bool ImageContainer::hasPixels() const
+{
+    return image != nullptr && !image->isNull();
+}
+
+/**
+ * @brief ImageContainer::dropFrames
+ *
+ * The evictor of the decoded frames of a background document: drop every pixel made from the
+ * file, only the file name, the tile hashes and the view are kept.
+ */
+void ImageContainer::dropFrames()
+{
+    framesEntry = 0;
+    framesDropped = true;
+
+    MemoryBudget *budget = MemoryBudget::instance();
+    for(int i = 0; i < framePixmapEntries.size(); i++) {
+        budget->unregisterEntry(framePixmapEntries[i]);
+    }
+    budget->unregisterEntry(previewEntry);
+    budget->unregisterEntry(displayEntry);
+    framePixmapEntries.fill(0);
+    previewEntry = 0;
+    displayEntry = 0;
+    pinnedFrame = -1;
+
+    frames.fill(QImage());
+    framePixmaps.fill(QPixmap());
+    previewImage = QImage();
+    previewPixmap = QPixmap();
+    displayPixmap = QPixmap();
+    *image = QImage();
+    imageCanvas->setPixmaps(QPixmap(), QPixmap());
+    recountDecodedFiles();
+}
+
+/**
+ * @brief ImageContainer::restoreFrames
+ * @return whether the pixels are back.
+ *
+ * Decode the file of a document shown again. If it changed while its pixels were dropped, it's
+ * loaded again completely, there are no previous frames to compare the tiles with. If it can't
+ * be read any more (deleted or moved), the failure is reported and the document stays dropped,
+ * it's tried again the next time it's shown.
+ */
+bool ImageContainer::restoreFrames()
+{
+    QVector<QImage> newFrames;
+    QVector<int> delays;
+    if(!readSharedFrames(fileName, newFrames, delays)) {
+        emit openImageFailedSignal();
+        return false;
+    }
+
+    bool same = newFrames.size() == tileHashes.size();
+    for(int i = 0; same && i < newFrames.size(); i++) {
+        same = hashTiles(newFrames[i]) == tileHashes[i];
+    }
+
+    if(!same) {
+        // loadImage() reports its own failure, and clears the dropped state when it succeeds.
+        if(!loadImage(fileName)) {
+            return false;
+        }
+        FrameChanges changes;
+        changes.resized = true;
+        emit imageReloadSignal(changes);
+        return true;
+    }
+
+    framesDropped = false;
+    frames = newFrames;
+    frameDelays = delays;
+    *image = frames[currentFrame];
+
+    qint64 frameBytes = 0;
+    for(int i = 0; i < frames.size(); i++) {
+        frameBytes += frames[i].sizeInBytes();
+    }
+    framesEntry = MemoryBudget::instance()->registerEntry("decoded frames", frameBytes, frameBytes / 100,
+                                                          [this]() { dropFrames(); });
+    return true;
 }
 
-QLabel *ImageContainer::getImageLabel() const
+QImage ImageContainer::getImage() const
 {
-    return imageLabel;
+    if(image == nullptr) {
+        return QImage();
+    }
+    return *image;
 }
 
 double ImageContainer::getShowScaleRatio() const
@@ -183,14 +814,14 @@ double ImageContainer::getFileIntoContainerScaleRatio() const
  * @brief ImageContainer::getPixelColor
  * @param x the mouse cursor pos x
  * @param y the mouse cursor pos y
- * @return the color the cursor points
+ * @return the color the cursor points, with 16 bits per channel for a 16-bit image.
  */
 QColor ImageContainer::getPixelColor(int x, int y)
 {
-    x /= fileIntoContainerScaleRatio * showScaleRatio;
-    y /= fileIntoContainerScaleRatio * showScaleRatio;
-
-    return image->pixelColor(x, y);
+    if(!hasPixels()) {
+        return QColor();
+    }
+    return image->pixelColor(imageCanvas->mapToImage(QPoint(x, y)));
 }
 
 /**
@@ -203,8 +834,11 @@ QColor ImageContainer::getPixelColor(int x, int y)
  */
 void ImageContainer::computeFileIntoContainerScaleRatio()
 {
-    int imageWidth = imageLabel->pixmap()->size().width();
-    int imageHeight = imageLabel->pixmap()->size().height();
+    if(!hasPixels()) {
+        return;
+    }
+    int imageWidth = image->width();
+    int imageHeight = image->height();
     double factor = 0.0;
     double x = 1.0 * imageAreaWidth / imageWidth;
     double y = 1.0 * imageAreaHeight / imageHeight;
@@ -213,6 +847,280 @@ void ImageContainer::computeFileIntoContainerScaleRatio()
     fileIntoContainerScaleRatio = 0.95 * factor;
 }
 
+/**
+ * @brief ImageContainer::setPalettePreview
+ * @param palette the colors of the color board.
+ * @param mode the dithering method.
+ *
+ * Show the image drawn only with the palette colors, so users can judge the palette.
+ * The picked colors still come from the original image.
+ */
+void ImageContainer::setPalettePreview(const QVector<QColor> &palette, DitherMode mode)
+{
+    if(!hasPixels()) {
+        return;
+    }
+
+    InverseColormap colormap(palette);
+    if(colormap.isEmpty()) {
+        return;
+    }
+    previewImage = colormap.remap(*image, mode);
+    previewPixmap = QPixmap::fromImage(previewImage);
+
+    // The preview is on screen, so it's counted but never evicted.
+    MemoryBudget *budget = MemoryBudget::instance();
+    budget->unregisterEntry(previewEntry);
+    previewEntry = budget->registerEntry("palette preview", previewImage.sizeInBytes() * 2, 0);
+
+    updateDisplayPixmap();
+}
+
+/**
+ * @brief ImageContainer::clearPalettePreview
+ *
+ * Show the original image again.
+ */
+void ImageContainer::clearPalettePreview()
+{
+    if(image == nullptr) {
+        return;
+    }
+    previewImage = QImage();
+    previewPixmap = QPixmap();
+    MemoryBudget::instance()->unregisterEntry(previewEntry);
+    previewEntry = 0;
+
+    updateDisplayPixmap();
+}
+
+/**
+ * @brief ImageContainer::updateDisplayPixmap
+ * @param resample false to only give the canvas the full size pixmap, which it scales itself.
+ *
+ * It's a slot function.
+ * Give the canvas the full size pixmap (the frame or the palette preview). When the image is
+ * shown smaller than its size, also make a pixmap of exactly the shown size with the Lanczos
+ * resampler, so the canvas doesn't have to choose between aliased fast scaling and slow smooth
+ * scaling. At 100% or larger, the canvas draws the source pixels directly.
+ */
+void ImageContainer::updateDisplayPixmap(bool resample)
+{
+    if(!hasPixels()) {
+        return;
+    }
+
+    MemoryBudget *budget = MemoryBudget::instance();
+    budget->setPinned(framePixmapEntries.value(pinnedFrame), false);
+    budget->unregisterEntry(displayEntry);
+    displayEntry = 0;
+    pinnedFrame = -1;
+    displayPixmap = QPixmap();
+
+    // A high bit depth frame has no full size pixmap, the canvas converts the tiles it shows.
+    bool wide = previewPixmap.isNull() && isHighBitDepth(frames[currentFrame]);
+
+    QPixmap source;
+    if(!previewPixmap.isNull()) {
+        source = previewPixmap;
+    }
+    else if(!wide) {
+        source = framePixmap(currentFrame);
+        pinnedFrame = currentFrame;
+        budget->setPinned(framePixmapEntries[currentFrame], true);
+    }
+
+    /*
+     * While playing or scrubbing, resampling every frame would take longer than showing it, so
+     * the canvas scales the frame pixmap. The sharp pixmap is made when the playback stops or
+     * the frame scrubber rests.
+     */
+    QPixmap display;
+    const QImage &sourceImage = previewImage.isNull() ? frames[currentFrame] : previewImage;
+    QSize target = imageCanvas->size();
+    if(!target.isEmpty() && target.width() < sourceImage.width() && target.height() < sourceImage.height()
+       && resample && !playTimer->isActive()) {
+        display = QPixmap::fromImage(resampleImage(sourceImage, target, Lanczos3Filter));
+        displayPixmap = display;
+
+        // A pixmap made only for the screen is counted but never evicted.
+        displayEntry = budget->registerEntry("display pixmap",
+                                             qint64(display.width()) * display.height() * display.depth() / 8, 0);
+    }
+
+    if(wide) {
+        imageCanvas->setImage(sourceImage, display);
+    }
+    else {
+        imageCanvas->setPixmaps(source, display);
+    }
+}
+
+/**
+ * @brief ImageContainer::patchDisplayPixmap
+ * @param tiles the changed tiles of the current frame.
+ *
+ * Only the display pixels whose filter reaches into a changed tile are resampled again, with the
+ * weights of the whole pixmap, so the patched pixmap is the one updateDisplayPixmap() would make.
+ * Without a sharp pixmap of the current frame at the current size it falls back to
+ * updateDisplayPixmap().
+ */
+void ImageContainer::patchDisplayPixmap(const QVector<QRect> &tiles)
+{
+    const QImage &frame = frames[currentFrame];
+    if(displayPixmap.isNull() || displayPixmap.size() != imageCanvas->size() || !previewPixmap.isNull()
+       || playTimer->isActive()) {
+        updateDisplayPixmap();
+        return;
+    }
+
+    double scaleX = double(displayPixmap.width()) / frame.width();
+    double scaleY = double(displayPixmap.height()) / frame.height();
+    QPainter painter(&displayPixmap);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for(int i = 0; i < tiles.size(); i++) {
+        const QRect &tile = tiles[i];
+        QRect region(QPoint(qFloor(tile.left() * scaleX) - DisplayFilterReach,
+                            qFloor(tile.top() * scaleY) - DisplayFilterReach),
+                     QPoint(qCeil((tile.right() + 1) * scaleX) + DisplayFilterReach,
+                            qCeil((tile.bottom() + 1) * scaleY) + DisplayFilterReach));
+        region = region.intersected(displayPixmap.rect());
+        painter.drawImage(region.topLeft(), resampleRegion(frame, displayPixmap.size(), region, Lanczos3Filter));
+    }
+    painter.end();
+
+    if(isHighBitDepth(frame)) {
+        imageCanvas->setImage(frame, displayPixmap);
+    }
+    else {
+        imageCanvas->setPixmaps(framePixmap(currentFrame), displayPixmap);
+    }
+}
+
+/**
+ * @brief ImageContainer::framePixmap
+ * @param index the frame index.
+ * @return the pixmap of the frame.
+ *
+ * Every frame is converted to a pixmap the first time it's shown and then kept, so moving the
+ * frame scrubber back and forth doesn't decode or convert anything again.
+ * The pixmaps are registered to the memory budget, which may drop those not on screen. They are
+ * converted again from the decoded frame when needed.
+ */
+QPixmap ImageContainer::framePixmap(int index)
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+
+    if(framePixmaps[index].isNull()) {
+        framePixmaps[index] = QPixmap::fromImage(frames[index]);
+
+        const QPixmap &pixmap = framePixmaps[index];
+        qint64 bytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+        framePixmapEntries[index] = budget->registerEntry("frame pixmap", bytes, bytes / 1000, [this, index]() {
+            framePixmaps[index] = QPixmap();
+            framePixmapEntries[index] = 0;
+        });
+    }
+    else {
+        budget->touch(framePixmapEntries[index]);
+    }
+
+    return framePixmaps[index];
+}
+
+/**
+ * @brief ImageContainer::ensureFrame
+ * @param index the frame index.
+ * @return whether the frame can be shown.
+ *
+ * A sequence frame may not be read yet, or it was dropped under memory pressure and is read
+ * again from its file.
+ */
+bool ImageContainer::ensureFrame(int index)
+{
+    if(index >= loadedFrames) {
+        return false;
+    }
+    if(frames[index].isNull() && !sequenceFiles.isEmpty()) {
+        frames[index] = readImage(sequenceFiles[index]);
+        registerSequenceFrame(index);
+    }
+    return !frames[index].isNull();
+}
+
+/**
+ * @brief ImageContainer::registerSequenceFrame
+ * @param index the frame index.
+ *
+ * Every sequence frame is its own budget entry, so the frames far from the shown one can be
+ * dropped. They are read again from the file when needed.
+ */
+void ImageContainer::registerSequenceFrame(int index)
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+    budget->unregisterEntry(sequenceFrameEntries[index]);
+    sequenceFrameEntries[index] = 0;
+    if(frames[index].isNull()) {
+        return;
+    }
+
+    // Decoding a file costs about ten times more than converting a frame to a pixmap.
+    qint64 bytes = frames[index].sizeInBytes();
+    sequenceFrameEntries[index] = budget->registerEntry("sequence frame", bytes, bytes / 100, [this, index]() {
+        frames[index] = QImage();
+        sequenceFrameEntries[index] = 0;
+
+        // The shown frame of a background document is shared with image, nothing is freed
+        // unless both let it go.
+        if(index == currentFrame && image != nullptr) {
+            *image = QImage();
+            displayPixmap = QPixmap();
+            imageCanvas->setPixmaps(QPixmap(), QPixmap());
+        }
+    });
+}
+
+/**
+ * @brief ImageContainer::showFrame
+ * @param index the frame index.
+ *
+ * It's a slot function.
+ * When users move the frame scrubber, show the frame and pick colors from it. A sequence frame
+ * which isn't read yet can't be shown, the scrubber goes back.
+ */
+void ImageContainer::showFrame(int index)
+{
+    if(image == nullptr || index < 0 || index >= frames.size()) {
+        return;
+    }
+    if(!ensureFrame(index)) {
+        frameSlider->blockSignals(true);
+        frameSlider->setValue(currentFrame);
+        frameSlider->blockSignals(false);
+        return;
+    }
+
+    // The decoded frame on screen is never dropped.
+    MemoryBudget *budget = MemoryBudget::instance();
+    budget->setPinned(sequenceFrameEntries.value(currentFrame), false);
+    budget->setPinned(sequenceFrameEntries.value(index), true);
+
+    currentFrame = index;
+    *image = frames[index];
+
+    // Pages of a multi-page file may have different sizes.
+    computeFileIntoContainerScaleRatio();
+    applyScale();
+    updateDisplayPixmap(false);
+    if(!playTimer->isActive()) {
+        displayTimer->start();
+    }
+
+    frameLabel->setText(QString::number(index + 1) + "/" + QString::number(frames.size()));
+
+    emit frameChangeSignal(index);
+}
+
 /**
  * @brief ImageContainer::loadImage
  * @param fileName the image file name
@@ -222,40 +1130,366 @@ void ImageContainer::computeFileIntoContainerScaleRatio()
  */
 bool ImageContainer::loadImage(QString fileName)
 {
+    QVector<QImage> newFrames;
+    QVector<int> delays;
+
+    if(!readSharedFrames(fileName, newFrames, delays)) {
+        emit openImageFailedSignal();
+        return false;
+    }
+
+    resetFrames(newFrames.size());
+    frames = newFrames;
+    frameDelays = delays;
+    loadedFrames = frames.size();
+
+    /*
+     * The decoded frames are the source of everything else, they stay while the document is on
+     * screen. In a background tab they may be dropped, see setActive().
+     */
+    qint64 frameBytes = 0;
+    for(int i = 0; i < frames.size(); i++) {
+        frameBytes += frames[i].sizeInBytes();
+    }
+    MemoryBudget *budget = MemoryBudget::instance();
+    framesEntry = budget->registerEntry("decoded frames", frameBytes, frameBytes / 100, [this]() { dropFrames(); });
+    budget->setPinned(framesEntry, active);
+
+    // Keep the tile hashes, so a new version of the file is compared tile by tile.
+    tileHashes.resize(frames.size());
+    for(int i = 0; i < frames.size(); i++) {
+        tileHashes[i] = hashTiles(frames[i]);
+    }
+
+    this->fileName = fileName;
+    fileWatcher->addPath(fileName);
+
+    showFirstFrame();
+    return true;
+}
+
+/**
+ * @brief ImageContainer::loadSequence
+ * @param fileNames the files of the sequence, in order.
+ *
+ * Get ready for the frames of a sequence. They come one by one from the sequence reader through
+ * setSequenceFrame(), the first one is shown as soon as it's there.
+ */
+void ImageContainer::loadSequence(const QStringList &fileNames)
+{
+    resetFrames(fileNames.size());
+    sequenceFiles = fileNames;
+    sequenceFrameEntries.fill(0, fileNames.size());
+    fileName = fileNames.value(0);
+
+    int frameRate = qMax(1, QSettings("MyPaint", "MyPaint").value("sequenceFrameRate", 24).toInt());
+    frameDelays.fill(1000 / frameRate, fileNames.size());
+
+    imageCanvas->setPixmaps(QPixmap(), QPixmap());
+    imageCanvas->resize(0, 0);
+}
+
+/**
+ * @brief ImageContainer::setSequenceFrame
+ * @param index the frame index.
+ * @param frame the decoded frame, null if the file can't be read.
+ *
+ * It's a slot function.
+ * The frames come in order, so all frames up to index are read.
+ */
+void ImageContainer::setSequenceFrame(int index, const QImage &frame)
+{
+    if(sequenceFiles.isEmpty() || index < 0 || index >= frames.size()) {
+        return;
+    }
+
+    frames[index] = frame;
+    loadedFrames = index + 1;
+    registerSequenceFrame(index);
+
+    if(image == nullptr && !frame.isNull()) {
+        currentFrame = index;
+        MemoryBudget::instance()->setPinned(sequenceFrameEntries[index], true);
+        frameSlider->blockSignals(true);
+        frameSlider->setValue(index);
+        frameSlider->blockSignals(false);
+        frameLabel->setText(QString::number(index + 1) + "/" + QString::number(frames.size()));
+        showFirstFrame();
+    }
+}
+
+/**
+ * @brief ImageContainer::resetFrames
+ * @param count the frame count of the image to show.
+ *
+ * Drop the image shown and everything made from it, and set up the frame scrubber.
+ */
+void ImageContainer::resetFrames(int count)
+{
+    playTimer->stop();
+    playButton->blockSignals(true);
+    playButton->setChecked(false);
+    playButton->setText(tr("Play"));
+    playButton->blockSignals(false);
+
     if(image != nullptr) {
         delete image;
+        image = nullptr;
     }
-    image = new QImage(fileName);
+    releaseMemoryEntries();
 
-    if(image->isNull()) {
-        emit openImageFailedSignal();
-        return false;
+    // The frames still being read belong to the previous file.
+    QHash<QFutureWatcher<QImage> *, int>::const_iterator it;
+    for(it = prefetches.constBegin(); it != prefetches.constEnd(); it++) {
+        it.key()->disconnect(this);
+        it.key()->deleteLater();
     }
+    prefetches.clear();
 
-    imageLabel->setPixmap(QPixmap::fromImage(*image));
+    frames.clear();
+    frames.resize(count);
+    framePixmaps.clear();
+    framePixmaps.resize(count);
+    framePixmapEntries.fill(0, count);
+    sequenceFiles.clear();
+    sequenceFrameEntries.clear();
+    frameDelays.clear();
+    tileHashes.clear();
+    currentFrame = 0;
+    loadedFrames = 0;
+    framesDropped = false;
+    reloadPending = false;
+
+    reloadTimer->stop();
+    if(!fileWatcher->files().isEmpty()) {
+        fileWatcher->removePaths(fileWatcher->files());
+    }
+
+    frameSlider->blockSignals(true);
+    frameSlider->setRange(0, count - 1);
+    frameSlider->setValue(0);
+    frameSlider->blockSignals(false);
+    frameSlider->setVisible(count > 1);
+    frameLabel->setVisible(count > 1);
+    playButton->setVisible(count > 1);
+    frameLabel->setText("1/" + QString::number(count));
+    recountDecodedFiles();
+}
+
+/**
+ * @brief ImageContainer::showFirstFrame
+ *
+ * Show the current frame of an image just loaded, fitted in the container.
+ */
+void ImageContainer::showFirstFrame()
+{
+    image = new QImage(frames[currentFrame]);
 
     imageAreaWidth = imageArea->viewport()->geometry().width();
     imageAreaHeight = imageArea->viewport()->geometry().height();
 
     computeFileIntoContainerScaleRatio();
-    imageLabel->resize(fileIntoContainerScaleRatio * showScaleRatio * imageLabel->pixmap()->size());
+    applyScale();
+    updateDisplayPixmap();
 
-    QFileInfo fi(fileName);
-    QString info;
+    emit imageFileChangeSignal(getInfo());
+    emit showScaleRatioChangeSignal(showScaleRatio);
+    emit cursorOutImageSignal();
+}
 
-    if(fi.fileName().length() > 15) {
-        info += "..., ";
+/**
+ * @brief ImageContainer::setPlaying
+ * @param playing whether the frames are played.
+ *
+ * It's a slot function.
+ * When the playback stops, the shown frame gets its sharp pixmap, and the color board and the
+ * histogram catch up with it.
+ */
+void ImageContainer::setPlaying(bool playing)
+{
+    if(playing == playTimer->isActive()) {
+        return;
+    }
+
+    if(playing) {
+        if(image == nullptr || frames.size() < 2) {
+            playButton->setChecked(false);
+            return;
+        }
+        playButton->setText(tr("Pause"));
+        playTimer->start(frameInterval(currentFrame));
     }
     else {
-        info += fi.fileName() + ", ";
+        playTimer->stop();
+        playButton->setText(tr("Play"));
+        updateDisplayPixmap();
+        emit frameChangeSignal(currentFrame);
     }
+}
 
-    info += QString::number(imageLabel->pixmap()->size().width()) + "*";
-    info += QString::number(imageLabel->pixmap()->size().height());
+/**
+ * @brief ImageContainer::playNextFrame
+ *
+ * It's a slot function.
+ * Show the next frame which can be shown. When the sequence reader is behind, wait for it.
+ * A sequence frame dropped by the memory budget is never read on the UI thread while playing:
+ * it's read in the background, with the next few frames, and up to PrefetchFrames frames which
+ * aren't back yet are skipped. Past that the playback waits for them.
+ */
+void ImageContainer::playNextFrame()
+{
+    for(int step = 1; step < frames.size(); step++) {
+        int next = (currentFrame + step) % frames.size();
+        if(next >= loadedFrames) {
+            return;
+        }
+        if(!frames[next].isNull()) {
+            frameSlider->setValue(next);
+            playTimer->setInterval(frameInterval(next));
+            for(int i = 1; i <= PrefetchFrames; i++) {
+                prefetchFrame((next + i) % frames.size());
+            }
+            return;
+        }
+        prefetchFrame(next);
+        if(step >= PrefetchFrames) {
+            return;
+        }
+    }
+}
 
-    emit imageFileChangeSignal(info);
-    emit showScaleRatioChangeSignal(showScaleRatio);
-    emit cursorOutImageSignal();
+/**
+ * @brief ImageContainer::prefetchFrame
+ * @param index the frame index.
+ *
+ * Read a dropped sequence frame again on the global thread pool, takePrefetchedFrame() keeps it.
+ */
+void ImageContainer::prefetchFrame(int index)
+{
+    if(sequenceFiles.isEmpty() || index >= loadedFrames || !frames[index].isNull()
+       || prefetches.key(index) != nullptr) {
+        return;
+    }
 
-    return true;
+    QString file = sequenceFiles[index];
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, SIGNAL(finished()), SLOT(takePrefetchedFrame()));
+    prefetches.insert(watcher, index);
+    watcher->setFuture(QtConcurrent::run([file]() { return readImage(file); }));
+}
+
+/**
+ * @brief ImageContainer::takePrefetchedFrame
+ *
+ * It's a slot function.
+ * Keep a frame read in the background. The reads of a file closed meanwhile were forgotten by
+ * resetFrames().
+ */
+void ImageContainer::takePrefetchedFrame()
+{
+    QFutureWatcher<QImage> *watcher = static_cast<QFutureWatcher<QImage> *>(sender());
+    watcher->deleteLater();
+    if(!prefetches.contains(watcher)) {
+        return;
+    }
+
+    int index = prefetches.take(watcher);
+    if(frames[index].isNull()) {
+        frames[index] = watcher->result();
+        registerSequenceFrame(index);
+    }
+}
+
+/**
+ * @brief ImageContainer::frameInterval
+ * @param index the frame index.
+ * @return how long the frame is shown while playing, in milliseconds.
+ */
+int ImageContainer::frameInterval(int index) const
+{
+    int delay = frameDelays.value(index);
+    return delay > 10 ? delay : DefaultFrameDelay;
+}
+
+/**
+ * @brief ImageContainer::reloadImage
+ *
+ * It's a slot function.
+ * When the open file is written again, decode it and compare it with the shown image tile by
+ * tile. Only the changed tiles are drawn into the frame pixmaps, and the color board gets them
+ * to update its histogram. If the frames don't match any more (count, size or format), the
+ * image is loaded again completely.
+ */
+void ImageContainer::reloadImage()
+{
+    if(image == nullptr || !sequenceFiles.isEmpty()) {
+        return;
+    }
+    if(!active || framesDropped) {
+        reloadPending = true;
+        return;
+    }
+
+    // Saving by rename replaces the file, and the watcher forgets it.
+    if(!fileWatcher->files().contains(fileName) && QFileInfo::exists(fileName)) {
+        fileWatcher->addPath(fileName);
+    }
+
+    QVector<QImage> newFrames;
+    QVector<int> delays;
+    if(!readImageFrames(fileName, newFrames, delays)) {
+        // The file may be half written, the next change tries again.
+        return;
+    }
+
+    bool sameLayout = newFrames.size() == frames.size();
+    for(int i = 0; sameLayout && i < frames.size(); i++) {
+        sameLayout = newFrames[i].size() == frames[i].size() && newFrames[i].format() == frames[i].format()
+                     && newFrames[i].colorTable() == frames[i].colorTable();
+    }
+
+    FrameChanges changes;
+    changes.resized = !sameLayout;
+    if(!sameLayout) {
+        if(loadImage(fileName)) {
+            emit imageReloadSignal(changes);
+        }
+        return;
+    }
+
+    int changedCount = 0;
+    changes.tiles.resize(frames.size());
+    for(int i = 0; i < frames.size(); i++) {
+        QVector<quint64> hashes = hashTiles(newFrames[i]);
+        changes.tiles[i] = changedTiles(newFrames[i], tileHashes[i], hashes);
+        tileHashes[i] = hashes;
+        changedCount += changes.tiles[i].size();
+    }
+    frameDelays = delays;
+    if(changedCount == 0) {
+        return;
+    }
+
+    changes.previousFrames = frames;
+    frames = newFrames;
+    *image = frames[currentFrame];
+
+    // Let the canvas release its pixmaps, so the frame pixmaps are patched without a copy.
+    imageCanvas->setPixmaps(QPixmap(), QPixmap());
+
+    for(int i = 0; i < frames.size(); i++) {
+        if(framePixmaps[i].isNull() || changes.tiles[i].isEmpty()) {
+            continue;
+        }
+        QPainter painter(&framePixmaps[i]);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for(int j = 0; j < changes.tiles[i].size(); j++) {
+            const QRect &tile = changes.tiles[i][j];
+            painter.drawImage(tile.topLeft(), frames[i], tile);
+        }
+    }
+    patchDisplayPixmap(changes.tiles[currentFrame]);
+    storeDecodedFile(fileName, frames, frameDelays);
+
+    emit imageReloadSignal(changes);
 }
@@ -8,17 +8,46 @@
 #include <QColor>
 #include <QImage>
 #include <QMouseEvent>
+#include <QVector>
+#include <QPixmap>
+#include <QSlider>
+#include <QToolButton>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QStringList>
+#include <QPointF>
+
+#include "palettemap.h"
+#include "tilehash.h"
+#include "imagecanvas.h"
+#include "loupe.h"
 
 class ImageContainer : public QWidget
 {
     Q_OBJECT
 public:
     explicit ImageContainer(QWidget *parent = 0);
+    ~ImageContainer();
     double getFileIntoContainerScaleRatio() const;
     double getShowScaleRatio() const;
-    QLabel *getImageLabel() const;
+    ImageCanvas *getImageCanvas() const;
+    QImage getImage() const;
+    QVector<QImage> getFrames() const;
+    QRect getVisibleRect() const;
+    bool isSequence() const;
+    QStringList getSequenceFiles() const;
+    bool isPlaying() const;
+    QString getFileName() const;
+    QString getInfo() const;
+    QPointF getViewCenter() const;
+    void setActive(bool active);
 
     bool loadImage(QString fileName);
+    void loadSequence(const QStringList &fileNames);
+    void setPalettePreview(const QVector<QColor> &palette, DitherMode mode);
+    void clearPalettePreview();
 protected:
     void wheelEvent(QWheelEvent *event);
     void resizeEvent(QResizeEvent *event);
@@ -26,12 +55,66 @@ protected:
 private:
     QScrollArea *imageArea;
     QImage *image;
-    QLabel *imageLabel;
-    double fileIntoContainerScaleRatio, showScaleRatio, scaleFactor;
+    ImageCanvas *imageCanvas;
+    Loupe *loupe;
+    bool loupeEnabled;
+    QVector<QImage> frames;
+    QVector<QPixmap> framePixmaps;
+    int currentFrame, loadedFrames;
+    QVector<int> frameDelays;
+    QStringList sequenceFiles;
+    QVector<int> sequenceFrameEntries;
+    QHash<QFutureWatcher<QImage> *, int> prefetches;
+    QTimer *playTimer;
+    QToolButton *playButton;
+    QImage previewImage;
+    QPixmap previewPixmap;
+    QPixmap displayPixmap;
+    QTimer *displayTimer;
+    int framesEntry, previewEntry, displayEntry, pinnedFrame;
+    QVector<int> framePixmapEntries;
+    QString fileName;
+    QFileSystemWatcher *fileWatcher;
+    QTimer *reloadTimer;
+    bool active, framesDropped, reloadPending, syncingView;
+    QVector<QVector<quint64> > tileHashes;
+    QSlider *frameSlider;
+    QLabel *frameLabel;
+    double fileIntoContainerScaleRatio, showScaleRatio;
     int imageAreaWidth, imageAreaHeight;
 
     QColor getPixelColor(int x, int y);
     void computeFileIntoContainerScaleRatio();
+    void zoom(double factor, const QPoint &anchor);
+    double maximumShowScaleRatio() const;
+    double displayScale() const;
+    void applyScale();
+    void updateLoupe(const QPoint &pos);
+    QPixmap framePixmap(int index);
+    bool ensureFrame(int index);
+    void registerSequenceFrame(int index);
+    int frameInterval(int index) const;
+    void resetFrames(int count);
+    void showFirstFrame();
+    void releaseMemoryEntries();
+    bool hasPixels() const;
+    void dropFrames();
+    bool restoreFrames();
+    void patchDisplayPixmap(const QVector<QRect> &tiles);
+    void prefetchFrame(int index);
+private slots:
+    void takePrefetchedFrame();
+public slots:
+    void showFrame(int index);
+    void setSequenceFrame(int index, const QImage &frame);
+    void setPlaying(bool playing);
+    void playNextFrame();
+    void updateDisplayPixmap(bool resample = true);
+    void reloadImage();
+    void setPixelGridVisible(bool visible);
+    void setLoupeVisible(bool visible);
+    void emitVisibleRect();
+    void setView(double showScaleRatio, const QPointF &center);
 signals:
     void showScaleRatioChangeSignal(double showScaleRatio);
     void cursorInImageSignal(int x, int y, QString &color);
@@ -41,6 +124,10 @@ signals:
     void copySuccessFromImageLabelSignal();
     void imageFileChangeSignal(QString info);
     void openImageFailedSignal();
+    void frameChangeSignal(int index);
+    void imageReloadSignal(const FrameChanges &changes);
+    void visibleRectChangeSignal(QRect rect);
+    void viewChangeSignal(double showScaleRatio, const QPointF &center);
 };
 
 #endif // IMAGECONTAINER_H
@@ -0,0 +1,168 @@
+#include "imageloader.h"
+#include "colormanagement.h"
+#include <QImageReader>
+#include <QBuffer>
+#include <QImage>
+#include <QSize>
+#include <QVector>
+#include <QtConcurrent>
+
+namespace {
+
+/*
+ * Every decoded frame goes through it: to sRGB, and 16 bits per channel for anything with more
+ * than 8, so the frames are the full precision source for the palettes and the picked colors.
+ * Only what's drawn on screen is ever reduced to 8 bits.
+ */
+QImage prepareFrame(const QImage &image)
+{
+    QImage frame = convertToSRgb(image);
+    if(!isHighBitDepth(frame)) {
+        return frame;
+    }
+    QImage::Format format = frame.hasAlphaChannel() ? QImage::Format_RGBA64 : QImage::Format_RGBX64;
+    return frame.format() == format ? frame : frame.convertToFormat(format);
+}
+
+/*
+ * Decode one page of a multi-page file with its own reader, so pages can be decoded on
+ * several threads at the same time.
+ */
+struct PageReader
+{
+    typedef QImage result_type;
+
+    QString fileName;
+
+    QImage operator()(const int &index) const
+    {
+        QImageReader reader(fileName);
+        reader.setAutoTransform(true);
+        if(!reader.jumpToImage(index)) {
+            return QImage();
+        }
+        return prepareFrame(reader.read());
+    }
+};
+
+}
+
+/**
+ * @brief readImageFrames
+ * @param fileName the image file name.
+ * @param frames all frames (or pages) of the file, a single image gives one frame.
+ * @param delays the delay of every frame in milliseconds, 0 for pages.
+ * @return false if no frame can be read.
+ *
+ * QImage(fileName) only reads the first frame. Animation frames depend on the frames before
+ * them, so they are decoded in order. Pages of a multi-page file (TIFF) are independent and
+ * decoded in parallel.
+ * Every frame is turned upright according to its EXIF orientation and converted from its
+ * embedded ICC profile to sRGB, so the shown and copied colors are the real ones. 16-bit files
+ * stay 16-bit (Format_RGBA64 or Format_RGBX64).
+ */
+bool readImageFrames(const QString &fileName, QVector<QImage> &frames, QVector<int> &delays)
+{
+    frames.clear();
+    delays.clear();
+
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+    int count = reader.imageCount();
+
+    if(!reader.supportsAnimation() && count > 1) {
+        QVector<int> indexes;
+        for(int i = 0; i < count; i++) {
+            indexes.push_back(i);
+        }
+        PageReader pageReader;
+        pageReader.fileName = fileName;
+
+        QVector<QImage> pages = QtConcurrent::blockingMapped<QVector<QImage> >(indexes, pageReader);
+        for(int i = 0; i < pages.size(); i++) {
+            if(!pages[i].isNull()) {
+                frames.push_back(pages[i]);
+                delays.push_back(0);
+            }
+        }
+    }
+    else if(reader.supportsAnimation()) {
+        forever {
+            QImage frame = reader.read();
+            if(frame.isNull()) {
+                break;
+            }
+            frames.push_back(prepareFrame(frame));
+            delays.push_back(reader.nextImageDelay());
+            if(!reader.canRead()) {
+                break;
+            }
+        }
+    }
+    else {
+        QImage image = reader.read();
+        if(!image.isNull()) {
+            frames.push_back(prepareFrame(image));
+            delays.push_back(0);
+        }
+    }
+
+    return !frames.isEmpty();
+}
+
+/**
+ * @brief readImage
+ * @param fileName the image file name.
+ * @return the first frame of the file, upright and in sRGB, or a null image. 16-bit files stay
+ * 16-bit.
+ */
+QImage readImage(const QString &fileName)
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+
+    return prepareFrame(reader.read());
+}
+
+/**
+ * @brief readImageScaled
+ * @param fileName the image file name.
+ * @param minSide the shorter side of the wanted copy.
+ * @return the first frame, about minSide on its shorter side, upright and in sRGB like
+ * readImage(), or a null image.
+ *
+ * The reader is asked for the small size, so the formats which can decode at a lower
+ * resolution (JPEG) skip most of the work. Smaller images are returned as they are.
+ */
+QImage readImageScaled(const QString &fileName, int minSide)
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+
+    QSize size = reader.size();
+    if(size.isValid() && qMin(size.width(), size.height()) > minSide) {
+        reader.setScaledSize(size.scaled(minSide, minSide, Qt::KeepAspectRatioByExpanding));
+    }
+    return prepareFrame(reader.read());
+}
+
+/**
+ * @brief readImageData
+ * @param data the encoded file, already read into memory.
+ * @param format the file format, e.g. "png", or empty to guess it from the data.
+ * @return the first frame, upright and in sRGB like readImage(), or a null image.
+ *
+ * Reading the file and decoding it are separate, so a pipeline can read the next files while
+ * other threads decode.
+ */
+QImage readImageData(const QByteArray &data, const QByteArray &format)
+{
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QImageReader reader(&buffer, format);
+    reader.setAutoTransform(true);
+
+    return prepareFrame(reader.read());
+}
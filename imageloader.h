@@ -0,0 +1,14 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+
+QImage readImage(const QString &fileName);
+QImage readImageScaled(const QString &fileName, int minSide);
+QImage readImageData(const QByteArray &data, const QByteArray &format = QByteArray());
+bool readImageFrames(const QString &fileName, QVector<QImage> &frames, QVector<int> &delays);
+
+#endif // IMAGELOADER_H
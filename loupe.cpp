@@ -0,0 +1,134 @@
+#include "loupe.h"
+#include "util.h"
+#include <QPainter>
+#include <cstring>
+
+namespace {
+
+// The loupe is drawn away from the cursor, so it doesn't hide what is picked.
+const int CursorOffset = 24;
+
+}
+
+Loupe::Loupe(QWidget *parent) : QWidget(parent)
+{
+    pixels = QImage(PixelCount, PixelCount, QImage::Format_ARGB32);
+    pixels.fill(Qt::transparent);
+
+    setFixedSize(PixelCount * CellSize, PixelCount * CellSize + TextHeight);
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    hide();
+}
+
+/**
+ * @brief Loupe::setPixels
+ * @param image the source image.
+ * @param center the image pixel under the cursor.
+ * @param color the color of that pixel, as the image container picks it.
+ *
+ * Copy the pixels around the center into the loupe image. 32 bit images are copied line by line
+ * straight from their buffer, other formats pixel by pixel. Pixels outside the image are
+ * transparent.
+ */
+void Loupe::setPixels(const QImage &image, const QPoint &center, const QColor &color)
+{
+    int left = center.x() - PixelCount / 2;
+    int top = center.y() - PixelCount / 2;
+    bool direct = image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32;
+
+    pixels.fill(Qt::transparent);
+    for(int row = 0; row < PixelCount; row++) {
+        int y = top + row;
+        if(y < 0 || y >= image.height()) {
+            continue;
+        }
+
+        int first = qMax(0, left);
+        int last = qMin(image.width(), left + PixelCount);
+        if(first >= last) {
+            continue;
+        }
+
+        QRgb *out = reinterpret_cast<QRgb *>(pixels.scanLine(row)) + (first - left);
+        if(direct) {
+            const QRgb *in = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+            memcpy(out, in + first, (last - first) * sizeof(QRgb));
+            if(image.format() == QImage::Format_RGB32) {
+                for(int x = 0; x < last - first; x++) {
+                    out[x] |= 0xff000000;
+                }
+            }
+        }
+        else {
+            for(int x = first; x < last; x++) {
+                out[x - first] = image.pixel(x, y);
+            }
+        }
+    }
+
+    colorText = qcolorToString(color);
+    update();
+}
+
+/**
+ * @brief Loupe::moveNear
+ * @param cursor the cursor position in the parent widget.
+ *
+ * Stay at the bottom right of the cursor, or flip to the other side near the parent's edges.
+ */
+void Loupe::moveNear(const QPoint &cursor)
+{
+    QWidget *parent = parentWidget();
+    int x = cursor.x() + CursorOffset;
+    int y = cursor.y() + CursorOffset;
+    if(parent != nullptr) {
+        if(x + width() > parent->width()) {
+            x = cursor.x() - CursorOffset - width();
+        }
+        if(y + height() > parent->height()) {
+            y = cursor.y() - CursorOffset - height();
+        }
+    }
+    move(x, y);
+}
+
+/**
+ * @brief Loupe::paintEvent
+ *
+ * Draw the pixels enlarged without smoothing, a grid between them, a frame around the center
+ * pixel and its color value below.
+ */
+void Loupe::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QPainter painter(this);
+    int side = PixelCount * CellSize;
+
+    // A checkerboard behind transparent pixels and outside the image.
+    for(int y = 0; y < PixelCount; y++) {
+        for(int x = 0; x < PixelCount; x++) {
+            painter.fillRect(x * CellSize, y * CellSize, CellSize, CellSize,
+                             (x + y) % 2 ? QColor(204, 204, 204) : QColor(255, 255, 255));
+        }
+    }
+    painter.drawImage(QRect(0, 0, side, side), pixels);
+
+    painter.setPen(QColor(128, 128, 128, 96));
+    for(int i = 1; i < PixelCount; i++) {
+        painter.drawLine(i * CellSize, 0, i * CellSize, side);
+        painter.drawLine(0, i * CellSize, side, i * CellSize);
+    }
+
+    int center = PixelCount / 2 * CellSize;
+    painter.setPen(Qt::black);
+    painter.drawRect(center - 1, center - 1, CellSize + 1, CellSize + 1);
+    painter.setPen(Qt::white);
+    painter.drawRect(center, center, CellSize - 1, CellSize - 1);
+
+    painter.setPen(Qt::black);
+    painter.drawRect(0, 0, width() - 1, height() - 1);
+    painter.fillRect(1, side, width() - 2, TextHeight - 1, QColor(232, 232, 232));
+    painter.drawText(QRect(0, side, width(), TextHeight), Qt::AlignCenter, colorText);
+}
@@ -0,0 +1,36 @@
+#ifndef LOUPE_H
+#define LOUPE_H
+
+#include <QWidget>
+#include <QImage>
+#include <QColor>
+#include <QPoint>
+#include <QString>
+#include <QPaintEvent>
+
+/*
+ * A magnifier following the cursor above the image. It shows the source pixels around the
+ * cursor, copied into a small image kept between moves, enlarged so each is a square.
+ */
+class Loupe : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit Loupe(QWidget *parent = 0);
+
+    void setPixels(const QImage &image, const QPoint &center, const QColor &color);
+    void moveNear(const QPoint &cursor);
+protected:
+    void paintEvent(QPaintEvent *event);
+private:
+    enum {
+        PixelCount = 15,
+        CellSize = 9,
+        TextHeight = 18
+    };
+
+    QImage pixels;
+    QString colorText;
+};
+
+#endif // LOUPE_H
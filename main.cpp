@@ -1,12 +1,291 @@
 #include "mainwindow.h"
+#include "paletteserver.h"
+#include "paletteloadtest.h"
+#include "memorybudget.h"
+#include "benchmarks.h"
+#include "colorindex.h"
+#include "startup.h"
+#include "paletteexport.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <cstring>
+
+/**
+ * @brief hasArgument
+ * @return whether the option is in the command line.
+ *
+ * The service modes don't need a GUI, so they have to be detected before any application
+ * object exists.
+ */
+static bool hasArgument(int argc, char *argv[], const char *option)
+{
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], option) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief argumentValue
+ * @return the value following the option in the command line, or the default value.
+ */
+static QString argumentValue(int argc, char *argv[], const char *option, const QString &defaultValue)
+{
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], option) == 0) {
+            return QString::fromLocal8Bit(argv[i + 1]);
+        }
+    }
+    return defaultValue;
+}
+
+/**
+ * @brief runPaletteService
+ *
+ * --palette-daemon runs the palette engine behind a local socket.
+ * --palette-load-test sends requests to a running daemon and reports the latency.
+ */
+static int runPaletteService(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption daemonOption("palette-daemon", "Run the palette service.");
+    QCommandLineOption loadTestOption("palette-load-test", "Benchmark a running palette service.");
+    QCommandLineOption nameOption("server-name", "Local socket name.", "name", PALETTE_SERVER_NAME);
+    QCommandLineOption clientsOption("clients", "Concurrent connections.", "count", "8");
+    QCommandLineOption requestsOption("requests", "Total requests.", "count", "1000");
+    QCommandLineOption colorsOption("colors", "Palette size.", "count", "7");
+    parser.addOption(daemonOption);
+    parser.addOption(loadTestOption);
+    parser.addOption(nameOption);
+    parser.addOption(clientsOption);
+    parser.addOption(requestsOption);
+    parser.addOption(colorsOption);
+    parser.addPositionalArgument("files", "Images requested by the load test.", "[files...]");
+    parser.process(a);
+
+    if(parser.isSet(daemonOption)) {
+        PaletteServer server;
+        if(!server.listen(parser.value(nameOption))) {
+            QTextStream(stderr) << server.errorString() << '\n';
+            return 1;
+        }
+        return a.exec();
+    }
+
+    PaletteLoadTest loadTest(parser.value(nameOption), parser.positionalArguments(),
+                             parser.value(clientsOption).toInt(), parser.value(requestsOption).toInt(),
+                             parser.value(colorsOption).toInt());
+    QObject::connect(&loadTest, &PaletteLoadTest::finished, &a, &QCoreApplication::exit, Qt::QueuedConnection);
+    loadTest.start();
+
+    return a.exec();
+}
+
+/**
+ * @brief runBenchmark
+ *
+ * --bench-resample times the resampler filters against QImage::scaled().
+ * --bench-palette times the perceptual palette against the RGB one, and fails if it costs more
+ * than --max-ratio times as much.
+ * --bench-hash times the perceptual hash against a full decode, and fails if it costs more than
+ * --max-hash-ratio times as much.
+ */
+static int runBenchmark(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption resampleOption("bench-resample", "Benchmark the image resampler.");
+    QCommandLineOption paletteOption("bench-palette", "Benchmark the perceptual palette.");
+    QCommandLineOption widthOption("width", "Target width.", "pixels", "800");
+    QCommandLineOption heightOption("height", "Target height.", "pixels", "800");
+    QCommandLineOption iterationsOption("iterations", "Runs of every filter or mode.", "count", "10");
+    QCommandLineOption colorsOption("colors", "Palette size.", "count", "7");
+    QCommandLineOption ratioOption("max-ratio", "Accepted cost of the perceptual palette.", "ratio", "1.5");
+    QCommandLineOption hashOption("bench-hash", "Benchmark the perceptual hash.");
+    QCommandLineOption hashRatioOption("max-hash-ratio", "Accepted cost of the hash, relative to a full decode.",
+                                       "ratio", "0.25");
+    parser.addOption(resampleOption);
+    parser.addOption(paletteOption);
+    parser.addOption(widthOption);
+    parser.addOption(heightOption);
+    parser.addOption(iterationsOption);
+    parser.addOption(colorsOption);
+    parser.addOption(ratioOption);
+    parser.addOption(hashOption);
+    parser.addOption(hashRatioOption);
+    parser.addPositionalArgument("file", "Image to analyse, a synthetic one if omitted.", "[file]");
+    parser.process(a);
+
+    if(parser.isSet(hashOption)) {
+        return runHashBenchmark(parser.positionalArguments().value(0), parser.value(iterationsOption).toInt(),
+                                parser.value(hashRatioOption).toDouble());
+    }
+    if(parser.isSet(paletteOption)) {
+        return runPaletteBenchmark(parser.positionalArguments().value(0), parser.value(colorsOption).toInt(),
+                                   parser.value(iterationsOption).toInt(), parser.value(ratioOption).toDouble());
+    }
+    return runResampleBenchmark(parser.positionalArguments().value(0),
+                                QSize(parser.value(widthOption).toInt(), parser.value(heightOption).toInt()),
+                                parser.value(iterationsOption).toInt());
+}
+
+/**
+ * @brief runColorIndexTool
+ *
+ * --index-colors updates the color index of a directory tree, only changed files are decoded.
+ * --search-color lists the indexed images closest to a color, e.g. --search-color "#3a7bd5".
+ */
+static int runColorIndexTool(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption indexOption("index-colors", "Index the images under a directory.", "directory");
+    QCommandLineOption searchOption("search-color", "Search images by color.", "color");
+    QCommandLineOption fileOption("index-file", "Index file.", "file", ColorIndex::defaultFileName());
+    QCommandLineOption resultsOption("results", "Maximum matches.", "count", "20");
+    QCommandLineOption colorsOption("colors", "Palette size of every image.", "count", "7");
+    parser.addOption(indexOption);
+    parser.addOption(searchOption);
+    parser.addOption(fileOption);
+    parser.addOption(resultsOption);
+    parser.addOption(colorsOption);
+    parser.process(a);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    ColorIndex index;
+    QElapsedTimer timer;
+
+    timer.start();
+    bool loaded = index.load(parser.value(fileOption));
+    if(loaded) {
+        err << index.fileCount() << " images loaded in " << timer.elapsed() << " ms\n";
+    }
+
+    if(parser.isSet(indexOption)) {
+        timer.restart();
+        ColorIndex::UpdateStats stats = index.update(parser.value(indexOption), parser.value(colorsOption).toInt(),
+                                                     [&err](int done, int total) {
+            err << "\ranalysed " << done << "/" << total;
+            err.flush();
+        });
+        err << "\n" << stats.added << " added, " << stats.changed << " changed, " << stats.removed
+            << " removed, " << stats.unchanged << " unchanged in " << timer.elapsed() << " ms\n";
+        err << stats.duplicates << " near duplicates took the palette of an image already analysed\n";
+        if(!index.save(parser.value(fileOption))) {
+            err << "Can't write " << parser.value(fileOption) << '\n';
+            return 1;
+        }
+    }
+    else if(!loaded) {
+        err << "No index at " << parser.value(fileOption) << ", run --index-colors first.\n";
+        return 1;
+    }
+
+    if(parser.isSet(searchOption)) {
+        QColor color(parser.value(searchOption));
+        if(!color.isValid()) {
+            err << "Invalid color " << parser.value(searchOption) << '\n';
+            return 1;
+        }
+
+        timer.restart();
+        QVector<ColorMatch> matches = index.search(color, parser.value(resultsOption).toInt());
+        double ms = timer.nsecsElapsed() / 1e6;
+
+        for(int i = 0; i < matches.size(); i++) {
+            out << QString::number(matches[i].distance, 'f', 4) << "\t" << matches[i].color.name()
+                << "\t" << matches[i].path << '\n';
+        }
+        err << matches.size() << " matches in " << QString::number(ms, 'f', 3) << " ms\n";
+    }
+
+    return 0;
+}
+
+/**
+ * @brief runPaletteExportTool
+ *
+ * --export-palettes writes the palettes of every image under a directory to one archive.
+ */
+static int runPaletteExportTool(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption exportOption("export-palettes", "Export the palettes of the images under a directory.",
+                                    "directory");
+    QCommandLineOption archiveOption("archive", "Archive file, JSON Lines.", "file", "palettes.jsonl");
+    QCommandLineOption colorsOption("colors", "Palette size of every image.", "count", "7");
+    parser.addOption(exportOption);
+    parser.addOption(archiveOption);
+    parser.addOption(colorsOption);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 written = exportPaletteArchive(parser.value(exportOption), parser.value(archiveOption),
+                                          parser.value(colorsOption).toInt(), [&err](int done) {
+        err << "\rread " << done;
+        err.flush();
+    });
+    if(written < 0) {
+        err << "\nCan't write " << parser.value(archiveOption) << '\n';
+        return 1;
+    }
+    err << "\n" << written << " palettes exported in " << timer.elapsed() << " ms\n";
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    startupStart();
+
+    if(hasArgument(argc, argv, "--index-colors") || hasArgument(argc, argv, "--search-color")) {
+        return runColorIndexTool(argc, argv);
+    }
+    if(hasArgument(argc, argv, "--export-palettes")) {
+        return runPaletteExportTool(argc, argv);
+    }
+    if(hasArgument(argc, argv, "--bench-resample") || hasArgument(argc, argv, "--bench-palette")
+            || hasArgument(argc, argv, "--bench-hash")) {
+        return runBenchmark(argc, argv);
+    }
+    if(hasArgument(argc, argv, "--palette-daemon") || hasArgument(argc, argv, "--palette-load-test")) {
+        return runPaletteService(argc, argv);
+    }
+
+    // --startup-benchmark quits at the first frame, failing if it took longer than the threshold.
+    if(hasArgument(argc, argv, "--startup-benchmark")) {
+        startupSetBenchmark(argumentValue(argc, argv, "--startup-threshold", "800").toLongLong());
+    }
+
     QApplication a(argc, argv);
+    startupMark("application");
+
+    // The style is set once before any widget exists, so no widget is polished twice.
+    MainWindow::setCustomStyle();
+    MemoryBudget::instance();
 
     MainWindow w;
+    startupMark("main window");
     w.show();
+    startupMark("show");
 
     return a.exec();
 }
@@ -1,5 +1,10 @@
 #include "mainwindow.h"
 #include "util.h"
+#include "memorybudget.h"
+#include "colorsearchdialog.h"
+#include "startup.h"
+#include "paletteexport.h"
+#include "sequencereader.h"
 #include <QDesktopWidget>
 #include <QApplication>
 #include <QMenuBar>
@@ -19,8 +24,13 @@
 #include <QProgressDialog>
 #include <QMessageBox>
 #include <QNetworkReply>
+#include <QDir>
+#include <QFileInfo>
+#include <QTimer>
+#include <QtConcurrent>
 #include <QThread>
 #include <QPalette>
+#include <QSettings>
 #include <QDebug>
 
 #define SCREEN_WIDTH QApplication::desktop()->screenGeometry().width()
@@ -30,6 +40,13 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
 {
     resize(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
+    colorSearchDialog = nullptr;
+    progressDialog = nullptr;
+    downloadThread = nullptr;
+    archiveWatcher = nullptr;
+    sequenceReader = nullptr;
+    workArea = nullptr;
+    firstFramePainted = false;
 
     createMenu(this);
     createStatusBar(this);
@@ -37,18 +54,26 @@ MainWindow::MainWindow(QWidget *parent)
     createToolBar(this);
 
     setMouseTracking(true);
-    workArea->setMouseTracking(true);
 
     connectSlots();
-
-    setCustomStyle();
+    setMemoryLabelText(MemoryBudget::instance()->usedBytes(), MemoryBudget::instance()->ceiling());
 }
 
 MainWindow::~MainWindow(){}
 
+/**
+ * @brief MainWindow::setCustomStyle
+ *
+ * Set the style of the whole application. It's called once in main() before any widget is
+ * created: a style sheet set on the window after its widgets exist makes Qt parse it and polish
+ * every widget again.
+ */
 void MainWindow::setCustomStyle()
 {
-    QString styles;
+    static QString styles;
+    if(!styles.isEmpty()) {
+        return;
+    }
     styles += "QMainWindow{background-color: #ffffff;}"
 
               "QMenuBar{background-color: #e8e8e8; border:none; padding: 0px;}"
@@ -81,7 +106,56 @@ void MainWindow::setCustomStyle()
 
               "QMessageBox{background-color: #ffffff;}";
 
-    setStyleSheet(styles);
+    qApp->setStyleSheet(styles);
+}
+
+/**
+ * @brief MainWindow::event
+ * @param event the event.
+ * @return whether the event was handled.
+ *
+ * The first paint of the window is the first frame users see. The startup is finished right
+ * after it, in the next event loop pass.
+ */
+bool MainWindow::event(QEvent *event)
+{
+    if(event->type() == QEvent::Paint && !firstFramePainted) {
+        firstFramePainted = true;
+        QTimer::singleShot(0, this, SLOT(finishStartup()));
+    }
+    return QMainWindow::event(event);
+}
+
+/**
+ * @brief MainWindow::finishStartup
+ *
+ * It's a slot function.
+ * Report the first frame, then load what the first frame doesn't need.
+ */
+void MainWindow::finishStartup()
+{
+    startupFirstFrame();
+    loadIcons();
+}
+
+/**
+ * @brief MainWindow::loadIcons
+ *
+ * The icons are loaded after the first frame, the window shows the action texts until then.
+ */
+void MainWindow::loadIcons()
+{
+    openImageMenu->setIcon(QIcon(":/icon/icon/image.png"));
+    openImageByLocalAction->setIcon(QIcon(":/icon/icon/folder.png"));
+    openHistoryImageMenu->setIcon(QIcon(":/icon/icon/time-circle.png"));
+    saveColorBoardMenu->setIcon(QIcon(":/icon/icon/save.png"));
+    saveAsTxtAction->setIcon(QIcon(":/icon/icon/file-text.png"));
+    saveAsJpgAction->setIcon(QIcon(":/icon/icon/file-image.png"));
+    restartAction->setIcon(QIcon(":/icon/icon/reload.png"));
+    exitAction->setIcon(QIcon(":/icon/icon/close-square.png"));
+    preferenceAction->setIcon(QIcon(":/icon/icon/setting.png"));
+    referenceAction->setIcon(QIcon(":/icon/icon/cloud.png"));
+    authorAction->setIcon(QIcon(":/icon/icon/user.png"));
 }
 
 /**
@@ -97,26 +171,164 @@ void MainWindow::createMenu(QMainWindow *mainWindow)
     menuBar = mainWindow->menuBar();
 
     fileMenu = menuBar->addMenu(tr("File"));
+    viewMenu = menuBar->addMenu(tr("View"));
     settingMenu = menuBar->addMenu(tr("Settings"));
     aboutMenu = menuBar->addMenu(tr("About"));
 
-    openImageMenu = fileMenu->addMenu(QIcon(":/icon/icon/image.png"), tr("Open file"));
-    openImageByLocalAction = openImageMenu->addAction(QIcon(":/icon/icon/folder.png"), tr("Open local file"));
+    openImageMenu = fileMenu->addMenu(tr("Open file"));
+    openImageByLocalAction = openImageMenu->addAction(tr("Open local file"));
+    openSequenceAction = openImageMenu->addAction(tr("Open image sequence"));
 
-    openHistoryImageMenu = fileMenu->addMenu(QIcon(":/icon/icon/time-circle.png"), tr("History"));
+    openHistoryImageMenu = fileMenu->addMenu(tr("History"));
 
-    saveColorBoardMenu = fileMenu->addMenu(QIcon(":/icon/icon/save.png"), tr("Save"));
-    saveAsTxtAction = saveColorBoardMenu->addAction(QIcon(":/icon/icon/file-text.png"), tr("Save as .txt"));
-    saveAsJpgAction = saveColorBoardMenu->addAction(QIcon(":/icon/icon/file-image.png"), tr("save as .jpg"));
+    colorSearchAction = fileMenu->addAction(tr("Search by color..."));
 
-    restartAction = fileMenu->addAction(QIcon(":/icon/icon/reload.png"), tr("Restart"));
+    saveColorBoardMenu = fileMenu->addMenu(tr("Save"));
+    saveAsTxtAction = saveColorBoardMenu->addAction(tr("Save as .txt"));
+    saveAsJpgAction = saveColorBoardMenu->addAction(tr("save as .jpg"));
+    exportArchiveAction = saveColorBoardMenu->addAction(tr("Export palettes of a folder..."));
 
-    exitAction = fileMenu->addAction(QIcon(":/icon/icon/close-square.png"), tr("Exit"));
+    restartAction = fileMenu->addAction(tr("Restart"));
 
-    preferenceAction = settingMenu->addAction(QIcon(":/icon/icon/setting.png"), tr("Settings"));
+    exitAction = fileMenu->addAction(tr("Exit"));
 
-    referenceAction = aboutMenu->addAction(QIcon(":/icon/icon/cloud.png"), tr("Reference"));
-    authorAction = aboutMenu->addAction(QIcon(":/icon/icon/user.png"), tr("Author"));
+    // The view menu is filled when it's opened the first time.
+    palettePreviewAction = nullptr;
+    pixelGridAction = nullptr;
+    loupeAction = nullptr;
+    histogramAction = nullptr;
+    perceptualPaletteAction = nullptr;
+    salientPaletteAction = nullptr;
+    compareAction = nullptr;
+    ditherMenu = nullptr;
+    ditherActionGroup = nullptr;
+    noDitherAction = nullptr;
+    orderedDitherAction = nullptr;
+    floydSteinbergDitherAction = nullptr;
+
+    preferenceAction = settingMenu->addAction(tr("Settings"));
+    memoryBudgetAction = settingMenu->addAction(tr("Memory budget..."));
+
+    referenceAction = aboutMenu->addAction(tr("Reference"));
+    authorAction = aboutMenu->addAction(tr("Author"));
+}
+
+/**
+ * @brief MainWindow::populateViewMenu
+ *
+ * It's a slot function.
+ * Create the view menu the first time it's opened. Until then, the image container and the
+ * histogram panel have the same defaults as the actions.
+ */
+void MainWindow::populateViewMenu()
+{
+    if(palettePreviewAction != nullptr) {
+        return;
+    }
+
+    palettePreviewAction = viewMenu->addAction(tr("Palette preview"));
+    palettePreviewAction->setCheckable(true);
+
+    pixelGridAction = viewMenu->addAction(tr("Pixel grid"));
+    pixelGridAction->setCheckable(true);
+    pixelGridAction->setChecked(true);
+
+    loupeAction = viewMenu->addAction(tr("Loupe"));
+    loupeAction->setCheckable(true);
+
+    histogramAction = viewMenu->addAction(tr("Histogram"));
+    histogramAction->setCheckable(true);
+    histogramAction->setChecked(true);
+
+    perceptualPaletteAction = viewMenu->addAction(tr("Perceptual palette (OKLab)"));
+    perceptualPaletteAction->setCheckable(true);
+    perceptualPaletteAction->setChecked(workArea->getColorBoard()->getQuantizeMode() == PerceptualQuantize);
+
+    salientPaletteAction = viewMenu->addAction(tr("Saliency weighted palette"));
+    salientPaletteAction->setCheckable(true);
+    salientPaletteAction->setChecked(workArea->getColorBoard()->getPixelWeighting() == SaliencyWeighting);
+
+    compareAction = viewMenu->addAction(tr("Compare side by side"));
+    compareAction->setCheckable(true);
+
+    ditherMenu = viewMenu->addMenu(tr("Dithering"));
+    ditherActionGroup = new QActionGroup(this);
+    noDitherAction = ditherMenu->addAction(tr("None"));
+    orderedDitherAction = ditherMenu->addAction(tr("Ordered"));
+    floydSteinbergDitherAction = ditherMenu->addAction(tr("Floyd-Steinberg"));
+    noDitherAction->setCheckable(true);
+    orderedDitherAction->setCheckable(true);
+    floydSteinbergDitherAction->setCheckable(true);
+    ditherActionGroup->addAction(noDitherAction);
+    ditherActionGroup->addAction(orderedDitherAction);
+    ditherActionGroup->addAction(floydSteinbergDitherAction);
+    noDitherAction->setChecked(true);
+
+    for(int i = 0; i < documentTabs->count(); i++) {
+        applyViewActions(static_cast<WorkArea *>(documentTabs->widget(i)));
+    }
+    for(int i = 0; i < compareTabs->count(); i++) {
+        applyViewActions(static_cast<WorkArea *>(compareTabs->widget(i)));
+    }
+
+    connect(palettePreviewAction,
+            SIGNAL(toggled(bool)),
+            SLOT(updatePalettePreview()));
+    connect(compareAction,
+            SIGNAL(toggled(bool)),
+            SLOT(setCompareView(bool)));
+    connect(perceptualPaletteAction,
+            SIGNAL(toggled(bool)),
+            SLOT(setPerceptualPalette(bool)));
+    connect(salientPaletteAction,
+            SIGNAL(toggled(bool)),
+            SLOT(setSalientPalette(bool)));
+    connect(ditherActionGroup,
+            SIGNAL(triggered(QAction*)),
+            SLOT(updatePalettePreview()));
+}
+
+/**
+ * @brief MainWindow::setPerceptualPalette
+ * @param perceptual whether the palette is computed in OKLab.
+ *
+ * It's a slot function.
+ * The open image is analysed again in the new mode.
+ */
+void MainWindow::setPerceptualPalette(bool perceptual)
+{
+    workArea->getColorBoard()->setQuantizeMode(perceptual ? PerceptualQuantize : RgbQuantize);
+    analyseImageAgain();
+}
+
+/**
+ * @brief MainWindow::setSalientPalette
+ * @param salient whether the pixels standing out count more in the palette.
+ *
+ * It's a slot function.
+ * The open image is analysed again with the new weighting.
+ */
+void MainWindow::setSalientPalette(bool salient)
+{
+    workArea->getColorBoard()->setPixelWeighting(salient ? SaliencyWeighting : UniformWeighting);
+    analyseImageAgain();
+}
+
+/**
+ * @brief MainWindow::analyseImageAgain
+ *
+ * Compute the palettes of the open image again after the palette options changed. A sequence
+ * is read again, its frames aren't all in memory.
+ */
+void MainWindow::analyseImageAgain()
+{
+    ImageContainer *imageContainer = workArea->getImageContainer();
+    if(imageContainer->isSequence()) {
+        startSequence(imageContainer->getSequenceFiles());
+    }
+    else if(!imageContainer->getFrames().isEmpty()) {
+        workArea->analyseImage();
+    }
 }
 
 /**
@@ -134,14 +346,17 @@ void MainWindow::createStatusBar(QMainWindow *mainWindow)
     showScaleRatioLabel = new QLabel(tr(""), statusBar);
     colorValueLabel = new QLabel(statusBar);
     helpTextLabel = new QLabel(tr(""));
+    memoryLabel = new QLabel(tr(""), statusBar);
 
     fileInfoLabel->setAlignment(Qt::AlignCenter);
     curInfoLabel->setAlignment(Qt::AlignCenter);
     showScaleRatioLabel->setAlignment(Qt::AlignCenter);
     colorValueLabel->setAlignment(Qt::AlignCenter);
     helpTextLabel->setAlignment(Qt::AlignCenter);
+    memoryLabel->setAlignment(Qt::AlignCenter);
 
     statusBar->addPermanentWidget(fileInfoLabel, 3);
+    statusBar->addPermanentWidget(memoryLabel, 2);
     statusBar->addWidget(curInfoLabel, 4);
     statusBar->addWidget(colorValueLabel, 1);
     statusBar->addWidget(helpTextLabel, 5);
@@ -161,7 +376,6 @@ void MainWindow::createToolBar(QMainWindow *mainWindow)
     mainWindow->addToolBar(Qt::TopToolBarArea, toolBar);
 
     toolBar->addAction(openImageByLocalAction);
-    toolBar->addAction(openImageByUrlAction);
     toolBar->addAction(saveAsTxtAction);
     toolBar->addAction(saveAsJpgAction);
     toolBar->addAction(restartAction);
@@ -177,13 +391,232 @@ void MainWindow::createToolBar(QMainWindow *mainWindow)
  * @brief MainWindow::createWorkArea
  * @param mainWindow the parent mainWindow. Explanation same as above.
  *
- * Create work area and make it be the central widget. Work area includes the image container and
- * color board which are the core widget of the application.
+ * Create the document tabs and make them the central widget. Every tab is a work area, which
+ * includes the image container and color board which are the core widget of the application.
+ * The compare pane next to the tabs is only shown in the compare view.
  */
 void MainWindow::createWorkArea(QMainWindow *mainWindow)
 {
-    workArea = new WorkArea(mainWindow);
-    mainWindow->setCentralWidget(workArea);
+    documentSplitter = new QSplitter(Qt::Horizontal, mainWindow);
+    documentTabs = new QTabWidget(documentSplitter);
+    documentTabs->setTabsClosable(true);
+    documentTabs->setDocumentMode(true);
+    compareTabs = new QTabWidget(documentSplitter);
+    compareTabs->setDocumentMode(true);
+    compareTabs->hide();
+    documentSplitter->addWidget(documentTabs);
+    documentSplitter->addWidget(compareTabs);
+    mainWindow->setCentralWidget(documentSplitter);
+
+    connect(documentTabs,
+            SIGNAL(currentChanged(int)),
+            SLOT(setCurrentDocument(int)));
+    connect(documentTabs,
+            SIGNAL(tabCloseRequested(int)),
+            SLOT(closeDocument(int)));
+
+    addDocument();
+}
+
+/**
+ * @brief MainWindow::addDocument
+ * @return a new empty document, in a new tab which becomes the current one.
+ */
+WorkArea *MainWindow::addDocument()
+{
+    WorkArea *area = new WorkArea(documentTabs);
+    area->setMouseTracking(true);
+    applyViewActions(area);
+
+    documentTabs->setCurrentIndex(documentTabs->addTab(area, tr("Untitled")));
+    return area;
+}
+
+/**
+ * @brief MainWindow::documentForImage
+ * @return the document to open an image in: the current one if it's still empty, a new tab
+ * otherwise.
+ */
+WorkArea *MainWindow::documentForImage()
+{
+    if(workArea->getImageContainer()->getFileName().isEmpty()) {
+        return workArea;
+    }
+    return addDocument();
+}
+
+void MainWindow::setDocumentTitle(WorkArea *area, const QString &fileName)
+{
+    QTabWidget *tabs = documentTabs->indexOf(area) >= 0 ? documentTabs : compareTabs;
+    int index = tabs->indexOf(area);
+    tabs->setTabText(index, QFileInfo(fileName).fileName());
+    tabs->setTabToolTip(index, QDir::toNativeSeparators(fileName));
+}
+
+/**
+ * @brief MainWindow::setCurrentDocument
+ * @param index the tab index.
+ *
+ * It's a slot function.
+ * The status bar, the menus and the panels follow the document of the current tab. The document
+ * left goes to the background, where it may drop its pixels under memory pressure.
+ */
+void MainWindow::setCurrentDocument(int index)
+{
+    WorkArea *area = qobject_cast<WorkArea *>(documentTabs->widget(index));
+    if(area == nullptr || area == workArea) {
+        return;
+    }
+
+    if(workArea != nullptr) {
+        disconnectDocument(workArea);
+        workArea->setActive(false);
+    }
+    workArea = area;
+    connectDocument(workArea);
+    workArea->setActive(true);
+
+    ImageContainer *imageContainer = workArea->getImageContainer();
+    ColorBoard *colorBoard = workArea->getColorBoard();
+    setFileInfoLabelText(imageContainer->getInfo());
+    setShowScaleRatioLabelText(imageContainer->getShowScaleRatio());
+    if(perceptualPaletteAction != nullptr) {
+        perceptualPaletteAction->blockSignals(true);
+        perceptualPaletteAction->setChecked(colorBoard->getQuantizeMode() == PerceptualQuantize);
+        perceptualPaletteAction->blockSignals(false);
+        salientPaletteAction->blockSignals(true);
+        salientPaletteAction->setChecked(colorBoard->getPixelWeighting() == SaliencyWeighting);
+        salientPaletteAction->blockSignals(false);
+    }
+
+    refreshHistogramPanel();
+    refreshPalettePreview();
+    refreshColorSearchSwatches();
+    syncCompareView();
+    updateSequencePriority();
+}
+
+/**
+ * @brief MainWindow::updateSequencePriority
+ *
+ * A sequence still being read for a tab which isn't on screen yields the cores to the documents
+ * shown.
+ */
+void MainWindow::updateSequencePriority()
+{
+    if(sequenceReader == nullptr) {
+        return;
+    }
+    bool shown = sequenceArea != nullptr && (sequenceArea == workArea || compareTabs->indexOf(sequenceArea) >= 0);
+    sequenceReader->setBackground(!shown);
+}
+
+/**
+ * @brief MainWindow::closeDocument
+ * @param index the tab index.
+ *
+ * It's a slot function.
+ * There is always one document, closing the last one leaves an empty one.
+ */
+void MainWindow::closeDocument(int index)
+{
+    WorkArea *area = qobject_cast<WorkArea *>(documentTabs->widget(index));
+    if(area == nullptr) {
+        return;
+    }
+    if(area == sequenceArea && sequenceReader != nullptr) {
+        sequenceReader->cancel();
+    }
+
+    documentTabs->removeTab(index);
+    if(area == workArea) {
+        disconnectDocument(area);
+        workArea = nullptr;
+    }
+    area->deleteLater();
+
+    if(documentTabs->count() == 0) {
+        addDocument();
+    }
+}
+
+/**
+ * @brief MainWindow::setCompareView
+ * @param compare whether two documents are shown side by side.
+ *
+ * It's a slot function.
+ * The tab next to the current one moves to the compare pane. Zooming or scrolling one side
+ * zooms and scrolls the other side the same way.
+ */
+void MainWindow::setCompareView(bool compare)
+{
+    if(compare) {
+        if(documentTabs->count() < 2) {
+            compareAction->setChecked(false);
+            helpTextLabel->setText(tr("Open a second image to compare."));
+            helpTextLabel->setStyleSheet("");
+            return;
+        }
+
+        int current = documentTabs->currentIndex();
+        int other = current + 1 < documentTabs->count() ? current + 1 : current - 1;
+        WorkArea *area = static_cast<WorkArea *>(documentTabs->widget(other));
+        QString text = documentTabs->tabText(other);
+        QString toolTip = documentTabs->tabToolTip(other);
+        documentTabs->removeTab(other);
+        compareTabs->setTabToolTip(compareTabs->addTab(area, text), toolTip);
+        compareTabs->show();
+        area->setActive(true);
+    }
+    else {
+        while(compareTabs->count() > 0) {
+            WorkArea *area = static_cast<WorkArea *>(compareTabs->widget(0));
+            QString text = compareTabs->tabText(0);
+            QString toolTip = compareTabs->tabToolTip(0);
+            compareTabs->removeTab(0);
+            documentTabs->setTabToolTip(documentTabs->addTab(area, text), toolTip);
+            area->setActive(false);
+        }
+        compareTabs->hide();
+    }
+    syncCompareView();
+    updateSequencePriority();
+}
+
+/**
+ * @brief MainWindow::syncCompareView
+ *
+ * Link the view of the current document to the view of the compare pane, and show the same
+ * part of both.
+ */
+void MainWindow::syncCompareView()
+{
+    for(int i = 0; i < 2; i++) {
+        if(syncedContainers[i] != nullptr) {
+            disconnect(syncedContainers[i], SIGNAL(viewChangeSignal(double,QPointF)), 0, 0);
+        }
+        syncedContainers[i] = nullptr;
+    }
+
+    WorkArea *other = qobject_cast<WorkArea *>(compareTabs->currentWidget());
+    if(other == nullptr || workArea == nullptr) {
+        return;
+    }
+
+    ImageContainer *left = workArea->getImageContainer();
+    ImageContainer *right = other->getImageContainer();
+    connect(left,
+            SIGNAL(viewChangeSignal(double,QPointF)),
+            right,
+            SLOT(setView(double,QPointF)));
+    connect(right,
+            SIGNAL(viewChangeSignal(double,QPointF)),
+            left,
+            SLOT(setView(double,QPointF)));
+    syncedContainers[0] = left;
+    syncedContainers[1] = right;
+
+    right->setView(left->getShowScaleRatio(), left->getViewCenter());
 }
 
 /**
@@ -202,11 +635,276 @@ void MainWindow::openFileDialog()
         return;
     }
 
+    openImageFile(curFileName);
+}
+
+/**
+ * @brief MainWindow::openSequenceDialog
+ *
+ * It's a slot function.
+ * Users select any frame of a numbered sequence (frame_0001.png...), all its frames are opened.
+ */
+void MainWindow::openSequenceDialog()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open image sequence"), "",
+                                                    tr("Images((*.png *.jpg *.jpeg *.bmp *.tif *.tiff))"));
+    if(fileName.isEmpty()) {
+        return;
+    }
+
+    curFileName = fileName;
+    documentForImage();
+    startSequence(findSequenceFiles(fileName));
+}
+
+/**
+ * @brief MainWindow::startSequence
+ * @param fileNames the frames of the sequence, in order.
+ *
+ * The sequence is read in the background. The frames are shown and their palettes added as they
+ * come, users can scrub or play the frames read so far.
+ */
+void MainWindow::startSequence(const QStringList &fileNames)
+{
+    if(sequenceReader == nullptr) {
+        sequenceReader = new SequenceReader(this);
+        connect(sequenceReader,
+                SIGNAL(frameReadySignal(int,QImage,QVector<QColor>,ColorHistogram)),
+                SLOT(showSequenceFrame(int,QImage,QVector<QColor>,ColorHistogram)));
+        connect(sequenceReader,
+                SIGNAL(finishSignal()),
+                SLOT(finishSequence()));
+    }
+    sequenceReader->cancel();
+
+    // The frames go to the document the sequence was opened in, even if another tab is shown.
+    sequenceArea = workArea;
+    ColorBoard *colorBoard = workArea->getColorBoard();
+    workArea->getImageContainer()->loadSequence(fileNames);
+    colorBoard->startSequence(fileNames.size());
+    setDocumentTitle(workArea, fileNames.value(0));
+    sequenceReader->setBackground(false);
+    sequenceReader->start(fileNames, colorBoard->getColorCount(), colorBoard->getQuantizeMode(),
+                          colorBoard->getPixelWeighting());
+}
+
+/**
+ * @brief MainWindow::showSequenceFrame
+ * @param index the frame index.
+ * @param frame the decoded frame.
+ * @param palette the smoothed palette of the frame.
+ * @param histogram the palette histogram of the frame.
+ *
+ * It's a slot function.
+ */
+void MainWindow::showSequenceFrame(int index, const QImage &frame, const QVector<QColor> &palette,
+                                   const ColorHistogram &histogram)
+{
+    if(sequenceArea == nullptr) {
+        return;
+    }
+    sequenceArea->getImageContainer()->setSequenceFrame(index, frame);
+    sequenceArea->getColorBoard()->setFrameHistogram(index, histogram);
+    sequenceArea->getColorBoard()->setFrameColors(index, palette);
+
+    helpTextLabel->setText(tr("Reading sequence: %1/%2 frames")
+                           .arg(index + 1).arg(sequenceReader->getFileNames().size()));
+    helpTextLabel->setStyleSheet("");
+}
+
+/**
+ * @brief MainWindow::finishSequence
+ *
+ * It's a slot function.
+ * Every frame is read, show the palette of all frames.
+ */
+void MainWindow::finishSequence()
+{
+    if(sequenceArea == nullptr) {
+        return;
+    }
+    sequenceArea->getColorBoard()->setGlobalColors(sequenceReader->getGlobalPalette());
+
+    helpTextLabel->setText(tr("%1 frames read.").arg(sequenceReader->getFileNames().size()));
+    helpTextLabel->setStyleSheet("color: green");
+}
+
+/**
+ * @brief MainWindow::openImageFile
+ * @param fileName the image file name.
+ *
+ * It's a slot function.
+ * Show the image and create its color board, e.g. when a search result is double clicked. The
+ * image gets a new tab unless the current one is empty.
+ */
+void MainWindow::openImageFile(QString fileName)
+{
+    curFileName = fileName;
+    WorkArea *previous = workArea;
+    documentForImage();
+    bool created = workArea != previous;
+
     if(showNewSelectedImage(curFileName)) {
-        createNewSelectedImageColorBoard();
+        workArea->analyseImage();
+        setDocumentTitle(workArea, curFileName);
+    }
+    else if(created) {
+        closeDocument(documentTabs->indexOf(workArea));
     }
 }
 
+/**
+ * @brief MainWindow::openColorSearchDialog
+ *
+ * It's a slot function.
+ * The dialog is created the first time it's opened, it loads the index and watches the library
+ * from then on.
+ */
+void MainWindow::openColorSearchDialog()
+{
+    if(colorSearchDialog == nullptr) {
+        colorSearchDialog = new ColorSearchDialog(this);
+        connect(colorSearchDialog,
+                SIGNAL(openImageSignal(QString)),
+                SLOT(openImageFile(QString)));
+        connect(workArea->getColorBoard(),
+                SIGNAL(colorsChangeSignal()),
+                SLOT(refreshColorSearchSwatches()));
+    }
+
+    refreshColorSearchSwatches();
+    colorSearchDialog->show();
+    colorSearchDialog->raise();
+    colorSearchDialog->activateWindow();
+}
+
+/**
+ * @brief MainWindow::refreshColorSearchSwatches
+ *
+ * It's a slot function.
+ * The search dialog offers the colors of the color board as query colors.
+ */
+void MainWindow::refreshColorSearchSwatches()
+{
+    if(colorSearchDialog != nullptr) {
+        colorSearchDialog->setSwatches(workArea->getColorBoard()->getColors());
+    }
+}
+
+/**
+ * @brief MainWindow::savePaletteFile
+ *
+ * It's a slot function.
+ * Save the colors of the color board as a palette, the suffix chosen selects the format.
+ */
+void MainWindow::savePaletteFile()
+{
+    QVector<QColor> colors = workArea->getColorBoard()->getColors();
+    if(colors.isEmpty()) {
+        return;
+    }
+
+    QString name = QFileInfo(curFileName).completeBaseName();
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save palette"), name + ".txt",
+                                                    tr("Text (*.txt);;JSON (*.json);;GIMP palette (*.gpl);;"
+                                                       "Adobe swatch exchange (*.ase)"));
+    if(fileName.isEmpty()) {
+        return;
+    }
+
+    if(!savePalette(fileName, colors, name)) {
+        QMessageBox::critical(this, tr("Save palette"), tr("Can't write %1.").arg(fileName));
+    }
+}
+
+/**
+ * @brief MainWindow::saveSwatchImage
+ *
+ * It's a slot function.
+ * Save the colors of the color board as an image of swatches.
+ */
+void MainWindow::saveSwatchImage()
+{
+    QVector<QColor> colors = workArea->getColorBoard()->getColors();
+    if(colors.isEmpty()) {
+        return;
+    }
+
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save swatches"),
+                                                    QFileInfo(curFileName).completeBaseName() + ".jpg",
+                                                    tr("JPEG (*.jpg);;PNG (*.png)"));
+    if(fileName.isEmpty()) {
+        return;
+    }
+
+    if(!renderSwatches(colors, 120).save(fileName, nullptr, 95)) {
+        QMessageBox::critical(this, tr("Save swatches"), tr("Can't write %1.").arg(fileName));
+    }
+}
+
+/**
+ * @brief MainWindow::openExportArchiveDialog
+ *
+ * It's a slot function.
+ * Export the palettes of every image under a folder to one archive, in the background.
+ */
+void MainWindow::openExportArchiveDialog()
+{
+    if(archiveWatcher != nullptr && archiveWatcher->isRunning()) {
+        return;
+    }
+
+    QString root = QFileDialog::getExistingDirectory(this, tr("Folder of images"));
+    if(root.isEmpty()) {
+        return;
+    }
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save palette archive"),
+                                                    QDir(root).dirName() + "-palettes.jsonl",
+                                                    tr("JSON Lines (*.jsonl)"));
+    if(fileName.isEmpty()) {
+        return;
+    }
+
+    if(archiveWatcher == nullptr) {
+        archiveWatcher = new QFutureWatcher<qint64>(this);
+        connect(archiveWatcher,
+                SIGNAL(finished()),
+                SLOT(finishArchiveExport()));
+    }
+
+    exportArchiveAction->setEnabled(false);
+    archiveWatcher->setFuture(QtConcurrent::run([this, root, fileName]() {
+        return exportPaletteArchive(root, fileName, 7, [this](int done) {
+            QMetaObject::invokeMethod(this, "showArchiveProgress", Qt::QueuedConnection, Q_ARG(int, done));
+        });
+    }));
+}
+
+void MainWindow::showArchiveProgress(int done)
+{
+    helpTextLabel->setText(tr("Exporting palettes: %1 images read").arg(done));
+    helpTextLabel->setStyleSheet("");
+}
+
+/**
+ * @brief MainWindow::finishArchiveExport
+ *
+ * It's a slot function.
+ */
+void MainWindow::finishArchiveExport()
+{
+    exportArchiveAction->setEnabled(true);
+
+    qint64 written = archiveWatcher->result();
+    if(written < 0) {
+        helpTextLabel->setText(tr("Can't write the palette archive."));
+        helpTextLabel->setStyleSheet("color: red");
+        return;
+    }
+    helpTextLabel->setText(tr("%1 palettes exported.").arg(written));
+    helpTextLabel->setStyleSheet("color: green");
+}
+
 /**
  * @brief MainWindow::openOpenImageFailedMessageBox
  *
@@ -231,17 +929,71 @@ void MainWindow::openOpenImageFailedMessageBox()
  */
 bool MainWindow::showNewSelectedImage(QString curFileName)
 {
+    if(sequenceReader != nullptr && sequenceArea == workArea) {
+        sequenceReader->cancel();
+    }
     return workArea->getImageContainer()->loadImage(curFileName);
 }
 
 /**
- * @brief MainWindow::createNewSelectedImageColorBoard
+ * @brief MainWindow::refreshHistogramPanel
+ *
+ * It's a slot function.
+ * When the color board changes (new image, another frame, reloaded file), show the statistics
+ * of the image shown, from the palette histogram of its frame when the color board keeps it.
+ */
+void MainWindow::refreshHistogramPanel()
+{
+    ImageContainer *imageContainer = workArea->getImageContainer();
+    ColorBoard *colorBoard = workArea->getColorBoard();
+    HistogramPanel *histogramPanel = workArea->getHistogramPanel();
+
+    // The panel waits until the playback stops, it would take most of the frame time.
+    if(imageContainer->isPlaying()) {
+        return;
+    }
+
+    histogramPanel->setImage(imageContainer->getImage(), colorBoard->getFrameHistogram());
+    histogramPanel->setVisibleRect(imageContainer->getVisibleRect());
+}
+
+/**
+ * @brief MainWindow::refreshPalettePreview
+ *
+ * It's a slot function.
+ * When the color board shows other colors (new image, another frame), draw the preview again.
+ */
+void MainWindow::refreshPalettePreview()
+{
+    if(palettePreviewAction != nullptr && palettePreviewAction->isChecked()) {
+        updatePalettePreview();
+    }
+}
+
+/**
+ * @brief MainWindow::updatePalettePreview
  *
- * create the color board of the new load image.
+ * It's a slot function.
+ * When the palette preview or the dithering method is changed, draw the image with the colors of
+ * the color board, or show the original image again.
  */
-void MainWindow::createNewSelectedImageColorBoard()
+void MainWindow::updatePalettePreview()
 {
-    workArea->getColorBoard()->setColorLabels();
+    ImageContainer *imageContainer = workArea->getImageContainer();
+
+    if(palettePreviewAction == nullptr || !palettePreviewAction->isChecked()) {
+        imageContainer->clearPalettePreview();
+        return;
+    }
+
+    DitherMode mode = NoDither;
+    if(orderedDitherAction->isChecked()) {
+        mode = OrderedDither;
+    }
+    else if(floydSteinbergDitherAction->isChecked()) {
+        mode = FloydSteinbergDither;
+    }
+    imageContainer->setPalettePreview(workArea->getColorBoard()->getColors(), mode);
 }
 
 /**
@@ -250,37 +1002,121 @@ void MainWindow::createNewSelectedImageColorBoard()
  */
 void MainWindow::connectSlots()
 {
-    connect(workArea->getImageContainer(),
+    connect(viewMenu,
+            SIGNAL(aboutToShow()),
+            SLOT(populateViewMenu()));
+    connect(openImageByLocalAction,
+            SIGNAL(triggered()),
+            SLOT(openFileDialog()));
+    connect(openSequenceAction,
+            SIGNAL(triggered()),
+            SLOT(openSequenceDialog()));
+    connect(memoryBudgetAction,
+            SIGNAL(triggered()),
+            SLOT(openMemoryBudgetDialog()));
+    connect(saveAsTxtAction,
+            SIGNAL(triggered()),
+            SLOT(savePaletteFile()));
+    connect(saveAsJpgAction,
+            SIGNAL(triggered()),
+            SLOT(saveSwatchImage()));
+    connect(exportArchiveAction,
+            SIGNAL(triggered()),
+            SLOT(openExportArchiveDialog()));
+    connect(colorSearchAction,
+            SIGNAL(triggered()),
+            SLOT(openColorSearchDialog()));
+    connect(MemoryBudget::instance(),
+            SIGNAL(usageChangeSignal(qint64,qint64)),
+            SLOT(setMemoryLabelText(qint64,qint64)));
+}
+
+/**
+ * @brief MainWindow::connectDocument
+ * @param area the document becoming the current one.
+ *
+ * The status bar, the palette preview and the search dialog follow the current document only.
+ */
+void MainWindow::connectDocument(WorkArea *area)
+{
+    ImageContainer *imageContainer = area->getImageContainer();
+    ColorBoard *colorBoard = area->getColorBoard();
+
+    connect(imageContainer,
             SIGNAL(showScaleRatioChangeSignal(double)),
             SLOT(setShowScaleRatioLabelText(double)));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(cursorInImageSignal(int,int,QString&)),
             SLOT(setCurInfoLabelText(int,int,QString&)));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(cursorInImageSignal(QColor&)),
             SLOT(setColorValueLabel(QColor&)));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(cursorInImageSignal()),
             SLOT(setHelpTextLabelCursorInImage()));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(cursorOutImageSignal()),
             SLOT(setHelpTextLabelCursorOutImage()));
-    connect(workArea->getColorBoard(),
-            SIGNAL(copySuccessFromColorBoradSignal()),
-            SLOT(setHelpTextLabelCopySuccess()));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(copySuccessFromImageLabelSignal()),
             SLOT(setHelpTextLabelCopySuccess()));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(imageFileChangeSignal(QString)),
             SLOT(setFileInfoLabelText(QString)));
-    connect(workArea->getImageContainer(),
+    connect(imageContainer,
             SIGNAL(openImageFailedSignal()),
             SLOT(openOpenImageFailedMessageBox()));
+    connect(colorBoard,
+            SIGNAL(copySuccessFromColorBoradSignal()),
+            SLOT(setHelpTextLabelCopySuccess()));
+    connect(colorBoard,
+            SIGNAL(colorsChangeSignal()),
+            SLOT(refreshHistogramPanel()));
+    connect(colorBoard,
+            SIGNAL(colorsChangeSignal()),
+            SLOT(refreshPalettePreview()));
+    if(colorSearchDialog != nullptr) {
+        connect(colorBoard,
+                SIGNAL(colorsChangeSignal()),
+                SLOT(refreshColorSearchSwatches()));
+    }
+}
 
-    connect(openImageByLocalAction,
-            SIGNAL(triggered()),
-            SLOT(openFileDialog()));
+void MainWindow::disconnectDocument(WorkArea *area)
+{
+    disconnect(area->getImageContainer(), 0, this, 0);
+    disconnect(area->getColorBoard(), 0, this, 0);
+}
+
+/**
+ * @brief MainWindow::applyViewActions
+ * @param area a document.
+ *
+ * The pixel grid, the loupe and the histogram are shown or hidden in every document at once.
+ * Until the view menu is created, the documents have the same defaults as the actions.
+ */
+void MainWindow::applyViewActions(WorkArea *area)
+{
+    if(pixelGridAction == nullptr) {
+        return;
+    }
+
+    area->getImageContainer()->setPixelGridVisible(pixelGridAction->isChecked());
+    area->getImageContainer()->setLoupeVisible(loupeAction->isChecked());
+    area->getHistogramPanel()->setVisible(histogramAction->isChecked());
+
+    connect(pixelGridAction,
+            SIGNAL(toggled(bool)),
+            area->getImageContainer(),
+            SLOT(setPixelGridVisible(bool)));
+    connect(loupeAction,
+            SIGNAL(toggled(bool)),
+            area->getImageContainer(),
+            SLOT(setLoupeVisible(bool)));
+    connect(histogramAction,
+            SIGNAL(toggled(bool)),
+            area->getHistogramPanel(),
+            SLOT(setVisible(bool)));
 }
 
 /**
@@ -387,3 +1223,44 @@ void MainWindow::setFileInfoLabelText(QString info)
 {
     fileInfoLabel->setText(info);
 }
+
+/**
+ * @brief MainWindow::setMemoryLabelText
+ * @param used the bytes held by all registered caches.
+ * @param ceiling the memory budget.
+ *
+ * It's a slot function.
+ * When a cache grows or is evicted, the memory budget will send a signal, trigger the function to
+ * show the usage in status bar.
+ */
+void MainWindow::setMemoryLabelText(qint64 used, qint64 ceiling)
+{
+    QString text;
+    text = text + "Memory: " + QString::number(used / (1024 * 1024)) + " / "
+         + QString::number(ceiling / (1024 * 1024)) + " MB";
+
+    memoryLabel->setText(text);
+}
+
+/**
+ * @brief MainWindow::openMemoryBudgetDialog
+ *
+ * It's a slot function.
+ * Let users set the memory ceiling of all pixel caches. It's saved for the next start.
+ */
+void MainWindow::openMemoryBudgetDialog()
+{
+    MemoryBudget *budget = MemoryBudget::instance();
+
+    bool ok = false;
+    int megabytes = QInputDialog::getInt(this, tr("Memory budget"), tr("Memory for images and caches (MB):"),
+                                         budget->ceiling() / (1024 * 1024), 64, 1024 * 1024, 64, &ok);
+    if(!ok) {
+        return;
+    }
+
+    budget->setCeiling(qint64(megabytes) * 1024 * 1024);
+
+    QSettings settings("MyPaint", "MyPaint");
+    settings.setValue("memoryBudgetMB", megabytes);
+}
@@ -10,8 +10,17 @@
 #include <QMouseEvent>
 #include <QProgressDialog>
 #include <QThread>
+#include <QActionGroup>
+#include <QFutureWatcher>
+#include <QTabWidget>
+#include <QSplitter>
+#include <QPointer>
 
 #include "workarea.h"
+#include "tilehash.h"
+
+class ColorSearchDialog;
+class SequenceReader;
 
 class MainWindow : public QMainWindow
 {
@@ -20,21 +29,35 @@ class MainWindow : public QMainWindow
 public:
     MainWindow(QWidget *parent = 0);
     ~MainWindow();
+
+    static void setCustomStyle();
+protected:
+    bool event(QEvent *event);
 private:
     QMenuBar *menuBar;
-    QMenu *fileMenu, *openImageMenu, *openHistoryImageMenu, *settingMenu, *saveColorBoardMenu, *aboutMenu;
-    QAction *openImageByLocalAction, *openImageByUrlAction, *saveAsTxtAction, *saveAsJpgAction,
-             *restartAction, *exitAction, *preferenceAction, *referenceAction, *authorAction;
+    QMenu *fileMenu, *openImageMenu, *openHistoryImageMenu, *settingMenu, *saveColorBoardMenu, *aboutMenu,
+          *viewMenu, *ditherMenu;
+    QAction *openImageByLocalAction, *openSequenceAction, *saveAsTxtAction, *saveAsJpgAction,
+             *exportArchiveAction, *restartAction, *exitAction, *preferenceAction, *referenceAction, *authorAction,
+             *memoryBudgetAction, *colorSearchAction, *palettePreviewAction, *pixelGridAction, *loupeAction, *histogramAction, *perceptualPaletteAction, *salientPaletteAction, *compareAction, *noDitherAction, *orderedDitherAction, *floydSteinbergDitherAction;
+    QActionGroup *ditherActionGroup;
     QToolBar *toolBar;
     QStatusBar *statusBar;
-    QLabel *fileInfoLabel, *curInfoLabel, *showScaleRatioLabel, *colorValueLabel, *helpTextLabel;
+    QLabel *fileInfoLabel, *curInfoLabel, *showScaleRatioLabel, *colorValueLabel, *helpTextLabel, *memoryLabel;
+    QSplitter *documentSplitter;
+    QTabWidget *documentTabs, *compareTabs;
     WorkArea *workArea;
+    QPointer<WorkArea> sequenceArea;
+    QPointer<ImageContainer> syncedContainers[2];
     QString curFileName;
 
+    ColorSearchDialog *colorSearchDialog;
+
     QProgressDialog *progressDialog;
     QThread *downloadThread;
-
-    void setCustomStyle();
+    QFutureWatcher<qint64> *archiveWatcher;
+    SequenceReader *sequenceReader;
+    bool firstFramePainted;
 
     void createMenu(QMainWindow *mainWindow);
     void createStatusBar(QMainWindow *mainWindow);
@@ -42,9 +65,19 @@ private:
     void createWorkArea(QMainWindow *mainWindow);
 
     void connectSlots();
+    void connectDocument(WorkArea *area);
+    void disconnectDocument(WorkArea *area);
+    void applyViewActions(WorkArea *area);
+    WorkArea *addDocument();
+    WorkArea *documentForImage();
+    void setDocumentTitle(WorkArea *area, const QString &fileName);
+    void syncCompareView();
+    void updateSequencePriority();
+    void loadIcons();
 
     bool showNewSelectedImage(QString curFileName);
-    void createNewSelectedImageColorBoard();
+    void startSequence(const QStringList &fileNames);
+    void analyseImageAgain();
 
 public slots:
     void setShowScaleRatioLabelText(double showScaleRatio);
@@ -54,8 +87,32 @@ public slots:
     void setHelpTextLabelCursorOutImage();
     void setHelpTextLabelCopySuccess();
     void setFileInfoLabelText(QString info);
+    void setMemoryLabelText(qint64 used, qint64 ceiling);
 
     void openFileDialog();
+    void openSequenceDialog();
+    void showSequenceFrame(int index, const QImage &frame, const QVector<QColor> &palette,
+                           const ColorHistogram &histogram);
+    void finishSequence();
+    void populateViewMenu();
+    void finishStartup();
+    void openImageFile(QString fileName);
+    void openColorSearchDialog();
+    void refreshColorSearchSwatches();
+    void setCurrentDocument(int index);
+    void closeDocument(int index);
+    void setCompareView(bool compare);
+    void refreshHistogramPanel();
+    void updatePalettePreview();
+    void refreshPalettePreview();
+    void setPerceptualPalette(bool perceptual);
+    void setSalientPalette(bool salient);
+    void openMemoryBudgetDialog();
+    void savePaletteFile();
+    void saveSwatchImage();
+    void openExportArchiveDialog();
+    void showArchiveProgress(int done);
+    void finishArchiveExport();
 
     void openOpenImageFailedMessageBox();
 };
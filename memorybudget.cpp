@@ -0,0 +1,229 @@
+#include "memorybudget.h"
+#include <QMutexLocker>
+#include <QSettings>
+#include <QCoreApplication>
+#include <QVector>
+#include <QSet>
+#include <QMetaObject>
+
+MemoryBudget::MemoryBudget(QObject *parent) : QObject(parent)
+{
+    nextId = 1;
+    used = 0;
+    clock = 0.0;
+    enforceQueued = false;
+
+    QSettings settings("MyPaint", "MyPaint");
+    limit = settings.value("memoryBudgetMB", 1024).toLongLong() * 1024 * 1024;
+}
+
+/**
+ * @brief MemoryBudget::instance
+ * @return the budget shared by the whole process.
+ *
+ * It must be called first on the main thread (main() does it), so its slots run there.
+ */
+MemoryBudget *MemoryBudget::instance()
+{
+    static MemoryBudget *budget = new MemoryBudget(QCoreApplication::instance());
+    return budget;
+}
+
+/**
+ * @brief MemoryBudget::registerEntry
+ * @param owner a readable name of the cache, for debugging.
+ * @param bytes the exact size of the entry.
+ * @param rebuildCost the estimated time to build the entry again, in microseconds.
+ * @param evictor frees the entry. Without it the entry is never evicted.
+ * @return the entry id.
+ */
+int MemoryBudget::registerEntry(const QString &owner, qint64 bytes, qint64 rebuildCost, Evictor evictor)
+{
+    int id;
+    {
+        QMutexLocker locker(&mutex);
+
+        Entry entry;
+        entry.owner = owner;
+        entry.bytes = bytes;
+        entry.rebuildCost = rebuildCost;
+        entry.priority = clock + double(rebuildCost) / qMax(Q_INT64_C(1), bytes);
+        entry.pinned = !evictor;
+        entry.evictor = evictor;
+
+        id = nextId++;
+        entries.insert(id, entry);
+        used += bytes;
+    }
+
+    scheduleEnforce();
+    emitUsage();
+    return id;
+}
+
+void MemoryBudget::updateEntry(int id, qint64 bytes)
+{
+    {
+        QMutexLocker locker(&mutex);
+        QHash<int, Entry>::iterator it = entries.find(id);
+        if(it == entries.end()) {
+            return;
+        }
+        used += bytes - it->bytes;
+        it->bytes = bytes;
+    }
+
+    scheduleEnforce();
+    emitUsage();
+}
+
+void MemoryBudget::unregisterEntry(int id)
+{
+    {
+        QMutexLocker locker(&mutex);
+        QHash<int, Entry>::iterator it = entries.find(id);
+        if(it == entries.end()) {
+            return;
+        }
+        used -= it->bytes;
+        entries.erase(it);
+    }
+
+    emitUsage();
+}
+
+/**
+ * @brief MemoryBudget::touch
+ * @param id the entry id.
+ *
+ * Call it when the entry is used, it moves the entry away from eviction.
+ */
+void MemoryBudget::touch(int id)
+{
+    QMutexLocker locker(&mutex);
+    QHash<int, Entry>::iterator it = entries.find(id);
+    if(it != entries.end()) {
+        it->priority = clock + double(it->rebuildCost) / qMax(Q_INT64_C(1), it->bytes);
+    }
+}
+
+/**
+ * @brief MemoryBudget::setPinned
+ * @param id the entry id.
+ * @param pinned a pinned entry is never evicted, e.g. the pixmap on screen.
+ */
+void MemoryBudget::setPinned(int id, bool pinned)
+{
+    {
+        QMutexLocker locker(&mutex);
+        QHash<int, Entry>::iterator it = entries.find(id);
+        if(it == entries.end() || !it->evictor) {
+            return;
+        }
+        it->pinned = pinned;
+    }
+
+    if(!pinned) {
+        scheduleEnforce();
+    }
+}
+
+qint64 MemoryBudget::usedBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return used;
+}
+
+qint64 MemoryBudget::ceiling() const
+{
+    QMutexLocker locker(&mutex);
+    return limit;
+}
+
+void MemoryBudget::setCeiling(qint64 bytes)
+{
+    {
+        QMutexLocker locker(&mutex);
+        limit = bytes;
+    }
+
+    scheduleEnforce();
+    emitUsage();
+}
+
+void MemoryBudget::scheduleEnforce()
+{
+    QMutexLocker locker(&mutex);
+    if(used <= limit || enforceQueued) {
+        return;
+    }
+    enforceQueued = true;
+    QMetaObject::invokeMethod(this, "enforce", Qt::QueuedConnection);
+}
+
+void MemoryBudget::emitUsage()
+{
+    emit usageChangeSignal(usedBytes(), ceiling());
+}
+
+/**
+ * @brief MemoryBudget::enforce
+ *
+ * It's a slot function, always run on the main thread.
+ * Evict the entries with the lowest priority until the usage is under the ceiling. The clock
+ * goes up to the priority of every evicted entry, so entries touched later rank above entries
+ * which are only expensive.
+ */
+void MemoryBudget::enforce()
+{
+    QVector<int> victims;
+    {
+        QMutexLocker locker(&mutex);
+        enforceQueued = false;
+
+        qint64 remaining = used;
+        QSet<int> chosen;
+        while(remaining > limit) {
+            QHash<int, Entry>::iterator victim = entries.end();
+            for(QHash<int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                if(!it->pinned && !chosen.contains(it.key())
+                   && (victim == entries.end() || it->priority < victim->priority)) {
+                    victim = it;
+                }
+            }
+            if(victim == entries.end()) {
+                break;
+            }
+
+            clock = victim->priority;
+            remaining -= victim->bytes;
+            chosen.insert(victim.key());
+            victims.push_back(victim.key());
+        }
+    }
+
+    /*
+     * The evictors are called without the lock, they may register, update or unregister other
+     * entries. A victim unregistered or pinned by an earlier evictor is left alone.
+     */
+    bool evicted = false;
+    for(int i = 0; i < victims.size(); i++) {
+        Evictor evictor;
+        {
+            QMutexLocker locker(&mutex);
+            QHash<int, Entry>::iterator it = entries.find(victims[i]);
+            if(it == entries.end() || it->pinned) {
+                continue;
+            }
+            used -= it->bytes;
+            evictor = it->evictor;
+            entries.erase(it);
+        }
+        evictor();
+        evicted = true;
+    }
+
+    if(evicted) {
+        emitUsage();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <functional>
+
+/*
+ * Every cache holding pixels registers its entries here with their exact size and an estimated
+ * cost to build them again. When the total goes over the ceiling, the entries with the lowest
+ * priority are evicted (GreedyDual-Size: cheap to rebuild and long unused goes first).
+ *
+ * The budget can be updated from any thread, but evictors always run on the main thread.
+ */
+class MemoryBudget : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void()> Evictor;
+
+    static MemoryBudget *instance();
+
+    int registerEntry(const QString &owner, qint64 bytes, qint64 rebuildCost, Evictor evictor = Evictor());
+    void updateEntry(int id, qint64 bytes);
+    void unregisterEntry(int id);
+    void touch(int id);
+    void setPinned(int id, bool pinned);
+
+    qint64 usedBytes() const;
+    qint64 ceiling() const;
+    void setCeiling(qint64 bytes);
+private:
+    explicit MemoryBudget(QObject *parent = 0);
+
+    struct Entry
+    {
+        QString owner;
+        qint64 bytes;
+        qint64 rebuildCost;
+        double priority;
+        bool pinned;
+        Evictor evictor;
+    };
+
+    mutable QMutex mutex;
+    QHash<int, Entry> entries;
+    int nextId;
+    qint64 used, limit;
+    double clock;
+    bool enforceQueued;
+
+    void scheduleEnforce();
+    void emitUsage();
+private slots:
+    void enforce();
+signals:
+    void usageChangeSignal(qint64 used, qint64 ceiling);
+};
+
+#endif // MEMORYBUDGET_H
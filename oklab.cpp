@@ -0,0 +1,154 @@
+#include "oklab.h"
+#include <QtMath>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+namespace {
+
+/*
+ * Cube root of 4 non-negative values: a guess from the float bits (the exponent divided by 3),
+ * then 3 Newton steps, which reach float precision.
+ */
+inline __m128 cubeRoot(__m128 x)
+{
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    __m128i bits = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)), third));
+    __m128 y = _mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(709921077)));
+    for(int i = 0; i < 3; i++) {
+        y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))), third);
+    }
+    return y;
+}
+
+// a * x + b * y + c * z with the coefficients broadcast.
+inline __m128 combine(float a, __m128 x, float b, __m128 y, float c, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a), x), _mm_mul_ps(_mm_set1_ps(b), y)),
+                      _mm_mul_ps(_mm_set1_ps(c), z));
+}
+
+}
+#endif
+
+/**
+ * @brief srgbToLinearTable
+ * @return the linear light value of every 8 bit sRGB value.
+ *
+ * The transfer function has a pow() in it, 256 values are computed once instead.
+ */
+const float *srgbToLinearTable()
+{
+    static struct Table
+    {
+        float values[256];
+
+        Table()
+        {
+            for(int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                values[i] = float(c <= 0.04045 ? c / 12.92 : qPow((c + 0.055) / 1.055, 2.4));
+            }
+        }
+    } table;
+
+    return table.values;
+}
+
+/**
+ * @brief linearToSrgb
+ * @param value the linear light value, 0..1.
+ * @return the sRGB value, 0..255.
+ */
+float linearToSrgb(float value)
+{
+    value = qBound(0.0f, value, 1.0f);
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * float(qPow(value, 1.0 / 2.4)) - 0.055f;
+    return c * 255.0f;
+}
+
+OkLab rgbToOkLab(QRgb rgb)
+{
+    const float *linear = srgbToLinearTable();
+    float r = linear[qRed(rgb)];
+    float g = linear[qGreen(rgb)];
+    float b = linear[qBlue(rgb)];
+
+    float l = std::cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+    float m = std::cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+    float s = std::cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+    OkLab lab;
+    lab.L = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+    lab.a = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+    lab.b = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+    return lab;
+}
+
+/**
+ * @brief rgbToOkLab
+ * @param pixels the colors to convert.
+ * @param count the number of colors.
+ * @param out the OKLab colors.
+ *
+ * The channels go through the linear table, then with SSE2 4 colors at a time through both
+ * matrices and the cube root, one color per lane.
+ */
+void rgbToOkLab(const QRgb *pixels, int count, OkLab *out)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const float *linear = srgbToLinearTable();
+    for(; i + 4 <= count; i += 4) {
+        __m128 r = _mm_setr_ps(linear[qRed(pixels[i])], linear[qRed(pixels[i + 1])],
+                               linear[qRed(pixels[i + 2])], linear[qRed(pixels[i + 3])]);
+        __m128 g = _mm_setr_ps(linear[qGreen(pixels[i])], linear[qGreen(pixels[i + 1])],
+                               linear[qGreen(pixels[i + 2])], linear[qGreen(pixels[i + 3])]);
+        __m128 b = _mm_setr_ps(linear[qBlue(pixels[i])], linear[qBlue(pixels[i + 1])],
+                               linear[qBlue(pixels[i + 2])], linear[qBlue(pixels[i + 3])]);
+
+        __m128 l = cubeRoot(combine(0.4122214708f, r, 0.5363325363f, g, 0.0514459929f, b));
+        __m128 m = cubeRoot(combine(0.2119034982f, r, 0.6806995451f, g, 0.1073969566f, b));
+        __m128 s = cubeRoot(combine(0.0883024619f, r, 0.2817188376f, g, 0.6299787005f, b));
+
+        float L[4], A[4], B[4];
+        _mm_storeu_ps(L, combine(0.2104542553f, l, 0.7936177850f, m, -0.0040720468f, s));
+        _mm_storeu_ps(A, combine(1.9779984951f, l, -2.4285922050f, m, 0.4505937099f, s));
+        _mm_storeu_ps(B, combine(0.0259040371f, l, 0.7827717662f, m, -0.8086757660f, s));
+        for(int k = 0; k < 4; k++) {
+            out[i + k].L = L[k];
+            out[i + k].a = A[k];
+            out[i + k].b = B[k];
+        }
+    }
+#endif
+
+    for(; i < count; i++) {
+        out[i] = rgbToOkLab(pixels[i]);
+    }
+}
+
+QRgb okLabToRgb(const OkLab &lab)
+{
+    float l = lab.L + 0.3963377774f * lab.a + 0.2158037573f * lab.b;
+    float m = lab.L - 0.1055613458f * lab.a - 0.0638541728f * lab.b;
+    float s = lab.L - 0.0894841775f * lab.a - 1.2914855480f * lab.b;
+    l = l * l * l;
+    m = m * m * m;
+    s = s * s * s;
+
+    float r = 4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+    float g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+    float b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+    return qRgb(qRound(linearToSrgb(r)), qRound(linearToSrgb(g)), qRound(linearToSrgb(b)));
+}
+
+float okLabDistanceSquared(const OkLab &first, const OkLab &second)
+{
+    float dL = first.L - second.L;
+    float da = first.a - second.a;
+    float db = first.b - second.b;
+    return dL * dL + da * da + db * db;
+}
@@ -0,0 +1,23 @@
+#ifndef OKLAB_H
+#define OKLAB_H
+
+#include <QColor>
+
+/*
+ * OKLab is a perceptual color space: the euclidean distance of two colors is close to how
+ * different they look, which sRGB distance is not.
+ */
+struct OkLab
+{
+    float L, a, b;
+};
+
+const float *srgbToLinearTable();
+float linearToSrgb(float value);
+
+OkLab rgbToOkLab(QRgb rgb);
+void rgbToOkLab(const QRgb *pixels, int count, OkLab *out);
+QRgb okLabToRgb(const OkLab &lab);
+float okLabDistanceSquared(const OkLab &first, const OkLab &second);
+
+#endif // OKLAB_H
@@ -0,0 +1,988 @@
+#include "paletteengine.h"
+#include "oklab.h"
+#include "imageloader.h"
+#include "resampler.h"
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// The palette of a thumbnail is as good as the palette of the full image, and much faster.
+const int AnalysisSide = 256;
+
+// The k-means steps after the perceptual median cut.
+const int RefineSteps = 4;
+
+// Two palettes further apart than this on average (OKLab distance) belong to different shots.
+const float SceneCutDistance = 0.12f;
+
+/*
+ * A box in the reduced color space. lo and hi are inclusive bin coordinates of the r, g and b
+ * axis.
+ */
+struct VBox
+{
+    int lo[3];
+    int hi[3];
+    qint64 count;
+
+    qint64 volume() const
+    {
+        return qint64(hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+    }
+};
+
+qint64 boxCount(const ColorHistogram &histogram, const VBox &box)
+{
+    qint64 count = 0;
+    for(int r = box.lo[0]; r <= box.hi[0]; r++) {
+        for(int g = box.lo[1]; g <= box.hi[1]; g++) {
+            for(int b = box.lo[2]; b <= box.hi[2]; b++) {
+                count += histogram.count(ColorHistogram::binIndex(r, g, b));
+            }
+        }
+    }
+    return count;
+}
+
+QColor boxAverage(const ColorHistogram &histogram, const VBox &box)
+{
+    const int mult = 1 << ColorHistogram::Shift;
+    double sum[3] = {0.0, 0.0, 0.0};
+    qint64 total = 0;
+
+    for(int r = box.lo[0]; r <= box.hi[0]; r++) {
+        for(int g = box.lo[1]; g <= box.hi[1]; g++) {
+            for(int b = box.lo[2]; b <= box.hi[2]; b++) {
+                quint32 n = histogram.count(ColorHistogram::binIndex(r, g, b));
+                total += n;
+                sum[0] += n * (r + 0.5) * mult;
+                sum[1] += n * (g + 0.5) * mult;
+                sum[2] += n * (b + 0.5) * mult;
+            }
+        }
+    }
+
+    if(total == 0) {
+        return QColor(mult * (box.lo[0] + box.hi[0] + 1) / 2,
+                      mult * (box.lo[1] + box.hi[1] + 1) / 2,
+                      mult * (box.lo[2] + box.hi[2] + 1) / 2);
+    }
+    return QColor(qMin(255, int(sum[0] / total)),
+                  qMin(255, int(sum[1] / total)),
+                  qMin(255, int(sum[2] / total)));
+}
+
+/*
+ * Cut the box along its longest axis at the median of the pixels it contains.
+ * Return false if the box can't be split any more.
+ */
+bool splitBox(const ColorHistogram &histogram, const VBox &box, VBox &first, VBox &second)
+{
+    if(box.count == 0 || box.volume() == 1) {
+        return false;
+    }
+
+    int axis = 0;
+    for(int i = 1; i < 3; i++) {
+        if(box.hi[i] - box.lo[i] > box.hi[axis] - box.lo[axis]) {
+            axis = i;
+        }
+    }
+
+    QVector<qint64> partial(box.hi[axis] - box.lo[axis] + 1, 0);
+    int c[3];
+    for(c[0] = box.lo[0]; c[0] <= box.hi[0]; c[0]++) {
+        for(c[1] = box.lo[1]; c[1] <= box.hi[1]; c[1]++) {
+            for(c[2] = box.lo[2]; c[2] <= box.hi[2]; c[2]++) {
+                partial[c[axis] - box.lo[axis]] += histogram.count(ColorHistogram::binIndex(c[0], c[1], c[2]));
+            }
+        }
+    }
+    for(int i = 1; i < partial.size(); i++) {
+        partial[i] += partial[i - 1];
+    }
+
+    int cut = 0;
+    while(cut < partial.size() - 1 && partial[cut] * 2 < box.count) {
+        cut++;
+    }
+    if(cut == partial.size() - 1) {
+        cut--;
+    }
+
+    first = box;
+    second = box;
+    first.hi[axis] = box.lo[axis] + cut;
+    second.lo[axis] = box.lo[axis] + cut + 1;
+    first.count = partial[cut];
+    second.count = box.count - first.count;
+
+    return true;
+}
+
+/*
+ * Split the boxes with the highest priority until there are enough of them.
+ * The first pass ranks boxes by their pixel count, the second pass by count * volume,
+ * so large sparse regions of the color space still get a color.
+ */
+void splitBoxes(const ColorHistogram &histogram, QVector<VBox> &boxes, int target, bool byVolume)
+{
+    while(boxes.size() < target) {
+        int best = -1;
+        qint64 bestPriority = 0;
+        for(int i = 0; i < boxes.size(); i++) {
+            if(boxes[i].volume() == 1 || boxes[i].count == 0) {
+                continue;
+            }
+            qint64 priority = byVolume ? boxes[i].count * boxes[i].volume() : boxes[i].count;
+            if(priority > bestPriority) {
+                best = i;
+                bestPriority = priority;
+            }
+        }
+
+        VBox first, second;
+        if(best < 0 || !splitBox(histogram, boxes[best], first, second)) {
+            return;
+        }
+        boxes[best] = first;
+        boxes.push_back(second);
+    }
+}
+
+bool boxCountGreater(const VBox &a, const VBox &b)
+{
+    return a.count > b.count;
+}
+
+/*
+ * An occupied histogram bin in OKLab, and a box of them: a range of the point array and its
+ * bounds.
+ */
+struct LabPoint
+{
+    float lab[3];
+    qint64 count;
+};
+
+struct LabBox
+{
+    int begin, end;
+    float lo[3], hi[3];
+    qint64 count;
+
+    double volume() const
+    {
+        return double(hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+    }
+};
+
+struct LabBelow
+{
+    int axis;
+    float limit;
+
+    bool operator()(const LabPoint &point) const
+    {
+        return point.lab[axis] < limit;
+    }
+};
+
+void fitLabBox(const QVector<LabPoint> &points, LabBox &box)
+{
+    box.count = 0;
+    for(int i = 0; i < 3; i++) {
+        box.lo[i] = points[box.begin].lab[i];
+        box.hi[i] = box.lo[i];
+    }
+    for(int p = box.begin; p < box.end; p++) {
+        for(int i = 0; i < 3; i++) {
+            box.lo[i] = qMin(box.lo[i], points[p].lab[i]);
+            box.hi[i] = qMax(box.hi[i], points[p].lab[i]);
+        }
+        box.count += points[p].count;
+    }
+}
+
+/*
+ * Cut the box along its longest axis near the median pixel. The axis is counted in 256 slices
+ * and the points are partitioned at the slice of the median, no sorting.
+ */
+bool splitLabBox(QVector<LabPoint> &points, const LabBox &box, LabBox &first, LabBox &second)
+{
+    const int Slices = 256;
+
+    int axis = 0;
+    for(int i = 1; i < 3; i++) {
+        if(box.hi[i] - box.lo[i] > box.hi[axis] - box.lo[axis]) {
+            axis = i;
+        }
+    }
+    float range = box.hi[axis] - box.lo[axis];
+    if(box.end - box.begin < 2 || range <= 0.0f) {
+        return false;
+    }
+
+    qint64 slices[Slices] = {0};
+    float scale = Slices / range;
+    for(int p = box.begin; p < box.end; p++) {
+        slices[qMin(Slices - 1, int((points[p].lab[axis] - box.lo[axis]) * scale))] += points[p].count;
+    }
+
+    // The first slice holds the lowest point and the last one the highest, both halves get one.
+    int cut = 0;
+    qint64 below = slices[0];
+    while(cut < Slices - 2 && below * 2 < box.count) {
+        cut++;
+        below += slices[cut];
+    }
+
+    LabBelow isBelow;
+    isBelow.axis = axis;
+    isBelow.limit = box.lo[axis] + (cut + 1) / scale;
+    int middle = int(std::partition(points.begin() + box.begin, points.begin() + box.end, isBelow) - points.begin());
+    if(middle == box.begin || middle == box.end) {
+        return false;
+    }
+
+    first.begin = box.begin;
+    first.end = middle;
+    second.begin = middle;
+    second.end = box.end;
+    fitLabBox(points, first);
+    fitLabBox(points, second);
+    return true;
+}
+
+/*
+ * The same two passes as splitBoxes(), on OKLab boxes.
+ */
+void splitLabBoxes(QVector<LabPoint> &points, QVector<LabBox> &boxes, int target, bool byVolume)
+{
+    while(boxes.size() < target) {
+        int best = -1;
+        double bestPriority = 0.0;
+        for(int i = 0; i < boxes.size(); i++) {
+            if(boxes[i].end - boxes[i].begin < 2) {
+                continue;
+            }
+            double priority = byVolume ? boxes[i].count * qMax(boxes[i].volume(), 1e-9) : double(boxes[i].count);
+            if(priority > bestPriority) {
+                best = i;
+                bestPriority = priority;
+            }
+        }
+
+        LabBox first, second;
+        if(best < 0 || !splitLabBox(points, boxes[best], first, second)) {
+            return;
+        }
+        boxes[best] = first;
+        boxes.push_back(second);
+    }
+}
+
+struct LabCluster
+{
+    OkLab mean;
+    qint64 count;
+};
+
+bool labClusterCountGreater(const LabCluster &a, const LabCluster &b)
+{
+    return a.count > b.count;
+}
+
+/*
+ * A few k-means steps from the box means: a median cut may go through a cluster of colors and
+ * average its halves with their neighbours, every point moving to its nearest mean fixes that.
+ */
+void refineClusters(const QVector<LabPoint> &points, QVector<LabCluster> &clusters, int iterations)
+{
+    QVector<double> sums(clusters.size() * 3);
+    for(int step = 0; step < iterations; step++) {
+        sums.fill(0.0);
+        for(int i = 0; i < clusters.size(); i++) {
+            clusters[i].count = 0;
+        }
+
+        for(int p = 0; p < points.size(); p++) {
+            OkLab lab = {points[p].lab[0], points[p].lab[1], points[p].lab[2]};
+            int nearest = 0;
+            float nearestDistance = okLabDistanceSquared(lab, clusters[0].mean);
+            for(int i = 1; i < clusters.size(); i++) {
+                float distance = okLabDistanceSquared(lab, clusters[i].mean);
+                if(distance < nearestDistance) {
+                    nearest = i;
+                    nearestDistance = distance;
+                }
+            }
+            clusters[nearest].count += points[p].count;
+            for(int c = 0; c < 3; c++) {
+                sums[nearest * 3 + c] += double(points[p].lab[c]) * points[p].count;
+            }
+        }
+
+        for(int i = clusters.size() - 1; i >= 0; i--) {
+            if(clusters[i].count == 0) {
+                clusters.remove(i);
+                sums.remove(i * 3, 3);
+                continue;
+            }
+            clusters[i].mean.L = float(sums[i * 3] / clusters[i].count);
+            clusters[i].mean.a = float(sums[i * 3 + 1] / clusters[i].count);
+            clusters[i].mean.b = float(sums[i * 3 + 2] / clusters[i].count);
+        }
+    }
+}
+
+/*
+ * Median cut in OKLab, then refined by k-means. Only the occupied bins are converted, at most
+ * 32768 colors whatever the image size, and every color is averaged in OKLab before it goes
+ * back to sRGB.
+ */
+QVector<QColor> quantizePerceptual(const ColorHistogram &histogram, int colorCount)
+{
+    QVector<QRgb> centers;
+    QVector<qint64> counts;
+    const int half = 1 << (ColorHistogram::Shift - 1);
+    for(int r = 0; r < ColorHistogram::SideLength; r++) {
+        for(int g = 0; g < ColorHistogram::SideLength; g++) {
+            for(int b = 0; b < ColorHistogram::SideLength; b++) {
+                quint32 n = histogram.count(ColorHistogram::binIndex(r, g, b));
+                if(n == 0) {
+                    continue;
+                }
+                centers.push_back(qRgb((r << ColorHistogram::Shift) + half, (g << ColorHistogram::Shift) + half,
+                                       (b << ColorHistogram::Shift) + half));
+                counts.push_back(n);
+            }
+        }
+    }
+
+    QVector<OkLab> labs(centers.size());
+    rgbToOkLab(centers.constData(), centers.size(), labs.data());
+
+    QVector<LabPoint> points(centers.size());
+    for(int i = 0; i < points.size(); i++) {
+        points[i].lab[0] = labs[i].L;
+        points[i].lab[1] = labs[i].a;
+        points[i].lab[2] = labs[i].b;
+        points[i].count = counts[i];
+    }
+
+    QVector<LabBox> boxes;
+    LabBox whole;
+    whole.begin = 0;
+    whole.end = points.size();
+    fitLabBox(points, whole);
+    boxes.push_back(whole);
+    splitLabBoxes(points, boxes, qMax(1, colorCount * 3 / 4), false);
+    splitLabBoxes(points, boxes, colorCount, true);
+
+    QVector<LabCluster> clusters;
+    for(int i = 0; i < boxes.size(); i++) {
+        double sum[3] = {0.0, 0.0, 0.0};
+        for(int p = boxes[i].begin; p < boxes[i].end; p++) {
+            for(int c = 0; c < 3; c++) {
+                sum[c] += double(points[p].lab[c]) * points[p].count;
+            }
+        }
+        LabCluster cluster;
+        cluster.mean.L = float(sum[0] / boxes[i].count);
+        cluster.mean.a = float(sum[1] / boxes[i].count);
+        cluster.mean.b = float(sum[2] / boxes[i].count);
+        cluster.count = boxes[i].count;
+        clusters.push_back(cluster);
+    }
+    refineClusters(points, clusters, RefineSteps);
+
+    std::sort(clusters.begin(), clusters.end(), labClusterCountGreater);
+    QVector<QColor> colors;
+    for(int i = 0; i < clusters.size(); i++) {
+        colors.push_back(QColor(okLabToRgb(clusters[i].mean)));
+    }
+    return colors;
+}
+
+struct FrameAnalysis
+{
+    ColorHistogram histogram;
+    QVector<QColor> palette;
+    ColorHistogram weightedHistogram;
+};
+
+/*
+ * Histogram and quantize one frame on a worker thread.
+ */
+struct FrameWorker
+{
+    typedef FrameAnalysis result_type;
+
+    int colorCount;
+    QuantizeMode mode;
+    PixelWeighting weighting;
+
+    FrameAnalysis operator()(const QImage &frame) const
+    {
+        FrameAnalysis analysis;
+        if(weighting == SaliencyWeighting) {
+            analysis.histogram.add(frame, computeSaliency(frame), analysis.weightedHistogram);
+            analysis.palette = quantizeHistogram(analysis.weightedHistogram, colorCount, mode);
+        }
+        else {
+            analysis.histogram.add(frame);
+            analysis.palette = quantizeHistogram(analysis.histogram, colorCount, mode);
+        }
+        return analysis;
+    }
+};
+
+void mergeFrameAnalysis(FramePalettes &result, const FrameAnalysis &frame)
+{
+    result.histogram.merge(frame.histogram);
+    result.weightedHistogram.merge(frame.weightedHistogram);
+    result.framePalettes.push_back(frame.palette);
+    result.frameHistograms.push_back(frame.histogram);
+}
+
+}
+
+ColorHistogram::ColorHistogram()
+    : bins(BinCount, 0), pixelCount(0)
+{
+}
+
+int ColorHistogram::binIndex(int r, int g, int b)
+{
+    return (r << (2 * SignificantBits)) + (g << SignificantBits) + b;
+}
+
+quint32 ColorHistogram::count(int index) const
+{
+    return bins[index];
+}
+
+qint64 ColorHistogram::total() const
+{
+    return pixelCount;
+}
+
+bool ColorHistogram::isEmpty() const
+{
+    return pixelCount == 0;
+}
+
+void ColorHistogram::clear()
+{
+    bins.fill(0);
+    pixelCount = 0;
+}
+
+void ColorHistogram::add(const QImage &image)
+{
+    add(image, image.rect());
+}
+
+/**
+ * @brief ColorHistogram::add
+ * @param image the source image.
+ * @param rect the part of the image to count.
+ * @param sign 1 to add the pixels, -1 to remove pixels counted before.
+ *
+ * Count the opaque pixels of the rect. Mostly transparent pixels are ignored because their
+ * color is not what users see.
+ * 16-bit images are read as they are, the top 5 bits of a 16-bit channel are the same bin as
+ * the top 5 bits of the 8-bit channel, so they never go through an 8-bit copy.
+ */
+void ColorHistogram::add(const QImage &image, const QRect &rect, int sign)
+{
+    QRect area = rect.intersected(image.rect());
+    if(area.isEmpty()) {
+        return;
+    }
+
+    QImage source = image;
+    bool wide = image.format() == QImage::Format_RGBA64 || image.format() == QImage::Format_RGBX64;
+    if(!wide && source.format() != QImage::Format_ARGB32 && source.format() != QImage::Format_RGB32) {
+        wide = image.depth() > 32;
+        source = image.copy(area).convertToFormat(wide ? QImage::Format_RGBA64 : QImage::Format_ARGB32);
+        area.moveTo(0, 0);
+    }
+
+    qint64 counted = 0;
+    for(int y = area.top(); y <= area.bottom(); y++) {
+        if(wide) {
+            counted += addRow64(reinterpret_cast<const quint64 *>(source.constScanLine(y)), area.left(),
+                                area.right() + 1, sign);
+        }
+        else {
+            counted += addRow(reinterpret_cast<const QRgb *>(source.constScanLine(y)), area.left(),
+                              area.right() + 1, sign);
+        }
+    }
+    pixelCount += sign * counted;
+}
+
+/**
+ * @brief ColorHistogram::add
+ * @param image the source image.
+ * @param saliency the saliency map of the image.
+ * @param weighted the histogram the pixels are added to weighted by their saliency.
+ *
+ * Count the pixels in this histogram, and at the same time add every pixel to weighted as
+ * many times as the weight of its saliency cell. The bin index of a pixel is computed once for
+ * both, the weighted histogram costs one more increment per pixel.
+ */
+void ColorHistogram::add(const QImage &image, const SaliencyMap &saliency, ColorHistogram &weighted)
+{
+    if(image.isNull() || saliency.isEmpty()) {
+        return;
+    }
+
+    QImage source = image;
+    bool wide = image.format() == QImage::Format_RGBA64 || image.format() == QImage::Format_RGBX64;
+    if(!wide && source.format() != QImage::Format_ARGB32 && source.format() != QImage::Format_RGB32) {
+        wide = image.depth() > 32;
+        source = image.convertToFormat(wide ? QImage::Format_RGBA64 : QImage::Format_ARGB32);
+    }
+
+    // The pixel columns of every saliency column.
+    QVector<int> columnStarts(saliency.width + 1);
+    for(int cx = 0; cx <= saliency.width; cx++) {
+        columnStarts[cx] = int(qint64(cx) * source.width() / saliency.width);
+    }
+
+    quint32 *weightedBins = weighted.bins.data();
+    qint64 counted = 0, weightedCounted = 0;
+    for(int y = 0; y < source.height(); y++) {
+        int cellRow = int(qint64(y) * saliency.height / source.height());
+        const quint8 *weights = saliency.weights.constData() + cellRow * saliency.width;
+        for(int cx = 0; cx < saliency.width; cx++) {
+            qint64 n;
+            if(wide) {
+                n = addRow64(reinterpret_cast<const quint64 *>(source.constScanLine(y)), columnStarts[cx],
+                             columnStarts[cx + 1], 1, weightedBins, weights[cx]);
+            }
+            else {
+                n = addRow(reinterpret_cast<const QRgb *>(source.constScanLine(y)), columnStarts[cx],
+                           columnStarts[cx + 1], 1, weightedBins, weights[cx]);
+            }
+            counted += n;
+            weightedCounted += n * weights[cx];
+        }
+    }
+    pixelCount += counted;
+    weighted.pixelCount += weightedCounted;
+}
+
+/**
+ * @brief ColorHistogram::addRow
+ * @param line an ARGB32 row.
+ * @param x the first pixel.
+ * @param end the pixel after the last one.
+ * @param sign 1 to add the pixels, -1 to remove them.
+ * @param weighted the bins of a second histogram the pixels are also added to, or nullptr.
+ * @param weight what every pixel adds to the second histogram.
+ * @return the number of pixels counted.
+ */
+qint64 ColorHistogram::addRow(const QRgb *line, int x, int end, int sign, quint32 *weighted, int weight)
+{
+    quint32 *data = bins.data();
+    qint64 counted = 0;
+
+#if defined(__SSE2__)
+    // The bin indices and the alpha test of 4 pixels at once, only the increments are scalar.
+    const __m128i redMask = _mm_set1_epi32(0x1f << (2 * SignificantBits));
+    const __m128i greenMask = _mm_set1_epi32(0x1f << SignificantBits);
+    const __m128i blueMask = _mm_set1_epi32(0x1f);
+    const __m128i alphaLimit = _mm_set1_epi32(124);
+    for(; x + 4 <= end; x += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x));
+        __m128i index = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16 + Shift - 2 * SignificantBits), redMask),
+                        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 8 + Shift - SignificantBits), greenMask),
+                                     _mm_and_si128(_mm_srli_epi32(pixels, Shift), blueMask)));
+        __m128i opaque = _mm_cmpgt_epi32(_mm_srli_epi32(pixels, 24), alphaLimit);
+
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(opaque));
+        if(mask == 0) {
+            continue;
+        }
+        int indices[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), index);
+        for(int i = 0; i < 4; i++) {
+            if(mask & (1 << i)) {
+                data[indices[i]] += sign;
+                if(weighted != nullptr) {
+                    weighted[indices[i]] += weight;
+                }
+                counted++;
+            }
+        }
+    }
+#endif
+
+    for(; x < end; x++) {
+        QRgb pixel = line[x];
+        if(qAlpha(pixel) < 125) {
+            continue;
+        }
+        int index = binIndex(qRed(pixel) >> Shift, qGreen(pixel) >> Shift, qBlue(pixel) >> Shift);
+        data[index] += sign;
+        if(weighted != nullptr) {
+            weighted[index] += weight;
+        }
+        counted++;
+    }
+    return counted;
+}
+
+/**
+ * @brief ColorHistogram::addRow64
+ * @param line an RGBA64 row, every pixel is r, g, b, a in 16 bits from the lowest.
+ * @param x the first pixel.
+ * @param end the pixel after the last one.
+ * @param sign 1 to add the pixels, -1 to remove them.
+ * @param weighted the bins of a second histogram the pixels are also added to, or nullptr.
+ * @param weight what every pixel adds to the second histogram.
+ * @return the number of pixels counted.
+ *
+ * The same alpha limit as the 8-bit rows: the top 8 bits of alpha at least 125.
+ */
+qint64 ColorHistogram::addRow64(const quint64 *line, int x, int end, int sign, quint32 *weighted, int weight)
+{
+    quint32 *data = bins.data();
+    qint64 counted = 0;
+    const int wideShift = 16 - SignificantBits;
+
+#if defined(__SSE2__)
+    /*
+     * 4 pixels in two registers: the channels are reduced to 5 bits in their 16-bit lanes and
+     * multiplied by their place in the bin index, madd sums r and g, the b and a pairs are added
+     * after the even and odd lanes are split.
+     */
+    const __m128i places = _mm_setr_epi16(1 << (2 * SignificantBits), 1 << SignificantBits, 1, 0,
+                                          1 << (2 * SignificantBits), 1 << SignificantBits, 1, 0);
+    const __m128i alphaLimit = _mm_set1_epi32(125 * 256 - 1);
+    for(; x + 4 <= end; x += 4) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x + 2));
+
+        __m128 alphas = _mm_shuffle_ps(_mm_castsi128_ps(_mm_srli_epi64(first, 48)),
+                                       _mm_castsi128_ps(_mm_srli_epi64(second, 48)), _MM_SHUFFLE(2, 0, 2, 0));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_castps_si128(alphas), alphaLimit)));
+        if(mask == 0) {
+            continue;
+        }
+
+        __m128 sumsFirst = _mm_castsi128_ps(_mm_madd_epi16(_mm_srli_epi16(first, wideShift), places));
+        __m128 sumsSecond = _mm_castsi128_ps(_mm_madd_epi16(_mm_srli_epi16(second, wideShift), places));
+        __m128i index = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sumsFirst, sumsSecond, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm_castps_si128(_mm_shuffle_ps(sumsFirst, sumsSecond, _MM_SHUFFLE(3, 1, 3, 1))));
+
+        int indices[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), index);
+        for(int i = 0; i < 4; i++) {
+            if(mask & (1 << i)) {
+                data[indices[i]] += sign;
+                if(weighted != nullptr) {
+                    weighted[indices[i]] += weight;
+                }
+                counted++;
+            }
+        }
+    }
+#endif
+
+    for(; x < end; x++) {
+        quint64 pixel = line[x];
+        if((pixel >> 56) < 125) {
+            continue;
+        }
+        int index = binIndex(int(pixel & 0xffff) >> wideShift, int((pixel >> 16) & 0xffff) >> wideShift,
+                             int((pixel >> 32) & 0xffff) >> wideShift);
+        data[index] += sign;
+        if(weighted != nullptr) {
+            weighted[index] += weight;
+        }
+        counted++;
+    }
+    return counted;
+}
+
+void ColorHistogram::merge(const ColorHistogram &other)
+{
+    quint32 *data = bins.data();
+    const quint32 *otherData = other.bins.constData();
+    for(int i = 0; i < BinCount; i++) {
+        data[i] += otherData[i];
+    }
+    pixelCount += other.pixelCount;
+}
+
+HistogramAccumulator::HistogramAccumulator()
+    : bins(ColorHistogram::BinCount, 0)
+{
+}
+
+void HistogramAccumulator::add(const ColorHistogram &histogram)
+{
+    quint64 *data = bins.data();
+    const quint32 *other = histogram.bins.constData();
+    for(int i = 0; i < ColorHistogram::BinCount; i++) {
+        data[i] += other[i];
+    }
+}
+
+void HistogramAccumulator::clear()
+{
+    bins.fill(0);
+}
+
+/**
+ * @brief HistogramAccumulator::toHistogram
+ * @return the sum, halved as many times as needed to fit in 32-bit bins.
+ *
+ * Every bin is divided by the same power of two, so the proportions MMCQ cuts on are kept. A
+ * color seen at all keeps a count of at least 1.
+ */
+ColorHistogram HistogramAccumulator::toHistogram() const
+{
+    quint64 largest = 0;
+    for(int i = 0; i < ColorHistogram::BinCount; i++) {
+        largest = qMax(largest, bins[i]);
+    }
+    int shift = 0;
+    while((largest >> shift) > quint64(0xffffffffu)) {
+        shift++;
+    }
+
+    ColorHistogram histogram;
+    for(int i = 0; i < ColorHistogram::BinCount; i++) {
+        if(bins[i] > 0) {
+            histogram.bins[i] = quint32(qMax(quint64(1), bins[i] >> shift));
+            histogram.pixelCount += histogram.bins[i];
+        }
+    }
+    return histogram;
+}
+
+/**
+ * @brief quantizeHistogram
+ * @param histogram the reduced color histogram of an image.
+ * @param colorCount the wanted palette size.
+ * @param mode the color space the histogram is cut in.
+ * @return the main colors, the most common first. It may be shorter than colorCount if the
+ * image has few colors.
+ *
+ * MMCQ (Modified Median Cut Quantization).
+ */
+QVector<QColor> quantizeHistogram(const ColorHistogram &histogram, int colorCount, QuantizeMode mode)
+{
+    QVector<QColor> colors;
+    if(histogram.isEmpty() || colorCount <= 0) {
+        return colors;
+    }
+    if(mode == PerceptualQuantize) {
+        return quantizePerceptual(histogram, colorCount);
+    }
+
+    VBox whole;
+    for(int i = 0; i < 3; i++) {
+        whole.lo[i] = ColorHistogram::SideLength;
+        whole.hi[i] = -1;
+    }
+    for(int r = 0; r < ColorHistogram::SideLength; r++) {
+        for(int g = 0; g < ColorHistogram::SideLength; g++) {
+            for(int b = 0; b < ColorHistogram::SideLength; b++) {
+                if(histogram.count(ColorHistogram::binIndex(r, g, b)) == 0) {
+                    continue;
+                }
+                int c[3] = {r, g, b};
+                for(int i = 0; i < 3; i++) {
+                    whole.lo[i] = qMin(whole.lo[i], c[i]);
+                    whole.hi[i] = qMax(whole.hi[i], c[i]);
+                }
+            }
+        }
+    }
+    whole.count = boxCount(histogram, whole);
+
+    QVector<VBox> boxes;
+    boxes.push_back(whole);
+    splitBoxes(histogram, boxes, qMax(1, colorCount * 3 / 4), false);
+    splitBoxes(histogram, boxes, colorCount, true);
+
+    std::sort(boxes.begin(), boxes.end(), boxCountGreater);
+    for(int i = 0; i < boxes.size(); i++) {
+        if(boxes[i].count > 0) {
+            colors.push_back(boxAverage(histogram, boxes[i]));
+        }
+    }
+
+    return colors;
+}
+
+/**
+ * @brief computePalette
+ * @param image the source image.
+ * @param colorCount the wanted palette size.
+ * @param mode the color space the histogram is cut in.
+ * @param weighting how much every pixel counts.
+ * @return the main colors of the image.
+ */
+QVector<QColor> computePalette(const QImage &image, int colorCount, QuantizeMode mode, PixelWeighting weighting)
+{
+    ColorHistogram histogram;
+    if(weighting == SaliencyWeighting) {
+        ColorHistogram weighted;
+        histogram.add(image, computeSaliency(image), weighted);
+        return quantizeHistogram(weighted, colorCount, mode);
+    }
+    histogram.add(image);
+
+    return quantizeHistogram(histogram, colorCount, mode);
+}
+
+/**
+ * @brief computeFramePalettes
+ * @param frames the frames (or pages) of an image.
+ * @param colorCount the wanted palette size.
+ * @param mode the color space the histograms are cut in.
+ * @param weighting how much every pixel counts.
+ * @return the palette of every frame and the palette of all frames.
+ *
+ * The frames are analysed in parallel and their histograms merged in frame order as soon as
+ * they are done. The frame histograms are kept (128 KB each), so the statistics of a frame
+ * don't count its pixels again.
+ */
+FramePalettes computeFramePalettes(const QVector<QImage> &frames, int colorCount, QuantizeMode mode,
+                                   PixelWeighting weighting)
+{
+    FrameWorker worker;
+    worker.colorCount = colorCount;
+    worker.mode = mode;
+    worker.weighting = weighting;
+
+    FramePalettes result;
+    if(frames.size() == 1) {
+        FrameAnalysis analysis = worker(frames.first());
+        result.histogram = analysis.histogram;
+        result.weightedHistogram = analysis.weightedHistogram;
+        result.framePalettes.push_back(analysis.palette);
+        result.globalPalette = analysis.palette;
+    }
+    else if(frames.size() > 1) {
+        result = QtConcurrent::blockingMappedReduced<FramePalettes>(frames, worker, mergeFrameAnalysis,
+                                                                    QtConcurrent::OrderedReduce);
+        const ColorHistogram &source = weighting == SaliencyWeighting ? result.weightedHistogram : result.histogram;
+        result.globalPalette = quantizeHistogram(source, colorCount, mode);
+    }
+
+    return result;
+}
+
+/**
+ * @brief computeFilePalette
+ * @param fileName the image file.
+ * @param colorCount the number of colors.
+ * @return the palette of the image, empty if the file can't be read.
+ *
+ * The palette of a file of an indexed or archived tree, computed on a thumbnail of the image.
+ */
+QVector<QColor> computeFilePalette(const QString &fileName, int colorCount)
+{
+    QImage image = readImage(fileName);
+    if(image.isNull()) {
+        return QVector<QColor>();
+    }
+    return computePalette(makeThumbnail(image, AnalysisSide), colorCount);
+}
+
+/**
+ * @brief smoothPalette
+ * @param previous the smoothed palette of the frame before.
+ * @param current the palette of this frame.
+ * @param strength 0 shows current as is, close to 1 changes the colors slowly.
+ * @return the palette to show for this frame.
+ *
+ * Every color of the previous palette is paired with the nearest color of the current one
+ * (closest pairs first), and moved toward it in OKLab. The colors keep their place, so a swatch
+ * only changes when its color really changes. Colors without a pair are added at the end. When
+ * the palettes are far apart the shot changed, and the current palette is shown as is.
+ */
+QVector<QColor> smoothPalette(const QVector<QColor> &previous, const QVector<QColor> &current, double strength)
+{
+    if(previous.isEmpty() || current.isEmpty() || strength <= 0.0) {
+        return current;
+    }
+
+    QVector<OkLab> before(previous.size()), after(current.size());
+    for(int i = 0; i < previous.size(); i++) {
+        before[i] = rgbToOkLab(previous[i].rgb());
+    }
+    for(int j = 0; j < current.size(); j++) {
+        after[j] = rgbToOkLab(current[j].rgb());
+    }
+
+    QVector<int> pairOf(previous.size(), -1);
+    QVector<bool> paired(current.size(), false);
+    int pairCount = qMin(previous.size(), current.size());
+    float totalDistance = 0.0f;
+    for(int n = 0; n < pairCount; n++) {
+        int bestI = -1, bestJ = -1;
+        float best = 0.0f;
+        for(int i = 0; i < previous.size(); i++) {
+            if(pairOf[i] >= 0) {
+                continue;
+            }
+            for(int j = 0; j < current.size(); j++) {
+                if(paired[j]) {
+                    continue;
+                }
+                float d = okLabDistanceSquared(before[i], after[j]);
+                if(bestI < 0 || d < best) {
+                    bestI = i;
+                    bestJ = j;
+                    best = d;
+                }
+            }
+        }
+        pairOf[bestI] = bestJ;
+        paired[bestJ] = true;
+        totalDistance += qSqrt(best);
+    }
+    if(totalDistance / pairCount > SceneCutDistance) {
+        return current;
+    }
+
+    QVector<QColor> result;
+    float keep = float(strength);
+    for(int i = 0; i < previous.size(); i++) {
+        if(pairOf[i] < 0) {
+            continue;
+        }
+        const OkLab &target = after[pairOf[i]];
+        OkLab lab;
+        lab.L = target.L + (before[i].L - target.L) * keep;
+        lab.a = target.a + (before[i].a - target.a) * keep;
+        lab.b = target.b + (before[i].b - target.b) * keep;
+        result.push_back(QColor(okLabToRgb(lab)));
+    }
+    for(int j = 0; j < current.size(); j++) {
+        if(!paired[j]) {
+            result.push_back(current[j]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,112 @@
+#ifndef PALETTEENGINE_H
+#define PALETTEENGINE_H
+
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <QVector>
+
+#include "saliency.h"
+
+// The color index and the palette archive analyse the images of a tree this many at a time, so
+// only one chunk is in memory and the progress is reported as they go.
+const int FileChunkSize = 64;
+
+/*
+ * Every pixel is reduced to 5 significant bits per channel before it is counted, so the
+ * histogram has 32 * 32 * 32 bins. It is the input of the MMCQ quantization and small enough
+ * to be cached and merged cheaply.
+ */
+class ColorHistogram
+{
+public:
+    enum {
+        SignificantBits = 5,
+        Shift = 8 - SignificantBits,
+        SideLength = 1 << SignificantBits,
+        BinCount = 1 << (3 * SignificantBits)
+    };
+
+    ColorHistogram();
+
+    void add(const QImage &image);
+    void add(const QImage &image, const QRect &rect, int sign = 1);
+    void add(const QImage &image, const SaliencyMap &saliency, ColorHistogram &weighted);
+    void merge(const ColorHistogram &other);
+    void clear();
+
+    quint32 count(int index) const;
+    qint64 total() const;
+    bool isEmpty() const;
+
+    static int binIndex(int r, int g, int b);
+private:
+    QVector<quint32> bins;
+    qint64 pixelCount;
+
+    qint64 addRow(const QRgb *line, int x, int end, int sign, quint32 *weighted = 0, int weight = 0);
+    qint64 addRow64(const quint64 *line, int x, int end, int sign, quint32 *weighted = 0, int weight = 0);
+
+    friend class HistogramAccumulator;
+};
+
+/*
+ * Sums the histograms of a long sequence in 64-bit bins. The 32-bit bins of a ColorHistogram
+ * would wrap: a flat 1080p background fills one in about 2000 frames. The sum is scaled down
+ * to 32 bits only when it's quantized.
+ */
+class HistogramAccumulator
+{
+public:
+    HistogramAccumulator();
+
+    void add(const ColorHistogram &histogram);
+    void clear();
+    ColorHistogram toHistogram() const;
+private:
+    QVector<quint64> bins;
+};
+
+/*
+ * RgbQuantize cuts the sRGB cube, PerceptualQuantize cuts the occupied histogram bins in OKLab,
+ * so the palette splits where colors look different rather than where sRGB values differ.
+ */
+enum QuantizeMode {
+    RgbQuantize,
+    PerceptualQuantize
+};
+
+/*
+ * UniformWeighting counts every pixel once. SaliencyWeighting counts a pixel more the more its
+ * part of the image stands out, so a large plain background doesn't take the whole palette.
+ */
+enum PixelWeighting {
+    UniformWeighting,
+    SaliencyWeighting
+};
+
+/*
+ * The palettes of a multi-frame image: one for every frame, and one for all frames together
+ * computed from the merged histogram. The histogram always counts every pixel once, the
+ * weighted histogram is only filled with saliency weighting. The histograms of the frames
+ * (unweighted) are kept for images with several frames, a single frame's is the histogram.
+ */
+struct FramePalettes
+{
+    ColorHistogram histogram;
+    ColorHistogram weightedHistogram;
+    QVector<QColor> globalPalette;
+    QVector<QVector<QColor> > framePalettes;
+    QVector<ColorHistogram> frameHistograms;
+};
+
+QVector<QColor> quantizeHistogram(const ColorHistogram &histogram, int colorCount, QuantizeMode mode = RgbQuantize);
+QVector<QColor> computePalette(const QImage &image, int colorCount, QuantizeMode mode = RgbQuantize,
+                               PixelWeighting weighting = UniformWeighting);
+FramePalettes computeFramePalettes(const QVector<QImage> &frames, int colorCount, QuantizeMode mode = RgbQuantize,
+                                   PixelWeighting weighting = UniformWeighting);
+QVector<QColor> computeFilePalette(const QString &fileName, int colorCount);
+QVector<QColor> smoothPalette(const QVector<QColor> &previous, const QVector<QColor> &current, double strength);
+
+#endif // PALETTEENGINE_H
@@ -0,0 +1,326 @@
+#include "paletteexport.h"
+#include "colorindex.h"
+#include "paletteengine.h"
+#include "perceptualhash.h"
+#include <QDataStream>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+namespace {
+
+// The archive is written in blocks of this size, not once per image.
+const int ArchiveBufferSize = 1 << 20;
+
+const int SwatchLabelHeight = 24;
+
+QJsonArray colorNames(const QVector<QColor> &colors)
+{
+    QJsonArray names;
+    for(int i = 0; i < colors.size(); i++) {
+        names.append(colors[i].name());
+    }
+    return names;
+}
+
+QByteArray encodeText(const QVector<QColor> &colors)
+{
+    QByteArray data;
+    for(int i = 0; i < colors.size(); i++) {
+        data += QString("%1\t%2 %3 %4\n").arg(colors[i].name()).arg(colors[i].red())
+                .arg(colors[i].green()).arg(colors[i].blue()).toUtf8();
+    }
+    return data;
+}
+
+QByteArray encodeJson(const QVector<QColor> &colors, const QString &name)
+{
+    QJsonObject object;
+    object.insert("name", name);
+    object.insert("colors", colorNames(colors));
+    return QJsonDocument(object).toJson();
+}
+
+QByteArray encodeGimp(const QVector<QColor> &colors, const QString &name)
+{
+    QByteArray data = "GIMP Palette\n";
+    data += "Name: " + name.toUtf8() + "\n";
+    data += "Columns: " + QByteArray::number(colors.size()) + "\n#\n";
+    for(int i = 0; i < colors.size(); i++) {
+        data += QString("%1 %2 %3\t%4\n").arg(colors[i].red(), 3).arg(colors[i].green(), 3)
+                .arg(colors[i].blue(), 3).arg(colors[i].name()).toUtf8();
+    }
+    return data;
+}
+
+/*
+ * Adobe Swatch Exchange: a big endian header and one color block per swatch, named by its hex
+ * code, in RGB floats.
+ */
+QByteArray encodeAse(const QVector<QColor> &colors)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::BigEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    out.writeRawData("ASEF", 4);
+    out << quint16(1) << quint16(0) << quint32(colors.size());
+
+    for(int i = 0; i < colors.size(); i++) {
+        QString name = colors[i].name();
+        quint16 nameLength = quint16(name.size() + 1);
+
+        out << quint16(0x0001) << quint32(2 + nameLength * 2 + 4 + 3 * 4 + 2);
+        out << nameLength;
+        for(int c = 0; c < name.size(); c++) {
+            out << quint16(name[c].unicode());
+        }
+        out << quint16(0);
+        out.writeRawData("RGB ", 4);
+        out << float(colors[i].redF()) << float(colors[i].greenF()) << float(colors[i].blueF());
+        out << quint16(2); // a normal color, not a global or spot one
+    }
+
+    return data;
+}
+
+struct ArchiveHasher
+{
+    typedef PerceptualHash result_type;
+
+    QString root;
+
+    PerceptualHash operator()(const QString &path) const
+    {
+        return readPerceptualHash(root + "/" + path);
+    }
+};
+
+struct ArchivePaletteReader
+{
+    typedef QVector<QColor> result_type;
+
+    QString root;
+    int colorCount;
+
+    QVector<QColor> operator()(const QString &path) const
+    {
+        return computeFilePalette(root + "/" + path, colorCount);
+    }
+};
+
+/*
+ * Every image analysed so far: a group of near duplicates is named after its first image and
+ * shares its palette.
+ */
+struct ArchiveGroups
+{
+    NearDuplicateIndex index;
+    QStringList paths;
+    QVector<QJsonArray> colors;
+};
+
+bool writeChunk(QSaveFile &file, QByteArray &buffer, const QStringList &chunk, const ArchiveHasher &hasher,
+                const ArchivePaletteReader &reader, ArchiveGroups &groups, qint64 &written)
+{
+    QVector<PerceptualHash> hashes = QtConcurrent::blockingMapped<QVector<PerceptualHash> >(chunk, hasher);
+
+    QVector<int> sources(chunk.size());
+    QStringList originals;
+    for(int i = 0; i < chunk.size(); i++) {
+        sources[i] = groups.index.find(hashes[i]);
+        if(sources[i] < 0) {
+            sources[i] = groups.paths.size();
+            groups.index.insert(hashes[i], sources[i]);
+            groups.paths.push_back(chunk[i]);
+            groups.colors.push_back(QJsonArray());
+            originals.push_back(chunk[i]);
+        }
+    }
+
+    QVector<QVector<QColor> > palettes = QtConcurrent::blockingMapped<QVector<QVector<QColor> > >(originals, reader);
+    // The groups of this chunk are the last ones, in the order of the originals.
+    for(int i = 0; i < palettes.size(); i++) {
+        groups.colors[groups.colors.size() - palettes.size() + i] = colorNames(palettes[i]);
+    }
+
+    for(int i = 0; i < chunk.size(); i++) {
+        const QJsonArray &colors = groups.colors[sources[i]];
+        if(colors.isEmpty()) {
+            continue;
+        }
+
+        QJsonObject object;
+        object.insert("path", chunk[i]);
+        object.insert("colors", colors);
+        if(groups.paths[sources[i]] != chunk[i]) {
+            object.insert("duplicateOf", groups.paths[sources[i]]);
+        }
+        buffer += QJsonDocument(object).toJson(QJsonDocument::Compact) + "\n";
+        written++;
+        if(buffer.size() >= ArchiveBufferSize) {
+            if(file.write(buffer) != buffer.size()) {
+                return false;
+            }
+            buffer.clear();
+        }
+    }
+    return true;
+}
+
+}
+
+/**
+ * @brief paletteFormatOf
+ * @param fileName the name of the palette file.
+ * @return the format matching the suffix, text if it's unknown.
+ */
+PaletteFormat paletteFormatOf(const QString &fileName)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if(suffix == "json") {
+        return JsonPalette;
+    }
+    if(suffix == "gpl") {
+        return GimpPalette;
+    }
+    if(suffix == "ase") {
+        return AsePalette;
+    }
+    return TextPalette;
+}
+
+/**
+ * @brief encodePalette
+ * @param colors the palette.
+ * @param format the file format.
+ * @param name the palette name, for the formats which have one.
+ * @return the file content.
+ */
+QByteArray encodePalette(const QVector<QColor> &colors, PaletteFormat format, const QString &name)
+{
+    switch(format) {
+    case TextPalette:
+        return encodeText(colors);
+    case JsonPalette:
+        return encodeJson(colors, name);
+    case GimpPalette:
+        return encodeGimp(colors, name);
+    case AsePalette:
+        return encodeAse(colors);
+    }
+    return QByteArray();
+}
+
+/**
+ * @brief savePalette
+ * @param fileName the palette file, its suffix selects the format.
+ * @param colors the palette.
+ * @param name the palette name.
+ * @return whether the file is written.
+ */
+bool savePalette(const QString &fileName, const QVector<QColor> &colors, const QString &name)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QByteArray data = encodePalette(colors, paletteFormatOf(fileName), name);
+    if(file.write(data) != data.size()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+/**
+ * @brief renderSwatches
+ * @param colors the palette.
+ * @param swatchSide the side of every swatch.
+ * @return a row of swatches, with the hex code of every color under it.
+ */
+QImage renderSwatches(const QVector<QColor> &colors, int swatchSide)
+{
+    if(colors.isEmpty() || swatchSide <= 0) {
+        return QImage();
+    }
+
+    QImage image(swatchSide * colors.size(), swatchSide + SwatchLabelHeight, QImage::Format_RGB32);
+    image.fill(Qt::white);
+
+    QPainter painter(&image);
+    for(int i = 0; i < colors.size(); i++) {
+        painter.fillRect(i * swatchSide, 0, swatchSide, swatchSide, colors[i]);
+        painter.setPen(Qt::black);
+        painter.drawText(QRect(i * swatchSide, swatchSide, swatchSide, SwatchLabelHeight), Qt::AlignCenter,
+                         colors[i].name());
+    }
+
+    return image;
+}
+
+/**
+ * @brief exportPaletteArchive
+ * @param rootPath the directory tree of images.
+ * @param fileName the archive file.
+ * @param colorCount the palette size of every image.
+ * @param progress called with the number of images read after every chunk.
+ * @return the number of palettes written, -1 if the archive can't be written.
+ *
+ * The tree is walked while it's exported, the file list is never built. The archive is
+ * written to a temporary file and replaces the old one only once it's complete.
+ * Every image is hashed from a small decode first, and only the first image of a group of near
+ * duplicates is decoded in full and analysed.
+ */
+qint64 exportPaletteArchive(const QString &rootPath, const QString &fileName, int colorCount,
+                            ArchiveProgress progress)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly)) {
+        return -1;
+    }
+
+    QDir rootDir(rootPath);
+    ArchiveHasher hasher;
+    hasher.root = rootDir.absolutePath();
+    ArchivePaletteReader reader;
+    reader.root = hasher.root;
+    reader.colorCount = colorCount;
+    ArchiveGroups groups;
+
+    QByteArray buffer;
+    buffer.reserve(ArchiveBufferSize + ArchiveBufferSize / 4);
+    QStringList chunk;
+    qint64 written = 0;
+    int done = 0;
+
+    QDirIterator it(hasher.root, ColorIndex::imageNameFilters(), QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        chunk.push_back(rootDir.relativeFilePath(it.next()));
+        if(chunk.size() < FileChunkSize && it.hasNext()) {
+            continue;
+        }
+
+        if(!writeChunk(file, buffer, chunk, hasher, reader, groups, written)) {
+            file.cancelWriting();
+            return -1;
+        }
+        done += chunk.size();
+        chunk.clear();
+        if(progress) {
+            progress(done);
+        }
+    }
+
+    if(file.write(buffer) != buffer.size() || !file.commit()) {
+        return -1;
+    }
+    return written;
+}
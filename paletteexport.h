@@ -0,0 +1,36 @@
+#ifndef PALETTEEXPORT_H
+#define PALETTEEXPORT_H
+
+#include <QByteArray>
+#include <QColor>
+#include <QImage>
+#include <QString>
+#include <QVector>
+#include <functional>
+
+enum PaletteFormat {
+    TextPalette,
+    JsonPalette,
+    GimpPalette,
+    AsePalette
+};
+
+PaletteFormat paletteFormatOf(const QString &fileName);
+QByteArray encodePalette(const QVector<QColor> &colors, PaletteFormat format, const QString &name);
+bool savePalette(const QString &fileName, const QVector<QColor> &colors, const QString &name);
+QImage renderSwatches(const QVector<QColor> &colors, int swatchSide);
+
+/*
+ * The palettes of a whole directory tree in one JSON Lines file, one image per line:
+ * {"path":"a/b.png","colors":["#1f2a3b",...]}
+ * A near duplicate of an earlier image (a re-export, a resized copy) gets its palette and
+ * names it: {"path":"a/b-small.jpg","colors":[...],"duplicateOf":"a/b.png"}
+ * Images are read a chunk at a time and the lines go through a fixed size buffer. Only the
+ * hash, the path and the palette of every distinct image are kept until the end.
+ */
+typedef std::function<void(int done)> ArchiveProgress;
+
+qint64 exportPaletteArchive(const QString &rootPath, const QString &fileName, int colorCount,
+                            ArchiveProgress progress = ArchiveProgress());
+
+#endif // PALETTEEXPORT_H
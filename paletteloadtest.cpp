@@ -0,0 +1,154 @@
+#include "paletteloadtest.h"
+#include "paletteserver.h"
+#include <QLocalSocket>
+#include <QDataStream>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <algorithm>
+
+namespace {
+
+const int syntheticSide = 256;
+
+}
+
+PaletteLoadTest::PaletteLoadTest(const QString &serverName, const QStringList &fileNames, int clientCount,
+                                 int requestCount, int colorCount, QObject *parent)
+    : QObject(parent), serverName(serverName), fileNames(fileNames), clientCount(qMax(1, clientCount)),
+      requestCount(qMax(1, requestCount)), colorCount(colorCount), sentTotal(0), errorCount(0)
+{
+    // Without files, every request carries the same generated gradient as raw pixels.
+    if(fileNames.isEmpty()) {
+        syntheticPixels.resize(syntheticSide * syntheticSide * 4);
+        uchar *p = reinterpret_cast<uchar *>(syntheticPixels.data());
+        for(int y = 0; y < syntheticSide; y++) {
+            for(int x = 0; x < syntheticSide; x++) {
+                *p++ = x;
+                *p++ = y;
+                *p++ = (x + y) / 2;
+                *p++ = 0xff;
+            }
+        }
+    }
+}
+
+void PaletteLoadTest::start()
+{
+    latencies.reserve(requestCount);
+    totalTimer.start();
+
+    clients.resize(clientCount);
+    for(int i = 0; i < clientCount; i++) {
+        clients[i].socket = new QLocalSocket(this);
+        clients[i].sent = 0;
+        connect(clients[i].socket, SIGNAL(readyRead()), SLOT(readResponses()));
+        connect(clients[i].socket, SIGNAL(error(QLocalSocket::LocalSocketError)), SLOT(socketError()));
+
+        clients[i].socket->connectToServer(serverName);
+        if(!clients[i].socket->waitForConnected(3000)) {
+            return;
+        }
+        sendRequest(i);
+    }
+}
+
+void PaletteLoadTest::sendRequest(int clientIndex)
+{
+    if(sentTotal >= requestCount) {
+        return;
+    }
+
+    Client &client = clients[clientIndex];
+    QDataStream out(client.socket);
+    out.setVersion(QDataStream::Qt_5_6);
+
+    quint32 id = sentTotal;
+    if(fileNames.isEmpty()) {
+        out << id << quint8(PixelRequest) << qint32(colorCount)
+            << qint32(syntheticSide) << qint32(syntheticSide) << syntheticPixels;
+    }
+    else {
+        out << id << quint8(FileRequest) << qint32(colorCount) << fileNames[sentTotal % fileNames.size()];
+    }
+
+    sentTotal++;
+    client.sent++;
+    client.sentTimer.start();
+}
+
+int PaletteLoadTest::findClient(QObject *socket) const
+{
+    for(int i = 0; i < clients.size(); i++) {
+        if(clients[i].socket == socket) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void PaletteLoadTest::readResponses()
+{
+    int clientIndex = findClient(sender());
+    if(clientIndex < 0) {
+        return;
+    }
+
+    QDataStream in(clients[clientIndex].socket);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    forever {
+        in.startTransaction();
+
+        quint32 id;
+        quint8 status;
+        QVector<QRgb> colors;
+        QString error;
+        in >> id >> status >> colors >> error;
+
+        if(!in.commitTransaction()) {
+            return;
+        }
+
+        latencies.push_back(clients[clientIndex].sentTimer.nsecsElapsed() / 1000);
+        if(status != PaletteOk) {
+            errorCount++;
+        }
+
+        if(latencies.size() == requestCount) {
+            report();
+            return;
+        }
+        sendRequest(clientIndex);
+    }
+}
+
+void PaletteLoadTest::socketError()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    QTextStream err(stderr);
+    err << "Palette server " << serverName << ": " << (socket ? socket->errorString() : QString()) << '\n';
+
+    emit finished(1);
+}
+
+/**
+ * @brief PaletteLoadTest::report
+ *
+ * Print the latency percentiles (in milliseconds) and the throughput of the whole run.
+ */
+void PaletteLoadTest::report()
+{
+    double seconds = totalTimer.nsecsElapsed() / 1e9;
+
+    std::sort(latencies.begin(), latencies.end());
+    qint64 p50 = latencies[(latencies.size() - 1) * 50 / 100];
+    qint64 p99 = latencies[(latencies.size() - 1) * 99 / 100];
+
+    QTextStream out(stdout);
+    out << "requests: " << latencies.size() << ", clients: " << clientCount
+        << ", errors: " << errorCount << '\n';
+    out << "p50: " << p50 / 1000.0 << " ms, p99: " << p99 / 1000.0 << " ms\n";
+    out << "throughput: " << latencies.size() / seconds << " requests/s\n";
+
+    emit finished(errorCount == 0 ? 0 : 1);
+}
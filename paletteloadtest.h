@@ -0,0 +1,50 @@
+#ifndef PALETTELOADTEST_H
+#define PALETTELOADTEST_H
+
+#include <QObject>
+#include <QLocalSocket>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QByteArray>
+
+/*
+ * Open several connections to a running palette server, keep one request in flight on each of
+ * them, and report the latency percentiles and throughput when all requests are answered.
+ */
+class PaletteLoadTest : public QObject
+{
+    Q_OBJECT
+public:
+    PaletteLoadTest(const QString &serverName, const QStringList &fileNames, int clientCount,
+                    int requestCount, int colorCount, QObject *parent = 0);
+
+    void start();
+private:
+    struct Client
+    {
+        QLocalSocket *socket;
+        QElapsedTimer sentTimer;
+        int sent;
+    };
+
+    QString serverName;
+    QStringList fileNames;
+    QByteArray syntheticPixels;
+    int clientCount, requestCount, colorCount;
+    int sentTotal, errorCount;
+    QVector<Client> clients;
+    QVector<qint64> latencies;
+    QElapsedTimer totalTimer;
+
+    void sendRequest(int clientIndex);
+    int findClient(QObject *socket) const;
+    void report();
+private slots:
+    void readResponses();
+    void socketError();
+signals:
+    void finished(int exitCode);
+};
+
+#endif // PALETTELOADTEST_H
@@ -0,0 +1,296 @@
+#include "palettemap.h"
+#include "paletteengine.h"
+#include <QColor>
+#include <QImage>
+#include <QVector>
+#include <QPair>
+#include <QThread>
+#include <QtMath>
+#include <QtConcurrent>
+#include <climits>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const int bayer[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+inline int distance2(QRgb a, int r, int g, int b)
+{
+    int dr = qRed(a) - r;
+    int dg = qGreen(a) - g;
+    int db = qBlue(a) - b;
+    return dr * dr + dg * dg + db * db;
+}
+
+inline int lutIndex(QRgb pixel)
+{
+    return ((pixel >> 9) & 0x7c00) | ((pixel >> 6) & 0x3e0) | ((pixel >> 3) & 0x1f);
+}
+
+/*
+ * Fill the lut entries of one red slice with the palette color nearest to the bin centers.
+ */
+struct LutSlice
+{
+    const QVector<QRgb> *palette;
+    QRgb *lut;
+
+    void operator()(const int &r) const
+    {
+        const int half = 1 << (ColorHistogram::Shift - 1);
+        int red = (r << ColorHistogram::Shift) + half;
+
+        for(int g = 0; g < ColorHistogram::SideLength; g++) {
+            int green = (g << ColorHistogram::Shift) + half;
+            for(int b = 0; b < ColorHistogram::SideLength; b++) {
+                int blue = (b << ColorHistogram::Shift) + half;
+
+                int best = 0, bestDistance = INT_MAX;
+                for(int i = 0; i < palette->size(); i++) {
+                    int d = distance2(palette->at(i), red, green, blue);
+                    if(d < bestDistance) {
+                        best = i;
+                        bestDistance = d;
+                    }
+                }
+                lut[ColorHistogram::binIndex(r, g, b)] = palette->at(best) & 0x00ffffff;
+            }
+        }
+    }
+};
+
+}
+
+InverseColormap::InverseColormap()
+    : ditherSpread(0)
+{
+}
+
+/**
+ * @brief InverseColormap::InverseColormap
+ * @param palette the colors the image will be drawn with.
+ *
+ * Build the 32 * 32 * 32 lookup table, one red slice per task.
+ * The strength of the ordered dithering follows the average gap between the palette colors.
+ */
+InverseColormap::InverseColormap(const QVector<QColor> &palette)
+    : ditherSpread(0)
+{
+    for(int i = 0; i < palette.size(); i++) {
+        this->palette.push_back(palette[i].rgb());
+    }
+    if(this->palette.isEmpty()) {
+        return;
+    }
+
+    lut.resize(ColorHistogram::BinCount);
+
+    QVector<int> slices;
+    for(int r = 0; r < ColorHistogram::SideLength; r++) {
+        slices.push_back(r);
+    }
+    LutSlice slice;
+    slice.palette = &this->palette;
+    slice.lut = lut.data();
+    QtConcurrent::blockingMap(slices, slice);
+
+    double gap = 0.0;
+    for(int i = 0; i < this->palette.size(); i++) {
+        int nearestDistance = INT_MAX;
+        for(int j = 0; j < this->palette.size(); j++) {
+            if(i != j) {
+                QRgb c = this->palette[j];
+                nearestDistance = qMin(nearestDistance, distance2(this->palette[i], qRed(c), qGreen(c), qBlue(c)));
+            }
+        }
+        gap += nearestDistance == INT_MAX ? 0.0 : qSqrt(nearestDistance);
+    }
+    ditherSpread = qBound(8, int(gap / this->palette.size() / 2), 96);
+}
+
+bool InverseColormap::isEmpty() const
+{
+    return lut.isEmpty();
+}
+
+QRgb InverseColormap::nearest(int r, int g, int b) const
+{
+    const int shift = ColorHistogram::Shift;
+    return lut[ColorHistogram::binIndex(r >> shift, g >> shift, b >> shift)];
+}
+
+/**
+ * @brief InverseColormap::remap
+ * @param image the source image.
+ * @param mode the dithering method.
+ * @return the image drawn only with the palette colors. The alpha channel is kept.
+ *
+ * The rows are split into bands which are remapped on the thread pool. Floyd-Steinberg error
+ * diffusion restarts at every band, which isn't visible with bands this high.
+ */
+QImage InverseColormap::remap(const QImage &image, DitherMode mode) const
+{
+    if(isEmpty() || image.isNull()) {
+        return QImage();
+    }
+
+    QImage source = image;
+    if(source.format() != QImage::Format_ARGB32 && source.format() != QImage::Format_RGB32) {
+        source = image.convertToFormat(QImage::Format_ARGB32);
+    }
+    QImage target(source.size(), source.format());
+
+    int bandHeight = qMax(64, source.height() / (QThread::idealThreadCount() * 4) + 1);
+    QVector<QPair<int, int> > bands;
+    for(int top = 0; top < source.height(); top += bandHeight) {
+        bands.push_back(qMakePair(top, qMin(source.height(), top + bandHeight)));
+    }
+
+    Band band;
+    band.colormap = this;
+    band.source = &source;
+    band.target = target.bits();
+    band.targetStride = target.bytesPerLine();
+    band.mode = mode;
+    QtConcurrent::blockingMap(bands, band);
+
+    return target;
+}
+
+void InverseColormap::Band::operator()(const QPair<int, int> &rows) const
+{
+    if(mode == FloydSteinbergDither) {
+        colormap->remapRowsFloydSteinberg(*source, target, targetStride, rows.first, rows.second);
+        return;
+    }
+
+    for(int y = rows.first; y < rows.second; y++) {
+        const QRgb *in = reinterpret_cast<const QRgb *>(source->constScanLine(y));
+        QRgb *out = reinterpret_cast<QRgb *>(target + qptrdiff(y) * targetStride);
+        if(mode == OrderedDither) {
+            colormap->remapRowsOrdered(in, out, source->width(), y);
+        }
+        else {
+            colormap->remapRowsPlain(in, out, source->width());
+        }
+    }
+}
+
+/**
+ * @brief InverseColormap::remapRowsPlain
+ *
+ * The lut index is computed with shifts and masks on several pixels at once. AVX2 also
+ * gathers the lut entries, SSE2 looks them up one by one.
+ */
+void InverseColormap::remapRowsPlain(const QRgb *in, QRgb *out, int width) const
+{
+    const QRgb *table = lut.constData();
+    int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i redMask = _mm256_set1_epi32(0x7c00);
+    const __m256i greenMask = _mm256_set1_epi32(0x3e0);
+    const __m256i blueMask = _mm256_set1_epi32(0x1f);
+    const __m256i alphaMask = _mm256_set1_epi32(0xff000000);
+    for(; x + 8 <= width; x += 8) {
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + x));
+        __m256i index = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(p, 9), redMask),
+                        _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(p, 6), greenMask),
+                                        _mm256_and_si256(_mm256_srli_epi32(p, 3), blueMask)));
+        __m256i color = _mm256_i32gather_epi32(reinterpret_cast<const int *>(table), index, 4);
+        color = _mm256_or_si256(color, _mm256_and_si256(p, alphaMask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), color);
+    }
+#elif defined(__SSE2__)
+    const __m128i redMask = _mm_set1_epi32(0x7c00);
+    const __m128i greenMask = _mm_set1_epi32(0x3e0);
+    const __m128i blueMask = _mm_set1_epi32(0x1f);
+    const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+    for(; x + 4 <= width; x += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + x));
+        __m128i index = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 9), redMask),
+                        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 6), greenMask),
+                                     _mm_and_si128(_mm_srli_epi32(p, 3), blueMask)));
+        int indexes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(indexes), index);
+        __m128i color = _mm_set_epi32(int(table[indexes[3]]), int(table[indexes[2]]),
+                                      int(table[indexes[1]]), int(table[indexes[0]]));
+        color = _mm_or_si128(color, _mm_and_si128(p, alphaMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), color);
+    }
+#endif
+
+    for(; x < width; x++) {
+        out[x] = table[lutIndex(in[x])] | (in[x] & 0xff000000);
+    }
+}
+
+/**
+ * @brief InverseColormap::remapRowsOrdered
+ *
+ * Add the 4 * 4 Bayer threshold, scaled to the gap between palette colors, before the lookup.
+ */
+void InverseColormap::remapRowsOrdered(const QRgb *in, QRgb *out, int width, int y) const
+{
+    const int *row = bayer[y & 3];
+    for(int x = 0; x < width; x++) {
+        int offset = (row[x & 3] * 2 - 15) * ditherSpread / 32;
+        QRgb p = in[x];
+        int r = qBound(0, qRed(p) + offset, 255);
+        int g = qBound(0, qGreen(p) + offset, 255);
+        int b = qBound(0, qBlue(p) + offset, 255);
+        out[x] = nearest(r, g, b) | (p & 0xff000000);
+    }
+}
+
+/**
+ * @brief InverseColormap::remapRowsFloydSteinberg
+ *
+ * Classic error diffusion (7/16, 3/16, 5/16, 1/16) with two rows of error per band.
+ */
+void InverseColormap::remapRowsFloydSteinberg(const QImage &source, uchar *target, int targetStride,
+                                              int top, int bottom) const
+{
+    int width = source.width();
+    QVector<int> errors((width + 2) * 3 * 2, 0);
+    int *current = errors.data();
+    int *next = errors.data() + (width + 2) * 3;
+
+    for(int y = top; y < bottom; y++) {
+        const QRgb *in = reinterpret_cast<const QRgb *>(source.constScanLine(y));
+        QRgb *out = reinterpret_cast<QRgb *>(target + qptrdiff(y) * targetStride);
+
+        for(int x = 0; x < width; x++) {
+            int *e = current + (x + 1) * 3;
+            int r = qBound(0, qRed(in[x]) + e[0] / 16, 255);
+            int g = qBound(0, qGreen(in[x]) + e[1] / 16, 255);
+            int b = qBound(0, qBlue(in[x]) + e[2] / 16, 255);
+
+            QRgb color = nearest(r, g, b);
+            out[x] = color | (in[x] & 0xff000000);
+
+            int diff[3] = {r - qRed(color), g - qGreen(color), b - qBlue(color)};
+            for(int c = 0; c < 3; c++) {
+                e[c + 3] += diff[c] * 7;
+                next[x * 3 + c] += diff[c] * 3;
+                next[(x + 1) * 3 + c] += diff[c] * 5;
+                next[(x + 2) * 3 + c] += diff[c];
+            }
+        }
+
+        qSwap(current, next);
+        memset(next, 0, (width + 2) * 3 * sizeof(int));
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef PALETTEMAP_H
+#define PALETTEMAP_H
+
+#include <QColor>
+#include <QImage>
+#include <QVector>
+#include <QPair>
+
+enum DitherMode {
+    NoDither,
+    OrderedDither,
+    FloydSteinbergDither
+};
+
+/*
+ * An inverse colormap: for every bin of the 32 * 32 * 32 reduced color space it stores the
+ * nearest palette color, so mapping a pixel to the palette is a single table lookup.
+ */
+class InverseColormap
+{
+public:
+    InverseColormap();
+    explicit InverseColormap(const QVector<QColor> &palette);
+
+    bool isEmpty() const;
+    QRgb nearest(int r, int g, int b) const;
+    QImage remap(const QImage &image, DitherMode mode) const;
+private:
+    QVector<QRgb> palette;
+    QVector<QRgb> lut;
+    int ditherSpread;
+
+    struct Band
+    {
+        const InverseColormap *colormap;
+        const QImage *source;
+        uchar *target;
+        int targetStride;
+        DitherMode mode;
+
+        void operator()(const QPair<int, int> &rows) const;
+    };
+
+    void remapRowsPlain(const QRgb *in, QRgb *out, int width) const;
+    void remapRowsOrdered(const QRgb *in, QRgb *out, int width, int y) const;
+    void remapRowsFloydSteinberg(const QImage &source, uchar *target, int targetStride, int top, int bottom) const;
+};
+
+#endif // PALETTEMAP_H
@@ -0,0 +1,289 @@
+#include "paletteserver.h"
+#include "paletteengine.h"
+#include "imageloader.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QHash>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+namespace {
+
+/*
+ * The function object run by QtConcurrent::mapped on the worker pool.
+ */
+struct PaletteWorker
+{
+    typedef PaletteResult result_type;
+
+    HistogramCache *cache;
+
+    PaletteResult operator()(const PaletteJob &job) const
+    {
+        PaletteResult result;
+        ColorHistogram histogram;
+
+        if(job.cacheKey.isEmpty() || !cache->find(job.cacheKey, histogram)) {
+            if(job.fileName.isEmpty()) {
+                histogram.add(job.pixels);
+            }
+            else {
+                QImage image = readImage(job.fileName);
+                if(image.isNull()) {
+                    result.error = QString("Can't read image %1").arg(job.fileName);
+                    return result;
+                }
+                histogram.add(image);
+            }
+            if(!job.cacheKey.isEmpty()) {
+                cache->insert(job.cacheKey, histogram);
+            }
+        }
+
+        QVector<QColor> colors = quantizeHistogram(histogram, job.colorCount);
+        for(int i = 0; i < colors.size(); i++) {
+            result.colors.push_back(colors[i].rgb());
+        }
+        return result;
+    }
+};
+
+}
+
+HistogramCache::HistogramCache(int maxCostKb)
+{
+    cache.setMaxCost(maxCostKb);
+}
+
+bool HistogramCache::find(const QString &key, ColorHistogram &histogram)
+{
+    QMutexLocker locker(&mutex);
+    ColorHistogram *cached = cache.object(key);
+    if(cached == nullptr) {
+        return false;
+    }
+    histogram = *cached;
+    return true;
+}
+
+void HistogramCache::insert(const QString &key, const ColorHistogram &histogram)
+{
+    QMutexLocker locker(&mutex);
+    cache.insert(key, new ColorHistogram(histogram), ColorHistogram::BinCount * sizeof(quint32) / 1024);
+}
+
+PaletteServer::PaletteServer(QObject *parent) : QObject(parent)
+{
+    server = new QLocalServer(this);
+    connect(server, SIGNAL(newConnection()), SLOT(acceptConnection()));
+
+    /*
+     * Requests arriving within the same couple of milliseconds are collected and handed to
+     * the worker pool together, so identical requests are computed only once.
+     */
+    batchTimer = new QTimer(this);
+    batchTimer->setSingleShot(true);
+    batchTimer->setInterval(2);
+    connect(batchTimer, SIGNAL(timeout()), SLOT(flushBatch()));
+}
+
+PaletteServer::~PaletteServer()
+{
+    for(int i = 0; i < runningBatches.size(); i++) {
+        runningBatches[i].watcher->waitForFinished();
+    }
+}
+
+/**
+ * @brief PaletteServer::listen
+ * @param name the local socket name.
+ * @return whether the server is listening.
+ *
+ * A stale socket left by a crashed daemon is removed first.
+ */
+bool PaletteServer::listen(const QString &name)
+{
+    QLocalServer::removeServer(name);
+    return server->listen(name);
+}
+
+QString PaletteServer::errorString() const
+{
+    return server->errorString();
+}
+
+void PaletteServer::acceptConnection()
+{
+    while(server->hasPendingConnections()) {
+        QLocalSocket *socket = server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), SLOT(readRequests()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+/**
+ * @brief PaletteServer::readRequests
+ *
+ * Read every complete request in the socket buffer. A request which is only partly received
+ * is left in the buffer until the next readyRead.
+ */
+void PaletteServer::readRequests()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    if(socket == nullptr) {
+        return;
+    }
+
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    forever {
+        in.startTransaction();
+
+        quint32 id;
+        quint8 kind;
+        qint32 colorCount;
+        QString fileName;
+        qint32 width = 0, height = 0;
+        QByteArray pixels;
+
+        in >> id >> kind >> colorCount;
+        if(kind == FileRequest) {
+            in >> fileName;
+        }
+        else {
+            in >> width >> height >> pixels;
+        }
+
+        if(!in.commitTransaction()) {
+            return;
+        }
+
+        PaletteJob job;
+        job.colorCount = qBound(1, int(colorCount), 256);
+
+        if(kind == FileRequest) {
+            QFileInfo fi(fileName);
+            job.fileName = fi.absoluteFilePath();
+            job.cacheKey = job.fileName + "|" + QString::number(fi.lastModified().toMSecsSinceEpoch())
+                         + "|" + QString::number(fi.size());
+            job.key = job.cacheKey + "#" + QString::number(job.colorCount);
+        }
+        else {
+            if(width <= 0 || height <= 0 || pixels.size() < qint64(width) * height * 4) {
+                PendingReply reply = {socket, id, QString()};
+                PaletteResult result;
+                result.error = "Pixel buffer doesn't match its size";
+                sendReply(reply, result);
+                continue;
+            }
+            job.pixels = QImage(reinterpret_cast<const uchar *>(pixels.constData()), width, height,
+                                width * 4, QImage::Format_RGBA8888).convertToFormat(QImage::Format_ARGB32);
+            job.key = QString("pixels:%1:%2").arg(id).arg(quintptr(socket));
+        }
+
+        PendingReply reply = {socket, id, job.key};
+        pendingReplies.push_back(reply);
+        pendingJobs.push_back(job);
+
+        if(!batchTimer->isActive()) {
+            batchTimer->start();
+        }
+    }
+}
+
+/**
+ * @brief PaletteServer::flushBatch
+ *
+ * Hand the collected requests to the worker pool. Requests for the same file and palette
+ * size share one job.
+ */
+void PaletteServer::flushBatch()
+{
+    if(pendingJobs.empty()) {
+        return;
+    }
+
+    Batch batch;
+    QHash<QString, int> jobIndex;
+    for(int i = 0; i < pendingJobs.size(); i++) {
+        if(!jobIndex.contains(pendingJobs[i].key)) {
+            jobIndex.insert(pendingJobs[i].key, batch.jobs.size());
+            batch.jobs.push_back(pendingJobs[i]);
+        }
+    }
+    batch.replies = pendingReplies;
+    pendingJobs.clear();
+    pendingReplies.clear();
+
+    PaletteWorker worker;
+    worker.cache = &histogramCache;
+
+    batch.watcher = new QFutureWatcher<PaletteResult>(this);
+    connect(batch.watcher, SIGNAL(resultReadyAt(int)), SLOT(sendBatchResult(int)));
+    connect(batch.watcher, SIGNAL(finished()), SLOT(finishBatch()));
+    runningBatches.push_back(batch);
+
+    runningBatches.last().watcher->setFuture(QtConcurrent::mapped(runningBatches.last().jobs, worker));
+}
+
+int PaletteServer::findBatch(QObject *watcher) const
+{
+    for(int i = 0; i < runningBatches.size(); i++) {
+        if(runningBatches[i].watcher == watcher) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief PaletteServer::sendBatchResult
+ * @param index the job index in the batch.
+ *
+ * Answer every request waiting for the job as soon as it's done, not when the whole batch is.
+ */
+void PaletteServer::sendBatchResult(int index)
+{
+    int batchIndex = findBatch(sender());
+    if(batchIndex < 0) {
+        return;
+    }
+
+    Batch &batch = runningBatches[batchIndex];
+    PaletteResult result = batch.watcher->resultAt(index);
+    const QString &key = batch.jobs[index].key;
+
+    for(int i = 0; i < batch.replies.size(); i++) {
+        if(batch.replies[i].key == key) {
+            sendReply(batch.replies[i], result);
+        }
+    }
+}
+
+void PaletteServer::finishBatch()
+{
+    int batchIndex = findBatch(sender());
+    if(batchIndex < 0) {
+        return;
+    }
+
+    runningBatches[batchIndex].watcher->deleteLater();
+    runningBatches.removeAt(batchIndex);
+}
+
+void PaletteServer::sendReply(const PendingReply &reply, const PaletteResult &result)
+{
+    if(reply.socket.isNull()) {
+        return;
+    }
+
+    QDataStream out(reply.socket.data());
+    out.setVersion(QDataStream::Qt_5_6);
+
+    quint8 status = result.error.isEmpty() ? PaletteOk : PaletteError;
+    out << reply.id << status << result.colors << result.error;
+}
@@ -0,0 +1,110 @@
+#ifndef PALETTESERVER_H
+#define PALETTESERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QFutureWatcher>
+#include <QCache>
+#include <QMutex>
+#include <QImage>
+#include <QVector>
+#include <QList>
+#include <QTimer>
+
+#include "paletteengine.h"
+
+#define PALETTE_SERVER_NAME "mypaint-palette"
+
+/*
+ * Wire format, every field written with QDataStream (Qt_5_6):
+ *
+ * request:  quint32 id, quint8 kind, qint32 colorCount,
+ *           then QString fileName (kind == FileRequest)
+ *           or qint32 width, qint32 height, QByteArray pixels in RGBA8888 (kind == PixelRequest)
+ * response: quint32 id, quint8 status, QVector<QRgb> colors, QString error
+ */
+enum PaletteRequestKind {
+    FileRequest = 0,
+    PixelRequest = 1
+};
+
+enum PaletteResponseStatus {
+    PaletteOk = 0,
+    PaletteError = 1
+};
+
+struct PaletteJob
+{
+    QString key;
+    QString cacheKey;
+    QString fileName;
+    QImage pixels;
+    int colorCount;
+};
+
+struct PaletteResult
+{
+    QVector<QRgb> colors;
+    QString error;
+};
+
+/*
+ * Decoding an image costs far more than quantizing it, so the histograms of files are kept
+ * between requests. It's shared by the worker threads.
+ */
+class HistogramCache
+{
+public:
+    explicit HistogramCache(int maxCostKb = 64 * 1024);
+
+    bool find(const QString &key, ColorHistogram &histogram);
+    void insert(const QString &key, const ColorHistogram &histogram);
+private:
+    QMutex mutex;
+    QCache<QString, ColorHistogram> cache;
+};
+
+class PaletteServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PaletteServer(QObject *parent = 0);
+    ~PaletteServer();
+
+    bool listen(const QString &name);
+    QString errorString() const;
+private:
+    struct PendingReply
+    {
+        QPointer<QLocalSocket> socket;
+        quint32 id;
+        QString key;
+    };
+
+    struct Batch
+    {
+        QFutureWatcher<PaletteResult> *watcher;
+        QVector<PaletteJob> jobs;
+        QList<PendingReply> replies;
+    };
+
+    QLocalServer *server;
+    QTimer *batchTimer;
+    QVector<PaletteJob> pendingJobs;
+    QList<PendingReply> pendingReplies;
+    QList<Batch> runningBatches;
+    HistogramCache histogramCache;
+
+    void sendReply(const PendingReply &reply, const PaletteResult &result);
+    int findBatch(QObject *watcher) const;
+private slots:
+    void acceptConnection();
+    void readRequests();
+    void flushBatch();
+    void sendBatchResult(int index);
+    void finishBatch();
+};
+
+#endif // PALETTESERVER_H
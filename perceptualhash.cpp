@@ -0,0 +1,233 @@
+#include "perceptualhash.h"
+#include "imageloader.h"
+#include "resampler.h"
+#include "oklab.h"
+#include <QtAlgorithms>
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+// The hash is computed on a HashSide * HashSide gray copy, from its HashFrequencies *
+// HashFrequencies lowest frequencies after the DC one.
+const int HashSide = 32;
+const int HashFrequencies = 8;
+
+// A bit is set when its coefficient is above the median by this much, so a flat image hashes to
+// 0 and not to rounding noise.
+const float MedianMargin = 0.01f;
+
+// Decoders which can scale while decoding (JPEG) only decode this much of a file to hash it.
+const int HashDecodeSide = 64;
+
+// Up to this many different bits, two images are the same picture.
+const int NearDuplicateDistance = 6;
+
+// And their average colors must be this close in OKLab.
+const float MaxAverageDistance = 0.03f;
+
+/*
+ * cos((2x + 1) * u * pi / (2 * HashSide)) for the frequencies u used by the hash.
+ */
+struct DctTable
+{
+    float values[HashFrequencies + 1][HashSide];
+
+    DctTable()
+    {
+        for(int u = 0; u <= HashFrequencies; u++) {
+            for(int x = 0; x < HashSide; x++) {
+                values[u][x] = float(qCos((2 * x + 1) * u * M_PI / (2 * HashSide)));
+            }
+        }
+    }
+};
+
+}
+
+/**
+ * @brief computePerceptualHash
+ * @param image the image, in any format.
+ * @return its hash, not valid if the image is null.
+ *
+ * The image is area averaged to 32 * 32, and only the 8 * 8 lowest frequencies of its DCT are
+ * computed, rows first, then columns. The DC term is left out: it's the brightness, which the
+ * average color already covers.
+ */
+PerceptualHash computePerceptualHash(const QImage &image)
+{
+    PerceptualHash hash = {0, 0, false};
+    if(image.isNull()) {
+        return hash;
+    }
+
+    static const DctTable table;
+
+    QImage small = resampleImage(image, QSize(HashSide, HashSide), BoxFilter);
+    float luma[HashSide][HashSide];
+    qint64 red = 0, green = 0, blue = 0;
+    for(int y = 0; y < HashSide; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(small.constScanLine(y));
+        for(int x = 0; x < HashSide; x++) {
+            luma[y][x] = 0.299f * qRed(line[x]) + 0.587f * qGreen(line[x]) + 0.114f * qBlue(line[x]);
+            red += qRed(line[x]);
+            green += qGreen(line[x]);
+            blue += qBlue(line[x]);
+        }
+    }
+    const int pixels = HashSide * HashSide;
+    hash.average = qRgb(int(red / pixels), int(green / pixels), int(blue / pixels));
+
+    float rows[HashSide][HashFrequencies];
+    for(int y = 0; y < HashSide; y++) {
+        for(int u = 0; u < HashFrequencies; u++) {
+            float sum = 0.0f;
+            for(int x = 0; x < HashSide; x++) {
+                sum += luma[y][x] * table.values[u + 1][x];
+            }
+            rows[y][u] = sum;
+        }
+    }
+
+    float coefficients[HashFrequencies * HashFrequencies];
+    for(int v = 0; v < HashFrequencies; v++) {
+        for(int u = 0; u < HashFrequencies; u++) {
+            float sum = 0.0f;
+            for(int y = 0; y < HashSide; y++) {
+                sum += rows[y][u] * table.values[v + 1][y];
+            }
+            coefficients[v * HashFrequencies + u] = sum;
+        }
+    }
+
+    float sorted[HashFrequencies * HashFrequencies];
+    std::copy(coefficients, coefficients + HashFrequencies * HashFrequencies, sorted);
+    float *middle = sorted + HashFrequencies * HashFrequencies / 2;
+    std::nth_element(sorted, middle, sorted + HashFrequencies * HashFrequencies);
+    float median = *middle;
+
+    for(int i = 0; i < HashFrequencies * HashFrequencies; i++) {
+        if(coefficients[i] > median + MedianMargin) {
+            hash.bits |= Q_UINT64_C(1) << i;
+        }
+    }
+    hash.valid = true;
+    return hash;
+}
+
+/**
+ * @brief readPerceptualHash
+ * @param fileName the image file name.
+ * @return the hash of its first frame, not valid if it can't be read.
+ *
+ * The file goes through the same decoder as the open images (orientation, color profile), but
+ * asks for a small copy: a JPEG is then decoded at 1/8 of its size, a small part of the cost
+ * of a full decode.
+ */
+PerceptualHash readPerceptualHash(const QString &fileName)
+{
+    return computePerceptualHash(readImageScaled(fileName, HashDecodeSide));
+}
+
+int hammingDistance(quint64 first, quint64 second)
+{
+    return int(qPopulationCount(first ^ second));
+}
+
+bool isNearDuplicate(const PerceptualHash &first, const PerceptualHash &second)
+{
+    if(!first.valid || !second.valid || hammingDistance(first.bits, second.bits) > NearDuplicateDistance) {
+        return false;
+    }
+    return okLabDistanceSquared(rgbToOkLab(first.average), rgbToOkLab(second.average))
+            <= MaxAverageDistance * MaxAverageDistance;
+}
+
+NearDuplicateIndex::NearDuplicateIndex()
+{
+}
+
+/**
+ * @brief NearDuplicateIndex::insert
+ * @param hash a valid hash.
+ * @param id what find() returns for it.
+ */
+void NearDuplicateIndex::insert(const PerceptualHash &hash, int id)
+{
+    if(!hash.valid) {
+        return;
+    }
+
+    int position = hashes.size();
+    hashes.push_back(hash);
+    ids.push_back(id);
+    for(int block = 0; block < Blocks; block++) {
+        tables[block].insert(quint16(hash.bits >> (block * BlockBits)), position);
+    }
+}
+
+/**
+ * @brief NearDuplicateIndex::find
+ * @param hash the hash to look for.
+ * @return the id of the closest near duplicate, or -1.
+ *
+ * Every block is looked up with the values within NearDuplicateDistance / Blocks bits of it
+ * (17 lookups for 1 bit), and only the hashes found are compared.
+ */
+int NearDuplicateIndex::find(const PerceptualHash &hash) const
+{
+    if(!hash.valid || hashes.isEmpty()) {
+        return -1;
+    }
+
+    QVector<int> candidates;
+    for(int block = 0; block < Blocks; block++) {
+        probe(block, quint16(hash.bits >> (block * BlockBits)), 0, NearDuplicateDistance / Blocks, candidates);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    int best = -1;
+    int bestDistance = NearDuplicateDistance + 1;
+    for(int i = 0; i < candidates.size(); i++) {
+        const PerceptualHash &candidate = hashes[candidates[i]];
+        int distance = hammingDistance(hash.bits, candidate.bits);
+        if(distance < bestDistance && isNearDuplicate(hash, candidate)) {
+            best = candidates[i];
+            bestDistance = distance;
+        }
+    }
+    return best < 0 ? -1 : ids[best];
+}
+
+int NearDuplicateIndex::size() const
+{
+    return hashes.size();
+}
+
+void NearDuplicateIndex::clear()
+{
+    hashes.clear();
+    ids.clear();
+    for(int block = 0; block < Blocks; block++) {
+        tables[block].clear();
+    }
+}
+
+/*
+ * Collect the hashes whose block is value, or value with up to radius of the bits from bit on
+ * flipped.
+ */
+void NearDuplicateIndex::probe(int block, quint16 value, int bit, int radius, QVector<int> &candidates) const
+{
+    QMultiHash<quint16, int>::const_iterator it = tables[block].constFind(value);
+    for(; it != tables[block].constEnd() && it.key() == value; ++it) {
+        candidates.push_back(it.value());
+    }
+    if(radius == 0) {
+        return;
+    }
+    for(int i = bit; i < BlockBits; i++) {
+        probe(block, quint16(value ^ (1 << i)), i + 1, radius - 1, candidates);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef PERCEPTUALHASH_H
+#define PERCEPTUALHASH_H
+
+#include <QImage>
+#include <QRgb>
+#include <QString>
+#include <QVector>
+#include <QMultiHash>
+
+/*
+ * What an image looks like in 64 bits plus its average color. The bits are the signs of the
+ * lowest frequencies of a 32 * 32 gray copy against their median, so re-encoded, resized or
+ * slightly retouched copies of an image differ in a few bits only. The bits don't see color,
+ * the average tells a recolored copy (or two flat images) apart.
+ */
+struct PerceptualHash
+{
+    quint64 bits;
+    QRgb average;
+    bool valid;
+};
+
+PerceptualHash computePerceptualHash(const QImage &image);
+PerceptualHash readPerceptualHash(const QString &fileName);
+int hammingDistance(quint64 first, quint64 second);
+bool isNearDuplicate(const PerceptualHash &first, const PerceptualHash &second);
+
+/*
+ * Finds the near duplicates of a hash without comparing it with every hash. The 64 bits are cut
+ * in Blocks blocks, one hash table each. Two hashes within NearDuplicateDistance bits have at
+ * least one block within NearDuplicateDistance / Blocks bits (pigeonhole), so only the hashes
+ * sharing such a block are compared.
+ */
+class NearDuplicateIndex
+{
+public:
+    NearDuplicateIndex();
+
+    void insert(const PerceptualHash &hash, int id);
+    int find(const PerceptualHash &hash) const;
+    int size() const;
+    void clear();
+private:
+    enum {
+        Blocks = 4,
+        BlockBits = 16
+    };
+
+    QVector<PerceptualHash> hashes;
+    QVector<int> ids;
+    QMultiHash<quint16, int> tables[Blocks];
+
+    void probe(int block, quint16 value, int bit, int radius, QVector<int> &candidates) const;
+};
+
+#endif // PERCEPTUALHASH_H
@@ -0,0 +1,392 @@
+#include "resampler.h"
+#include <QImage>
+#include <QSize>
+#include <QRect>
+#include <QVector>
+#include <QPair>
+#include <QThread>
+#include <QtMath>
+#include <QtConcurrent>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+double filterSupport(ResampleFilter filter)
+{
+    switch(filter) {
+    case BoxFilter:
+        return 0.5;
+    case BilinearFilter:
+        return 1.0;
+    case Lanczos3Filter:
+        return 3.0;
+    }
+    return 1.0;
+}
+
+double sinc(double x)
+{
+    if(x == 0.0) {
+        return 1.0;
+    }
+    x *= M_PI;
+    return qSin(x) / x;
+}
+
+double filterWeight(ResampleFilter filter, double x)
+{
+    switch(filter) {
+    case BoxFilter:
+        return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+    case BilinearFilter:
+        return qMax(0.0, 1.0 - qAbs(x));
+    case Lanczos3Filter:
+        return qAbs(x) < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+    return 0.0;
+}
+
+/*
+ * Negative lobes of Lanczos may push a premultiplied color above its alpha.
+ */
+inline quint32 clampPremultiplied(quint32 pixel)
+{
+    quint32 alpha = pixel >> 24;
+    if(alpha == 0xff) {
+        return pixel;
+    }
+    quint32 r = qMin((pixel >> 16) & 0xff, alpha);
+    quint32 g = qMin((pixel >> 8) & 0xff, alpha);
+    quint32 b = qMin(pixel & 0xff, alpha);
+    return (alpha << 24) | (r << 16) | (g << 8) | b;
+}
+
+inline quint32 packPixel(const float *channels)
+{
+    quint32 pixel = 0;
+    for(int c = 3; c >= 0; c--) {
+        pixel = (pixel << 8) | quint32(qBound(0, qRound(channels[c]), 255));
+    }
+    return pixel;
+}
+
+/*
+ * Filter one row along x: every target pixel is a weighted sum of neighbouring source pixels.
+ */
+void resampleRow(const quint32 *in, quint32 *out, int width, const ResampleContributions &contributions)
+{
+    for(int x = 0; x < width; x++) {
+        const quint32 *source = in + contributions.starts[x];
+        const float *weights = contributions.weights.constData() + x * contributions.maxTaps;
+        int count = contributions.counts[x];
+
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        __m128 sum = _mm_setzero_ps();
+        for(int k = 0; k < count; k++) {
+            __m128i p = _mm_cvtsi32_si128(int(source[k]));
+            p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(p), _mm_set1_ps(weights[k])));
+        }
+        __m128i value = _mm_cvtps_epi32(sum);
+        value = _mm_packus_epi16(_mm_packs_epi32(value, value), zero);
+        out[x] = clampPremultiplied(quint32(_mm_cvtsi128_si32(value)));
+#else
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(int k = 0; k < count; k++) {
+            for(int c = 0; c < 4; c++) {
+                sum[c] += ((source[k] >> (c * 8)) & 0xff) * weights[k];
+            }
+        }
+        out[x] = clampPremultiplied(packPixel(sum));
+#endif
+    }
+}
+
+/*
+ * Filter along y: the target row is a weighted sum of whole source rows, so the same weight is
+ * applied across the row. AVX2 handles two pixels per step, SSE2 one.
+ */
+void resampleColumn(const QImage &source, int start, int count, const float *weights,
+                    quint32 *out, float *sum)
+{
+    int width = source.width();
+    memset(sum, 0, sizeof(float) * width * 4);
+
+    for(int k = 0; k < count; k++) {
+        const quint32 *in = reinterpret_cast<const quint32 *>(source.constScanLine(start + k));
+        float weight = weights[k];
+        int x = 0;
+
+#if defined(__AVX2__)
+        __m256 w8 = _mm256_set1_ps(weight);
+        for(; x + 2 <= width; x += 2) {
+            __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + x)));
+            __m256 s = _mm256_loadu_ps(sum + x * 4);
+            s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_cvtepi32_ps(p), w8));
+            _mm256_storeu_ps(sum + x * 4, s);
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        __m128 w4 = _mm_set1_ps(weight);
+        for(; x < width; x++) {
+            __m128i p = _mm_cvtsi32_si128(int(in[x]));
+            p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+            __m128 s = _mm_loadu_ps(sum + x * 4);
+            s = _mm_add_ps(s, _mm_mul_ps(_mm_cvtepi32_ps(p), w4));
+            _mm_storeu_ps(sum + x * 4, s);
+        }
+#else
+        for(; x < width; x++) {
+            for(int c = 0; c < 4; c++) {
+                sum[x * 4 + c] += ((in[x] >> (c * 8)) & 0xff) * weight;
+            }
+        }
+#endif
+    }
+
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for(; x < width; x++) {
+        __m128i value = _mm_cvtps_epi32(_mm_loadu_ps(sum + x * 4));
+        value = _mm_packus_epi16(_mm_packs_epi32(value, value), zero);
+        out[x] = clampPremultiplied(quint32(_mm_cvtsi128_si32(value)));
+    }
+#else
+    for(; x < width; x++) {
+        out[x] = clampPremultiplied(packPixel(sum + x * 4));
+    }
+#endif
+}
+
+struct HorizontalPass
+{
+    const QImage *source;
+    QImage *target;
+    const ResampleContributions *contributions;
+
+    void operator()(const QPair<int, int> &rows) const
+    {
+        uchar *bits = target->bits();
+        for(int y = rows.first; y < rows.second; y++) {
+            resampleRow(reinterpret_cast<const quint32 *>(source->constScanLine(y)),
+                        reinterpret_cast<quint32 *>(bits + qptrdiff(y) * target->bytesPerLine()),
+                        target->width(), *contributions);
+        }
+    }
+};
+
+struct VerticalPass
+{
+    const QImage *source;
+    QImage *target;
+    const ResampleContributions *contributions;
+
+    void operator()(const QPair<int, int> &rows) const
+    {
+        QVector<float> sum(source->width() * 4);
+        uchar *bits = target->bits();
+        for(int y = rows.first; y < rows.second; y++) {
+            resampleColumn(*source, contributions->starts[y], contributions->counts[y],
+                           contributions->weights.constData() + y * contributions->maxTaps,
+                           reinterpret_cast<quint32 *>(bits + qptrdiff(y) * target->bytesPerLine()), sum.data());
+        }
+    }
+};
+
+QVector<QPair<int, int> > rowBands(int height)
+{
+    int bandHeight = qMax(16, height / (QThread::idealThreadCount() * 4) + 1);
+    QVector<QPair<int, int> > bands;
+    for(int top = 0; top < height; top += bandHeight) {
+        bands.push_back(qMakePair(top, qMin(height, top + bandHeight)));
+    }
+    return bands;
+}
+
+}
+
+/**
+ * @brief computeContributions
+ * @param sourceSize the source length of the axis.
+ * @param targetSize the target length of the axis.
+ * @param filter the kernel.
+ * @return the source pixels and weights of every target pixel.
+ *
+ * When shrinking, the kernel is stretched by the scale so every source pixel contributes
+ * (box becomes area averaging). When enlarging it's used as is.
+ */
+ResampleContributions computeContributions(int sourceSize, int targetSize, ResampleFilter filter)
+{
+    ResampleContributions contributions;
+
+    double scale = double(sourceSize) / targetSize;
+    double filterScale = qMax(1.0, scale);
+    double support = filterSupport(filter) * filterScale;
+
+    contributions.maxTaps = int(qCeil(support * 2)) + 1;
+    contributions.starts.resize(targetSize);
+    contributions.counts.resize(targetSize);
+    contributions.weights.fill(0.0f, targetSize * contributions.maxTaps);
+
+    for(int i = 0; i < targetSize; i++) {
+        double center = (i + 0.5) * scale;
+        int left = qMax(0, int(qFloor(center - support)));
+        int right = qMin(sourceSize, int(qCeil(center + support)));
+        right = qMin(right, left + contributions.maxTaps);
+
+        float *weights = contributions.weights.data() + i * contributions.maxTaps;
+        double total = 0.0;
+        for(int j = left; j < right; j++) {
+            double w = filterWeight(filter, (j + 0.5 - center) / filterScale);
+            weights[j - left] = w;
+            total += w;
+        }
+
+        if(total == 0.0) {
+            // The kernel fell between two pixels, take the nearest one.
+            left = qBound(0, int(center), sourceSize - 1);
+            right = left + 1;
+            weights[0] = 1.0f;
+            total = 1.0;
+        }
+        for(int j = 0; j < right - left; j++) {
+            weights[j] /= total;
+        }
+
+        contributions.starts[i] = left;
+        contributions.counts[i] = right - left;
+    }
+
+    return contributions;
+}
+
+/**
+ * @brief resampleImage
+ * @param image the source image.
+ * @param size the target size.
+ * @param filter the kernel.
+ * @return the resized image, Format_RGB32 for opaque sources, premultiplied ARGB otherwise.
+ *
+ * Separable: rows are filtered along x into an intermediate image, then along y. Both passes
+ * run on bands of rows in parallel.
+ */
+QImage resampleImage(const QImage &image, const QSize &size, ResampleFilter filter)
+{
+    if(image.isNull() || size.isEmpty()) {
+        return QImage();
+    }
+
+    QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage source = image.convertToFormat(format);
+
+    ResampleContributions horizontal = computeContributions(source.width(), size.width(), filter);
+    ResampleContributions vertical = computeContributions(source.height(), size.height(), filter);
+
+    QImage middle(size.width(), source.height(), format);
+    HorizontalPass horizontalPass;
+    horizontalPass.source = &source;
+    horizontalPass.target = &middle;
+    horizontalPass.contributions = &horizontal;
+    middle.bits();
+    QVector<QPair<int, int> > bands = rowBands(source.height());
+    QtConcurrent::blockingMap(bands, horizontalPass);
+
+    QImage target(size, format);
+    VerticalPass verticalPass;
+    verticalPass.source = &middle;
+    verticalPass.target = &target;
+    verticalPass.contributions = &vertical;
+    target.bits();
+    bands = rowBands(size.height());
+    QtConcurrent::blockingMap(bands, verticalPass);
+
+    return target;
+}
+
+/**
+ * @brief resampleRegion
+ * @param image the source image.
+ * @param size the size of the whole resized image.
+ * @param region the part of the resized image to compute.
+ * @return the pixels of region, the same as resampleImage(image, size, filter) gives there.
+ *
+ * Only the source pixels under the region are filtered, so a small change of a large image is
+ * resampled again for the cost of the change.
+ */
+QImage resampleRegion(const QImage &image, const QSize &size, const QRect &region, ResampleFilter filter)
+{
+    QRect target = region.intersected(QRect(QPoint(0, 0), size));
+    if(image.isNull() || target.isEmpty()) {
+        return QImage();
+    }
+
+    ResampleContributions horizontal = computeContributions(image.width(), size.width(), filter);
+    ResampleContributions vertical = computeContributions(image.height(), size.height(), filter);
+
+    // The source pixels read by the region.
+    int left = image.width(), right = 0;
+    for(int x = target.left(); x <= target.right(); x++) {
+        left = qMin(left, horizontal.starts[x]);
+        right = qMax(right, horizontal.starts[x] + horizontal.counts[x]);
+    }
+    int top = image.height(), bottom = 0;
+    for(int y = target.top(); y <= target.bottom(); y++) {
+        top = qMin(top, vertical.starts[y]);
+        bottom = qMax(bottom, vertical.starts[y] + vertical.counts[y]);
+    }
+
+    QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage source = image.copy(QRect(left, top, right - left, bottom - top)).convertToFormat(format);
+
+    // The contributions of the region's columns, relative to the copied pixels.
+    ResampleContributions columns;
+    columns.maxTaps = horizontal.maxTaps;
+    columns.starts = horizontal.starts.mid(target.left(), target.width());
+    columns.counts = horizontal.counts.mid(target.left(), target.width());
+    columns.weights = horizontal.weights.mid(target.left() * horizontal.maxTaps, target.width() * horizontal.maxTaps);
+    for(int x = 0; x < columns.starts.size(); x++) {
+        columns.starts[x] -= left;
+    }
+
+    QImage middle(target.width(), source.height(), format);
+    for(int y = 0; y < source.height(); y++) {
+        resampleRow(reinterpret_cast<const quint32 *>(source.constScanLine(y)),
+                    reinterpret_cast<quint32 *>(middle.scanLine(y)), middle.width(), columns);
+    }
+
+    QImage result(target.size(), format);
+    QVector<float> sum(middle.width() * 4);
+    for(int y = 0; y < result.height(); y++) {
+        int row = target.top() + y;
+        resampleColumn(middle, vertical.starts[row] - top, vertical.counts[row],
+                       vertical.weights.constData() + row * vertical.maxTaps,
+                       reinterpret_cast<quint32 *>(result.scanLine(y)), sum.data());
+    }
+    return result;
+}
+
+/**
+ * @brief makeThumbnail
+ * @param image the source image.
+ * @param maxSide the length of the longer side of the thumbnail.
+ * @return an area averaged thumbnail, or the image itself if it's small enough.
+ */
+QImage makeThumbnail(const QImage &image, int maxSide)
+{
+    if(image.width() <= maxSide && image.height() <= maxSide) {
+        return image;
+    }
+
+    QSize size = image.size().scaled(maxSide, maxSide, Qt::KeepAspectRatio);
+    return resampleImage(image, size.expandedTo(QSize(1, 1)), BoxFilter);
+}
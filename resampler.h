@@ -0,0 +1,32 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QImage>
+#include <QSize>
+#include <QRect>
+#include <QVector>
+
+enum ResampleFilter {
+    BoxFilter,
+    BilinearFilter,
+    Lanczos3Filter
+};
+
+/*
+ * For every target pixel of one axis: the first source pixel it reads, how many it reads, and
+ * their normalized weights (maxTaps per target pixel).
+ */
+struct ResampleContributions
+{
+    QVector<int> starts;
+    QVector<int> counts;
+    QVector<float> weights;
+    int maxTaps;
+};
+
+ResampleContributions computeContributions(int sourceSize, int targetSize, ResampleFilter filter);
+QImage resampleImage(const QImage &image, const QSize &size, ResampleFilter filter);
+QImage resampleRegion(const QImage &image, const QSize &size, const QRect &region, ResampleFilter filter);
+QImage makeThumbnail(const QImage &image, int maxSide);
+
+#endif // RESAMPLER_H
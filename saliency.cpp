@@ -0,0 +1,186 @@
+#include "saliency.h"
+#include "oklab.h"
+#include <QtMath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Every grid cell is the average of this many samples per side, not of all its pixels.
+const int SamplesPerSide = 4;
+
+// The fine blur only removes noise, the coarse one is the surrounding the cell is compared to.
+const double FineSigma = 1.0;
+const double CoarseSigmaRatio = 0.25;
+
+QVector<float> gaussianKernel(double sigma)
+{
+    int radius = qMax(1, int(qCeil(sigma * 3.0)));
+    QVector<float> kernel(radius * 2 + 1);
+    double total = 0.0;
+    for(int i = -radius; i <= radius; i++) {
+        double w = qExp(-(i * i) / (2.0 * sigma * sigma));
+        kernel[i + radius] = float(w);
+        total += w;
+    }
+    for(int i = 0; i < kernel.size(); i++) {
+        kernel[i] /= float(total);
+    }
+    return kernel;
+}
+
+/*
+ * Separable gaussian blur of a float plane, the edges are extended. Both passes add whole
+ * rows of weighted values, 4 floats per step with SSE2.
+ */
+QVector<float> blurPlane(const QVector<float> &plane, int width, int height, const QVector<float> &kernel)
+{
+    int radius = kernel.size() / 2;
+    QVector<float> padded(width + radius * 2);
+    QVector<float> horizontal(width * height);
+    QVector<float> result(width * height);
+
+    for(int y = 0; y < height; y++) {
+        const float *in = plane.constData() + y * width;
+        for(int x = 0; x < padded.size(); x++) {
+            padded[x] = in[qBound(0, x - radius, width - 1)];
+        }
+
+        float *out = horizontal.data() + y * width;
+        int x = 0;
+#if defined(__SSE2__)
+        for(; x + 4 <= width; x += 4) {
+            __m128 sum = _mm_setzero_ps();
+            for(int k = 0; k < kernel.size(); k++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(padded.constData() + x + k), _mm_set1_ps(kernel[k])));
+            }
+            _mm_storeu_ps(out + x, sum);
+        }
+#endif
+        for(; x < width; x++) {
+            float sum = 0.0f;
+            for(int k = 0; k < kernel.size(); k++) {
+                sum += padded[x + k] * kernel[k];
+            }
+            out[x] = sum;
+        }
+    }
+
+    for(int y = 0; y < height; y++) {
+        float *out = result.data() + y * width;
+        for(int k = 0; k < kernel.size(); k++) {
+            const float *in = horizontal.constData() + qBound(0, y + k - radius, height - 1) * width;
+            float w = kernel[k];
+            int x = 0;
+#if defined(__SSE2__)
+            __m128 w4 = _mm_set1_ps(w);
+            for(; x + 4 <= width; x += 4) {
+                _mm_storeu_ps(out + x, _mm_add_ps(_mm_loadu_ps(out + x), _mm_mul_ps(_mm_loadu_ps(in + x), w4)));
+            }
+#endif
+            for(; x < width; x++) {
+                out[x] += in[x] * w;
+            }
+        }
+    }
+
+    return result;
+}
+
+/*
+ * The average color of every cell, from a few samples spread over it.
+ */
+QVector<QRgb> sampleCells(const QImage &image, int width, int height)
+{
+    bool direct = image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32;
+    QVector<QRgb> cells(width * height);
+
+    for(int cy = 0; cy < height; cy++) {
+        for(int cx = 0; cx < width; cx++) {
+            int sum[3] = {0, 0, 0};
+            for(int sy = 0; sy < SamplesPerSide; sy++) {
+                int y = int((cy + (sy + 0.5) / SamplesPerSide) * image.height() / height);
+                const QRgb *line = direct ? reinterpret_cast<const QRgb *>(image.constScanLine(y)) : nullptr;
+                for(int sx = 0; sx < SamplesPerSide; sx++) {
+                    int x = int((cx + (sx + 0.5) / SamplesPerSide) * image.width() / width);
+                    QRgb pixel = direct ? line[x] : image.pixel(x, y);
+                    sum[0] += qRed(pixel);
+                    sum[1] += qGreen(pixel);
+                    sum[2] += qBlue(pixel);
+                }
+            }
+            const int samples = SamplesPerSide * SamplesPerSide;
+            cells[cy * width + cx] = qRgb(sum[0] / samples, sum[1] / samples, sum[2] / samples);
+        }
+    }
+    return cells;
+}
+
+}
+
+/**
+ * @brief computeSaliency
+ * @param image the source image.
+ * @return the saliency of the cells of a grid at most 128 cells wide or high.
+ *
+ * The image is reduced to the grid and converted to OKLab. The saliency of a cell is the
+ * distance between its color blurred a little (noise removed) and blurred a lot (its
+ * surrounding): a difference of gaussians in every channel. Reading the samples is the only
+ * pass over the image, and it reads 16 pixels per cell.
+ */
+SaliencyMap computeSaliency(const QImage &image)
+{
+    SaliencyMap map;
+    map.width = 0;
+    map.height = 0;
+    if(image.isNull()) {
+        return map;
+    }
+
+    QSize size = image.size().scaled(SaliencyMap::MapSide, SaliencyMap::MapSide, Qt::KeepAspectRatio);
+    size = size.boundedTo(image.size()).expandedTo(QSize(1, 1));
+    map.width = size.width();
+    map.height = size.height();
+    int count = map.width * map.height;
+
+    QVector<QRgb> cells = sampleCells(image, map.width, map.height);
+    QVector<OkLab> labs(count);
+    rgbToOkLab(cells.constData(), count, labs.data());
+
+    QVector<float> planes[3];
+    for(int c = 0; c < 3; c++) {
+        planes[c].resize(count);
+    }
+    for(int i = 0; i < count; i++) {
+        planes[0][i] = labs[i].L;
+        planes[1][i] = labs[i].a;
+        planes[2][i] = labs[i].b;
+    }
+
+    QVector<float> fineKernel = gaussianKernel(FineSigma);
+    QVector<float> coarseKernel = gaussianKernel(qMax(map.width, map.height) * CoarseSigmaRatio);
+    QVector<float> saliency(count, 0.0f);
+    for(int c = 0; c < 3; c++) {
+        QVector<float> fine = blurPlane(planes[c], map.width, map.height, fineKernel);
+        QVector<float> coarse = blurPlane(planes[c], map.width, map.height, coarseKernel);
+        for(int i = 0; i < count; i++) {
+            float d = fine[i] - coarse[i];
+            saliency[i] += d * d;
+        }
+    }
+
+    float maximum = 0.0f;
+    for(int i = 0; i < count; i++) {
+        saliency[i] = qSqrt(saliency[i]);
+        maximum = qMax(maximum, saliency[i]);
+    }
+
+    map.weights.resize(count);
+    for(int i = 0; i < count; i++) {
+        float level = maximum > 0.0f ? saliency[i] / maximum : 0.0f;
+        map.weights[i] = quint8(1 + qRound(level * (SaliencyMap::MaximumWeight - 1)));
+    }
+    return map;
+}
@@ -0,0 +1,30 @@
+#ifndef SALIENCY_H
+#define SALIENCY_H
+
+#include <QImage>
+#include <QVector>
+
+/*
+ * How much every part of an image stands out, on a small grid laid over the image. The weights
+ * go from 1 (background, e.g. a plain sky) to MaximumWeight (the most salient cell), so no
+ * pixel is ignored completely.
+ */
+struct SaliencyMap
+{
+    enum {
+        MapSide = 128,
+        MaximumWeight = 16
+    };
+
+    int width, height;
+    QVector<quint8> weights;
+
+    bool isEmpty() const
+    {
+        return weights.isEmpty();
+    }
+};
+
+SaliencyMap computeSaliency(const QImage &image);
+
+#endif // SALIENCY_H
@@ -0,0 +1,358 @@
+#include "sequencereader.h"
+#include "imageloader.h"
+#include "saliency.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QRegularExpression>
+#include <QThread>
+#include <QMetaObject>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace {
+
+// Encoded files waiting to be decoded, and decoded frames waiting to be analysed.
+const int ReadQueueSize = 8;
+const int DecodeQueueSize = 4;
+
+// How much of the previous palette stays in the next one.
+const double PaletteSmoothing = 0.6;
+
+struct SequenceFile
+{
+    qint64 number;
+    QString fileName;
+
+    bool operator<(const SequenceFile &other) const
+    {
+        return number < other.number || (number == other.number && fileName < other.fileName);
+    }
+};
+
+}
+
+/**
+ * @brief findSequenceFiles
+ * @param fileName any frame of the sequence, e.g. "render/frame_0042.png".
+ * @return all frames of the sequence in number order, or only fileName if its name has no
+ * number.
+ *
+ * The frames are the files of the same folder with the same name around the last number, the
+ * numbers may be padded or not.
+ */
+QStringList findSequenceFiles(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QRegularExpressionMatch match = QRegularExpression("^(.*?)(\\d+)(\\D*)$").match(info.fileName());
+    if(!match.hasMatch()) {
+        return QStringList(fileName);
+    }
+
+    QString prefix = match.captured(1);
+    QString suffix = match.captured(3);
+    QRegularExpression pattern("^" + QRegularExpression::escape(prefix) + "(\\d+)"
+                               + QRegularExpression::escape(suffix) + "$");
+
+    QDir dir = info.dir();
+    QStringList names = dir.entryList(QStringList(prefix + "*" + suffix), QDir::Files);
+    QVector<SequenceFile> files;
+    for(int i = 0; i < names.size(); i++) {
+        QRegularExpressionMatch frame = pattern.match(names[i]);
+        if(frame.hasMatch()) {
+            SequenceFile file;
+            file.number = frame.captured(1).toLongLong();
+            file.fileName = dir.filePath(names[i]);
+            files.push_back(file);
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    QStringList result;
+    for(int i = 0; i < files.size(); i++) {
+        result.push_back(files[i].fileName);
+    }
+    return result.isEmpty() ? QStringList(fileName) : result;
+}
+
+SequenceReader::SequenceReader(QObject *parent) : QObject(parent), readQueue(ReadQueueSize),
+    decodeQueue(DecodeQueueSize)
+{
+    colorCount = 7;
+    mode = RgbQuantize;
+    weighting = UniformWeighting;
+    generation = 0;
+    running = false;
+    deliverQueued = false;
+    background = false;
+    nextIndex = 0;
+}
+
+SequenceReader::~SequenceReader()
+{
+    cancel();
+}
+
+/**
+ * @brief SequenceReader::start
+ * @param fileNames the frames in order.
+ * @param colorCount the wanted palette size.
+ * @param mode the color space the histograms are cut in.
+ * @param weighting how much every pixel counts.
+ *
+ * Stop the sequence being read, if any, and read this one. The pipeline has its own threads:
+ * its stages wait on each other, and waiting threads of the global pool would starve the rest
+ * of the application.
+ */
+void SequenceReader::start(const QStringList &fileNames, int colorCount, QuantizeMode mode,
+                           PixelWeighting weighting)
+{
+    cancel();
+
+    this->fileNames = fileNames;
+    this->colorCount = colorCount;
+    this->mode = mode;
+    this->weighting = weighting;
+    format = QFileInfo(fileNames.value(0)).suffix().toLower().toLatin1();
+    generation++;
+    running = true;
+    nextIndex = 0;
+    previousPalette.clear();
+    globalPalette.clear();
+    histogram.clear();
+    cancelled.store(0);
+    readQueue.reset();
+    decodeQueue.reset();
+
+    // Decoding is the slowest stage, it gets most of the threads.
+    int workers = qMax(2, QThread::idealThreadCount() - 1);
+    int decoders = qMax(1, workers * 2 / 3);
+    int analysers = qMax(1, workers - decoders);
+    runningDecoders.store(decoders);
+    runningAnalysers.store(analysers);
+    pool.setMaxThreadCount(1 + decoders + analysers);
+
+    QtConcurrent::run(&pool, [this]() { readFiles(); });
+    for(int i = 0; i < decoders; i++) {
+        QtConcurrent::run(&pool, [this, i]() { decodeFrames(i); });
+    }
+    for(int i = 0; i < analysers; i++) {
+        QtConcurrent::run(&pool, [this, i]() { analyseFrames(i); });
+    }
+}
+
+/**
+ * @brief SequenceReader::cancel
+ *
+ * Stop every stage and wait for the threads. The frames not delivered yet are dropped.
+ */
+void SequenceReader::cancel()
+{
+    cancelled.store(1);
+    readQueue.clear();
+    readQueue.close();
+    decodeQueue.clear();
+    decodeQueue.close();
+    wakeWorkers();
+    pool.waitForDone();
+
+    QMutexLocker locker(&resultMutex);
+    analysedFrames.clear();
+    analysedHistograms.clear();
+    running = false;
+}
+
+/**
+ * @brief SequenceReader::setBackground
+ * @param background whether the tab of the sequence is hidden.
+ *
+ * The sequence of a hidden tab is read by one decoder and one analyser, so the documents on
+ * screen get the other cores. Reloads of hidden documents wait the same way.
+ */
+void SequenceReader::setBackground(bool background)
+{
+    QMutexLocker locker(&priorityMutex);
+    this->background = background;
+    if(!background) {
+        foreground.wakeAll();
+    }
+}
+
+/*
+ * Every worker but the first of its stage waits here while the sequence is in the background,
+ * until its tab is shown, the run is cancelled or its input ends.
+ */
+void SequenceReader::waitInBackground(int worker, BoundedQueue<Frame> &input)
+{
+    if(worker == 0) {
+        return;
+    }
+    QMutexLocker locker(&priorityMutex);
+    while(background && !cancelled.load() && !input.isClosed()) {
+        foreground.wait(&priorityMutex);
+    }
+}
+
+void SequenceReader::wakeWorkers()
+{
+    QMutexLocker locker(&priorityMutex);
+    foreground.wakeAll();
+}
+
+bool SequenceReader::isRunning() const
+{
+    return running;
+}
+
+QStringList SequenceReader::getFileNames() const
+{
+    return fileNames;
+}
+
+/**
+ * @brief SequenceReader::getGlobalPalette
+ * @return the palette of all frames together, once finishSignal() is sent.
+ */
+QVector<QColor> SequenceReader::getGlobalPalette() const
+{
+    return globalPalette;
+}
+
+/**
+ * @brief SequenceReader::readFiles
+ *
+ * The I/O stage: read every file into memory in order. A file which can't be read still goes
+ * down the pipeline, empty, so the frames after it aren't held back.
+ */
+void SequenceReader::readFiles()
+{
+    for(int i = 0; i < fileNames.size() && !cancelled.load(); i++) {
+        Frame frame;
+        frame.index = i;
+        QFile file(fileNames[i]);
+        if(file.open(QIODevice::ReadOnly)) {
+            frame.data = file.readAll();
+        }
+        if(!readQueue.push(frame)) {
+            break;
+        }
+    }
+    readQueue.close();
+    wakeWorkers();
+}
+
+/**
+ * @brief SequenceReader::decodeFrames
+ * @param worker the index of the decoder.
+ *
+ * The decode stage, run by several threads. The last decoder to finish closes the queue of
+ * the analysers.
+ */
+void SequenceReader::decodeFrames(int worker)
+{
+    Frame frame;
+    while(!cancelled.load()) {
+        waitInBackground(worker, readQueue);
+        if(!readQueue.pop(frame)) {
+            break;
+        }
+        frame.image = readImageData(frame.data, format);
+        frame.data = QByteArray();
+        if(!decodeQueue.push(frame)) {
+            break;
+        }
+    }
+    if(runningDecoders.fetchAndAddOrdered(-1) == 1) {
+        decodeQueue.close();
+        wakeWorkers();
+    }
+}
+
+/**
+ * @brief SequenceReader::analyseFrames
+ * @param worker the index of the analyser.
+ *
+ * The histogram stage, run by several threads. The frames finish out of order, they are kept
+ * until the main thread takes them in order.
+ */
+void SequenceReader::analyseFrames(int worker)
+{
+    Frame frame;
+    while(!cancelled.load()) {
+        waitInBackground(worker, decodeQueue);
+        if(!decodeQueue.pop(frame)) {
+            break;
+        }
+        ColorHistogram counts, weighted;
+        if(weighting == SaliencyWeighting) {
+            counts.add(frame.image, computeSaliency(frame.image), weighted);
+        }
+        else {
+            counts.add(frame.image);
+        }
+        const ColorHistogram &source = weighting == SaliencyWeighting ? weighted : counts;
+        frame.palette = quantizeHistogram(source, colorCount, mode);
+
+        QMutexLocker locker(&resultMutex);
+        histogram.add(source);
+        analysedFrames.insert(frame.index, frame);
+        analysedHistograms.insert(frame.index, counts);
+        if(!deliverQueued) {
+            deliverQueued = true;
+            QMetaObject::invokeMethod(this, "deliverFrames", Qt::QueuedConnection);
+        }
+    }
+    if(runningAnalysers.fetchAndAddOrdered(-1) == 1 && !cancelled.load()) {
+        QMetaObject::invokeMethod(this, "finishRun", Qt::QueuedConnection, Q_ARG(int, generation));
+    }
+}
+
+/**
+ * @brief SequenceReader::deliverFrames
+ *
+ * It's a slot function, run on the main thread.
+ * Send the analysed frames which are next in order, with their palettes smoothed.
+ */
+void SequenceReader::deliverFrames()
+{
+    QVector<Frame> frames;
+    QVector<ColorHistogram> histograms;
+    {
+        QMutexLocker locker(&resultMutex);
+        deliverQueued = false;
+        while(analysedFrames.contains(nextIndex)) {
+            frames.push_back(analysedFrames.take(nextIndex));
+            histograms.push_back(analysedHistograms.take(nextIndex));
+            nextIndex++;
+        }
+    }
+
+    for(int i = 0; i < frames.size(); i++) {
+        if(!frames[i].palette.isEmpty()) {
+            frames[i].palette = smoothPalette(previousPalette, frames[i].palette, PaletteSmoothing);
+            previousPalette = frames[i].palette;
+        }
+        emit frameReadySignal(frames[i].index, frames[i].image, frames[i].palette, histograms[i]);
+    }
+}
+
+/**
+ * @brief SequenceReader::finishRun
+ * @param generation the run which finished, an older run may finish after it was cancelled.
+ *
+ * It's a slot function, run on the main thread.
+ */
+void SequenceReader::finishRun(int generation)
+{
+    if(generation != this->generation || !running) {
+        return;
+    }
+    deliverFrames();
+
+    running = false;
+    {
+        QMutexLocker locker(&resultMutex);
+        globalPalette = quantizeHistogram(histogram.toHistogram(), colorCount, mode);
+    }
+    emit finishSignal();
+}
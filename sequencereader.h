@@ -0,0 +1,170 @@
+#ifndef SEQUENCEREADER_H
+#define SEQUENCEREADER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include <QColor>
+#include <QQueue>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QAtomicInt>
+
+#include "paletteengine.h"
+
+/*
+ * A queue between two pipeline stages. push() waits while it's full, so a fast stage can't run
+ * ahead of a slow one and fill the memory; pop() waits while it's empty. After close() the
+ * items left can still be popped, then pop() returns false.
+ */
+template <class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity) : capacity(capacity), closed(false)
+    {
+    }
+
+    bool push(const T &item)
+    {
+        QMutexLocker locker(&mutex);
+        while(items.size() >= capacity && !closed) {
+            notFull.wait(&mutex);
+        }
+        if(closed) {
+            return false;
+        }
+        items.enqueue(item);
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        QMutexLocker locker(&mutex);
+        while(items.isEmpty() && !closed) {
+            notEmpty.wait(&mutex);
+        }
+        if(items.isEmpty()) {
+            return false;
+        }
+        item = items.dequeue();
+        notFull.wakeOne();
+        return true;
+    }
+
+    bool isClosed()
+    {
+        QMutexLocker locker(&mutex);
+        return closed;
+    }
+
+    void close()
+    {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        notEmpty.wakeAll();
+        notFull.wakeAll();
+    }
+
+    void reset()
+    {
+        QMutexLocker locker(&mutex);
+        items.clear();
+        closed = false;
+    }
+
+    void clear()
+    {
+        QMutexLocker locker(&mutex);
+        items.clear();
+        notFull.wakeAll();
+    }
+private:
+    QMutex mutex;
+    QWaitCondition notEmpty, notFull;
+    QQueue<T> items;
+    int capacity;
+    bool closed;
+};
+
+QStringList findSequenceFiles(const QString &fileName);
+
+/*
+ * Reads a numbered image sequence (frame_0001.png, frame_0002.png...) in a pipeline: one thread
+ * reads the files, several decode them and several count their colors, joined by bounded
+ * queues. The frames are delivered in order on the main thread, with their palettes smoothed
+ * over time so the swatches don't flicker.
+ */
+class SequenceReader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SequenceReader(QObject *parent = 0);
+    ~SequenceReader();
+
+    void start(const QStringList &fileNames, int colorCount, QuantizeMode mode = RgbQuantize,
+               PixelWeighting weighting = UniformWeighting);
+    void cancel();
+    void setBackground(bool background);
+    bool isRunning() const;
+    QStringList getFileNames() const;
+    QVector<QColor> getGlobalPalette() const;
+private:
+    struct Frame
+    {
+        int index;
+        QByteArray data;
+        QImage image;
+        QVector<QColor> palette;
+    };
+
+    QThreadPool pool;
+    BoundedQueue<Frame> readQueue, decodeQueue;
+    QAtomicInt cancelled, runningDecoders, runningAnalysers;
+
+    QStringList fileNames;
+    QByteArray format;
+    int colorCount;
+    QuantizeMode mode;
+    PixelWeighting weighting;
+    int generation;
+    bool running;
+
+    // Shared with the analysers.
+    QMutex resultMutex;
+    QMap<int, Frame> analysedFrames;
+    QMap<int, ColorHistogram> analysedHistograms;
+    HistogramAccumulator histogram;
+    bool deliverQueued;
+
+    // Set by the main thread, the workers wait on it.
+    QMutex priorityMutex;
+    QWaitCondition foreground;
+    bool background;
+
+    // Only used on the main thread.
+    int nextIndex;
+    QVector<QColor> previousPalette, globalPalette;
+
+    void readFiles();
+    void decodeFrames(int worker);
+    void analyseFrames(int worker);
+    void waitInBackground(int worker, BoundedQueue<Frame> &input);
+    void wakeWorkers();
+private slots:
+    void deliverFrames();
+    void finishRun(int generation);
+signals:
+    void frameReadySignal(int index, const QImage &frame, const QVector<QColor> &palette,
+                          const ColorHistogram &histogram);
+    void finishSignal();
+};
+
+#endif // SEQUENCEREADER_H
@@ -0,0 +1,95 @@
+#include "startup.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QTextStream>
+#include <QVector>
+
+namespace {
+
+QElapsedTimer startupTimer;
+QVector<QPair<QString, qint64> > startupMarks;
+qint64 benchmarkThreshold = -1;
+bool firstFrameShown = false;
+
+}
+
+/**
+ * @brief startupStart
+ *
+ * Call it first in main().
+ */
+void startupStart()
+{
+    startupTimer.start();
+}
+
+void startupMark(const QString &stage)
+{
+    startupMarks.push_back(qMakePair(stage, startupTimer.elapsed()));
+}
+
+/**
+ * @brief startupSetBenchmark
+ * @param thresholdMs the longest accepted time to the first frame.
+ *
+ * In the benchmark, the app quits at the first frame, with exit code 1 if it was too slow.
+ */
+void startupSetBenchmark(qint64 thresholdMs)
+{
+    benchmarkThreshold = thresholdMs;
+}
+
+/**
+ * @brief startupFirstFrame
+ *
+ * The main window calls it once its first frame is painted.
+ */
+void startupFirstFrame()
+{
+    if(firstFrameShown) {
+        return;
+    }
+    firstFrameShown = true;
+    startupMark("first frame");
+
+    if(benchmarkThreshold >= 0 || qEnvironmentVariableIsSet("MYPAINT_STARTUP_TRACE")) {
+        QTextStream(stderr) << startupReport();
+    }
+
+    if(benchmarkThreshold >= 0) {
+        bool passed = startupElapsed() <= benchmarkThreshold;
+        QTextStream(stderr) << (passed ? "PASS" : "FAIL") << ": first frame after " << startupElapsed()
+                            << " ms, threshold " << benchmarkThreshold << " ms\n";
+        QCoreApplication::exit(passed ? 0 : 1);
+    }
+}
+
+/**
+ * @brief startupElapsed
+ * @return the time from main() to the first frame, or to now if it's not shown yet.
+ */
+qint64 startupElapsed()
+{
+    for(int i = 0; i < startupMarks.size(); i++) {
+        if(startupMarks[i].first == "first frame") {
+            return startupMarks[i].second;
+        }
+    }
+    return startupTimer.elapsed();
+}
+
+QString startupReport()
+{
+    QString report;
+    QTextStream out(&report);
+    out.setFieldAlignment(QTextStream::AlignLeft);
+    qint64 previous = 0;
+    for(int i = 0; i < startupMarks.size(); i++) {
+        out << qSetFieldWidth(16) << startupMarks[i].first << qSetFieldWidth(0)
+            << startupMarks[i].second << " ms (+" << startupMarks[i].second - previous << ")\n";
+        previous = startupMarks[i].second;
+    }
+    out.flush();
+    return report;
+}
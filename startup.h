@@ -0,0 +1,18 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <QString>
+
+/*
+ * Startup instrumentation: the time from main() to the first frame of the main window, with
+ * marks for the stages in between. The report is printed when MYPAINT_STARTUP_TRACE is set,
+ * and by the startup benchmark.
+ */
+void startupStart();
+void startupMark(const QString &stage);
+void startupSetBenchmark(qint64 thresholdMs);
+void startupFirstFrame();
+qint64 startupElapsed();
+QString startupReport();
+
+#endif // STARTUP_H
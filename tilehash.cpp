@@ -0,0 +1,113 @@
+#include "tilehash.h"
+#include <QPair>
+#include <QtConcurrent>
+#include <cstring>
+
+namespace {
+
+// The side of a hashed tile, changedTiles() returns rectangles of this size.
+const int TileSize = 64;
+
+inline quint64 mix(quint64 hash, quint64 word)
+{
+    hash ^= word;
+    hash *= Q_UINT64_C(0x9e3779b97f4a7c15);
+    return hash ^ (hash >> 29);
+}
+
+/*
+ * Hash every tile of one row of tiles. Each tile line is read 8 bytes at a time.
+ */
+struct TileRowHasher
+{
+    const QImage *image;
+    quint64 *hashes;
+    int columns;
+
+    void operator()(int tileRow) const
+    {
+        int bytesPerPixel = image->depth() / 8;
+        int top = tileRow * TileSize;
+        int bottom = qMin(image->height(), top + TileSize);
+
+        for(int column = 0; column < columns; column++) {
+            int left = column * TileSize;
+            int bytes = (qMin(image->width(), left + TileSize) - left) * bytesPerPixel;
+            quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+
+            for(int y = top; y < bottom; y++) {
+                const uchar *line = image->constScanLine(y) + left * bytesPerPixel;
+                int i = 0;
+                for(; i + 8 <= bytes; i += 8) {
+                    quint64 word;
+                    memcpy(&word, line + i, 8);
+                    hash = mix(hash, word);
+                }
+                if(i < bytes) {
+                    quint64 word = 0;
+                    memcpy(&word, line + i, bytes - i);
+                    hash = mix(hash, word);
+                }
+            }
+            hashes[tileRow * columns + column] = hash;
+        }
+    }
+};
+
+}
+
+/**
+ * @brief hashTiles
+ * @param image the decoded image.
+ * @return the hash of every tile, row by row.
+ *
+ * Rows of tiles are hashed in parallel. Images with less than 8 bits per pixel are hashed from
+ * a 32 bit copy.
+ */
+QVector<quint64> hashTiles(const QImage &image)
+{
+    QImage source = image.depth() < 8 ? image.convertToFormat(QImage::Format_ARGB32) : image;
+
+    int columns = (source.width() + TileSize - 1) / TileSize;
+    int rows = (source.height() + TileSize - 1) / TileSize;
+    QVector<quint64> hashes(columns * rows);
+
+    QVector<int> tileRows(rows);
+    for(int i = 0; i < rows; i++) {
+        tileRows[i] = i;
+    }
+
+    TileRowHasher hasher;
+    hasher.image = &source;
+    hasher.hashes = hashes.data();
+    hasher.columns = columns;
+    QtConcurrent::blockingMap(tileRows, hasher);
+
+    return hashes;
+}
+
+/**
+ * @brief changedTiles
+ * @param image the new image, the same size as the previous one.
+ * @param previous the tile hashes of the previous image.
+ * @param current the tile hashes of the new image.
+ * @return the rect of every tile whose hash changed.
+ */
+QVector<QRect> changedTiles(const QImage &image, const QVector<quint64> &previous,
+                            const QVector<quint64> &current)
+{
+    QVector<QRect> tiles;
+    int columns = (image.width() + TileSize - 1) / TileSize;
+    if(previous.size() != current.size()) {
+        tiles.push_back(image.rect());
+        return tiles;
+    }
+
+    for(int i = 0; i < current.size(); i++) {
+        if(previous[i] != current[i]) {
+            QRect tile((i % columns) * TileSize, (i / columns) * TileSize, TileSize, TileSize);
+            tiles.push_back(tile.intersected(image.rect()));
+        }
+    }
+    return tiles;
+}
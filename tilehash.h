@@ -0,0 +1,27 @@
+#ifndef TILEHASH_H
+#define TILEHASH_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+/*
+ * What changed when the open file was written again. If the frame count, a frame size or the
+ * pixel format changed, the image is reloaded completely and resized is true.
+ */
+struct FrameChanges
+{
+    bool resized;
+    QVector<QImage> previousFrames;
+    QVector<QVector<QRect> > tiles;
+};
+
+/*
+ * An image is compared with its previous version tile by tile: every 64 * 64 tile has a 64 bit
+ * hash of its pixels, tiles are stored row by row.
+ */
+QVector<quint64> hashTiles(const QImage &image);
+QVector<QRect> changedTiles(const QImage &image, const QVector<quint64> &previous,
+                            const QVector<quint64> &current);
+
+#endif // TILEHASH_H
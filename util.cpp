@@ -6,11 +6,22 @@
  * @return the color string (one of RGB, HSL, CMYK...)
  *
  * According to the setting, convert the QColor to string.
+ * A color of a 16-bit image which can't be written with 8 bits per channel is written with 16
+ * bits, e.g. #1234abcd5678, which QColor reads back exactly.
  */
 QString qcolorToString(QColor color)
 {
+    QRgba64 rgba64 = color.rgba64();
+    bool wide = rgba64.red() % 0x101 != 0 || rgba64.green() % 0x101 != 0 || rgba64.blue() % 0x101 != 0;
+
     QString colorValue;
     colorValue += "#";
+    if(wide) {
+        colorValue += QString("%1").arg(rgba64.red(), 4, 16, QChar('0'));
+        colorValue += QString("%1").arg(rgba64.green(), 4, 16, QChar('0'));
+        colorValue += QString("%1").arg(rgba64.blue(), 4, 16, QChar('0'));
+        return colorValue;
+    }
     colorValue += decToHexString(color.red());
     colorValue += decToHexString(color.green());
     colorValue += decToHexString(color.blue());
@@ -1,6 +1,7 @@
 #include "workarea.h"
 #include "imagecontainer.h"
 #include "colorboard.h"
+#include "histogrampanel.h"
 #include <QGridLayout>
 
 WorkArea::WorkArea(QWidget *parent) : QWidget(parent)
@@ -8,11 +9,25 @@ WorkArea::WorkArea(QWidget *parent) : QWidget(parent)
     QGridLayout *layout = new QGridLayout(this);
     imageContainer = new ImageContainer(this);
     colorBoard = new ColorBoard(this);
+    histogramPanel = new HistogramPanel(this);
 
-    layout->addWidget(imageContainer, 0, 0, 1, 3);
+    layout->addWidget(imageContainer, 0, 0, 2, 3);
     layout->addWidget(colorBoard, 0, 3, 1, 1);
+    layout->addWidget(histogramPanel, 1, 3, 1, 1);
 
     setLayout(layout);
+
+    connect(imageContainer,
+            SIGNAL(imageReloadSignal(FrameChanges)),
+            SLOT(reloadColorBoard(FrameChanges)));
+    connect(imageContainer,
+            SIGNAL(frameChangeSignal(int)),
+            colorBoard,
+            SLOT(showFrameColors(int)));
+    connect(imageContainer,
+            SIGNAL(visibleRectChangeSignal(QRect)),
+            histogramPanel,
+            SLOT(setVisibleRect(QRect)));
 }
 
 ImageContainer *WorkArea::getImageContainer() const
@@ -24,3 +39,44 @@ ColorBoard *WorkArea::getColorBoard() const
 {
     return colorBoard;
 }
+
+HistogramPanel *WorkArea::getHistogramPanel() const
+{
+    return histogramPanel;
+}
+
+/**
+ * @brief WorkArea::analyseImage
+ *
+ * Create the color board of the image just loaded.
+ */
+void WorkArea::analyseImage()
+{
+    colorBoard->setColorLabels(imageContainer->getFrames());
+}
+
+/**
+ * @brief WorkArea::setActive
+ * @param active whether the document is on screen, in the current tab or in the compare view.
+ */
+void WorkArea::setActive(bool active)
+{
+    imageContainer->setActive(active);
+}
+
+/**
+ * @brief WorkArea::reloadColorBoard
+ * @param changes what changed in the open file.
+ *
+ * It's a slot function.
+ * When the open file is written again, update the color board from the changed tiles only, or
+ * analyse it again if the image was reloaded completely.
+ */
+void WorkArea::reloadColorBoard(const FrameChanges &changes)
+{
+    if(changes.resized) {
+        analyseImage();
+        return;
+    }
+    colorBoard->updateColorLabels(changes.previousFrames, imageContainer->getFrames(), changes.tiles);
+}
@@ -6,7 +6,13 @@
 
 #include "imagecontainer.h"
 #include "colorboard.h"
+#include "histogrampanel.h"
+#include "tilehash.h"
 
+/*
+ * One open document: the image, its color board and its histogram. Every tab of the main window
+ * is a work area, they share the worker threads, the memory budget and the tile cache.
+ */
 class WorkArea : public QWidget
 {
     Q_OBJECT
@@ -15,11 +21,18 @@ public:
 
     ImageContainer *getImageContainer() const;
     ColorBoard *getColorBoard() const;
+    HistogramPanel *getHistogramPanel() const;
+
+    void analyseImage();
+    void setActive(bool active);
 
 private:
     QGridLayout *layout;
     ImageContainer *imageContainer;
     ColorBoard *colorBoard;
+    HistogramPanel *histogramPanel;
+public slots:
+    void reloadColorBoard(const FrameChanges &changes);
 };
 
 #endif // WORKAREA_H